@@ -25,7 +25,7 @@ void EventDispatcher::UnregisterListener(EventListener* listener) {
 	}
 }
 
-void EventDispatcher::DispatchEvent(InputEvent event) {
+void EventDispatcher::DispatchEvent(const InputEvent& event) {
 	for (EventListener* listener : mListeners) {
 		listener->HandleEvent(event);
 	}
@@ -55,7 +55,7 @@ class EventListener {
 public:
 	virtual ~EventListener() { }
 
-	virtual bool HandleEvent(InputEvent event) = 0;
+	virtual bool HandleEvent(const InputEvent& event) = 0;
 };
 
 class EventDispatcher {
@@ -64,7 +64,7 @@ public:
 	
 	void PollEvents();
 
-	void DispatchEvent(InputEvent event);
+	void DispatchEvent(const InputEvent& event);
 
 	void RegisterListener(EventListener* listener);
 	void UnregisterListener(EventListener* listener);
@@ -6,13 +6,15 @@
 Game::Game()
 	: mInitialized(false)
 	, mRunning(false)
-	, mPaused(false)
-	, mCurrTime(0)
-	, mLastTime(0)
 	, mWindow(nullptr)
 	, mRenderer(nullptr)
 	, mFramebuffer(nullptr)
-	, mFB(nullptr)
+	, mFramesRendered(0)
+	, mFramesPresented(0)
+	, mPaused(false)
+	, mDebugging(false)
+	, mPendingStep(StepMode_None)
+	, mExiting(false)
 	, mEventDispatcher(nullptr)
 	, mRDRAM(nullptr)
 	, mHiddenRAM(nullptr)
@@ -52,16 +54,20 @@ bool Game::Initialize() {
 
 	mFramebuffer = SDL_CreateTexture(mRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, 640, 480);
 
-	mFB = std::make_unique<uint8_t[]>(8 * 1024 * 1024);
+	for (std::unique_ptr<uint8_t[]>& frame : mFrames)
+		frame = std::make_unique<uint8_t[]>(8 * 1024 * 1024);
 	mRDRAM = std::make_unique<uint8_t[]>(8 * 1024 * 1024);
 	mHiddenRAM = std::make_unique<uint8_t[]>(8 * 1024 * 1024);
 	
 	mCapture = new pin64_t();
-	mCapture->play(0);
 
+	// the player has to be attached before play() so that looping can
+	// restore its starting state
 	mRDP = new n64_rdp((uint32_t*)mRDRAM.get());
 	mRDP->init_internal_state(mCapture);
 
+	mCapture->play(0);
+
 	return true;
 }
 
@@ -69,61 +75,209 @@ static double mix(double a, double b, double factor) {
 	return a + (b - a) * factor;
 }
 
-void Game::Render(double delta) {
-	if (!mPaused) {
-		if (!mCapture->playing()) {
+void Game::RenderThread() {
+	for (;;) {
+		uint32_t* frame;
+		bool debugging;
+		StepMode step;
+		{
+			std::unique_lock<std::mutex> lock(mFrameMutex);
+			mRenderWake.wait(lock, [this] {
+				if (mExiting)
+					return true;
+				if (mFramesRendered - mFramesPresented == FRAME_COUNT || mPaused)
+					return false;
+				// the debugger only moves on when asked to
+				return !mDebugging || mPendingStep != StepMode_None;
+			});
+			if (mExiting)
+				return;
+
+			frame = reinterpret_cast<uint32_t*>(mFrames[mFramesRendered % FRAME_COUNT].get());
+			debugging = mDebugging;
+			step = mPendingStep;
+			mPendingStep = StepMode_None;
+		}
+
+		bool rendered;
+		{
+			std::lock_guard<std::mutex> lock(mRenderMutex);
+			rendered = Render(frame, debugging, step);
+		}
+
+		if (rendered) {
+			std::lock_guard<std::mutex> lock(mFrameMutex);
+			mFramesRendered++;
+		}
+	}
+}
+
+bool Game::Render(uint32_t* frame, bool debugging, StepMode step) {
+	if (!mCapture->playing()) {
+		if (!mCapture->rewind())
 			mCapture->play(0);
-		} else {
-			if (mRDP->commands_available()) {
-				mRDP->process_command();
-				mCapture->next_command();
-			} else {
-				mCapture->mark_frame(running_machine());
-				
-				mRDP->screen_update(reinterpret_cast<uint32_t*>(mFB.get()));
+		return false;
+	}
 
-				SDL_UpdateTexture(mFramebuffer, nullptr, mFB.get(), 640 * 4);
+	if (debugging)
+		return Step(frame, step);
 
-				SDL_SetRenderDrawColor(mRenderer, 0, 0, 0, 0xff);
-				SDL_RenderClear(mRenderer);
-				SDL_RenderCopy(mRenderer, mFramebuffer, nullptr, nullptr);
-				SDL_RenderPresent(mRenderer);
-			}
+	mRDP->process_command_list();
+	EndFrame();
+	mRDP->screen_update(frame);
+	return true;
+}
+
+bool Game::Step(uint32_t* frame, StepMode mode) {
+	const uint32_t frame_index = mCapture->current_frame();
+
+	switch (mode) {
+	case StepMode_Frame:
+		mRDP->process_command_list();
+		EndFrame();
+		break;
+
+	case StepMode_Command:
+		if (!mRDP->commands_available()) {
+			EndFrame();
+			break;
+		}
+		mRDP->step_command();
+		mCapture->next_command();
+		break;
+
+	case StepMode_Scanline:
+		if (!mRDP->commands_available()) {
+			EndFrame();
+			break;
+		}
+		if (mRDP->step_scanline())
+			mCapture->next_command();
+		break;
+
+	default:
+		return false;
+	}
+
+	if (mode != StepMode_Frame && frame_index == mCapture->current_frame()) {
+		char text[4000];
+		mRDP->disassemble(text, sizeof(text));
+		Logger::Log("Frame %u, %u commands left: %s\n", frame_index, mCapture->commands_left(), text);
+	} else {
+		Logger::Log("Frame %u\n", mCapture->current_frame());
+	}
+
+	mRDP->screen_update(frame);
+	return true;
+}
+
+void Game::EndFrame() {
+	running_machine machine;
+	mCapture->mark_frame(machine);
+}
+
+void Game::Present() {
+	const uint8_t* frame = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mFrameMutex);
+		if (mFramesPresented != mFramesRendered)
+			frame = mFrames[mFramesPresented % FRAME_COUNT].get();
+	}
+
+	if (frame) {
+		SDL_UpdateTexture(mFramebuffer, nullptr, frame, 640 * 4);
+		{
+			std::lock_guard<std::mutex> lock(mFrameMutex);
+			mFramesPresented++;
 		}
+		mRenderWake.notify_one();
 	}
+
+	// the last frame is presented again until a new one is ready, which also
+	// paces this loop to the display
+	SDL_SetRenderDrawColor(mRenderer, 0, 0, 0, 0xff);
+	SDL_RenderClear(mRenderer);
+	SDL_RenderCopy(mRenderer, mFramebuffer, nullptr, nullptr);
+	SDL_RenderPresent(mRenderer);
 }
 
 void Game::Run() {
 	mRunning = true;
+	mRenderThread = std::thread(&Game::RenderThread, this);
 
 	while (mRunning) {
-		
-		mLastTime = mCurrTime;
-		mCurrTime = SDL_GetPerformanceCounter();
-		uint64_t timeDelta = mCurrTime - mLastTime;
-		double secondsDelta = double(timeDelta * 1000) / SDL_GetPerformanceFrequency();
-		Render(secondsDelta);
-
+		Present();
 		mEventDispatcher->PollEvents();
 	}
+
+	{
+		std::lock_guard<std::mutex> lock(mFrameMutex);
+		mExiting = true;
+	}
+	mRenderWake.notify_one();
+	mRenderThread.join();
 }
 
-bool Game::HandleEvent(InputEvent event) {
+bool Game::HandleEvent(const InputEvent& event) {
 	switch (event.GetType()) {
 	case EventType_Quit:
 		mRunning = false;
 		return true;
 	case EventType_KeyDown:
 	{
-		KeyDownEvent& keyEvent = reinterpret_cast<KeyDownEvent&>(event);
-		if (keyEvent.key().sym == SDLK_p) {
+		const KeyDownEvent& keyEvent = static_cast<const KeyDownEvent&>(event);
+		const SDL_Keycode sym = keyEvent.key().sym;
+		if (sym == SDLK_p) {
 			mEventDispatcher->DispatchEvent(PauseEvent());
+			return true;
+		} else if (sym == SDLK_k) {
+			std::lock_guard<std::mutex> lock(mRenderMutex);
+			if (!mCapture->build_keyframes(0))
+				Logger::Log("Unable to build keyframes for pin64_0.cap\n");
+			mCapture->play(0);
+			return true;
+		} else if (sym == SDLK_v) {
+			std::lock_guard<std::mutex> lock(mRenderMutex);
+			mCapture->set_validate(!mCapture->validating());
+			Logger::Log("Frame validation %s\n", mCapture->validating() ? "on" : "off");
+			return true;
+		} else if (sym == SDLK_o) {
+			std::lock_guard<std::mutex> lock(mRenderMutex);
+			if (!mCapture->optimize(0))
+				Logger::Log("Unable to optimize pin64_0.cap\n");
+			mCapture->play(0);
+			return true;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mFrameMutex);
+			if (sym == SDLK_d) {
+				mDebugging = !mDebugging;
+				mPendingStep = StepMode_None;
+				Logger::Log("Debugger %s\n", mDebugging ? "on, f/c/s step a frame, command or scanline" : "off");
+			} else if (mDebugging && sym == SDLK_f) {
+				mPendingStep = StepMode_Frame;
+			} else if (mDebugging && sym == SDLK_c) {
+				mPendingStep = StepMode_Command;
+			} else if (mDebugging && sym == SDLK_s) {
+				mPendingStep = StepMode_Scanline;
+			} else {
+				return false;
+			}
 		}
+		mRenderWake.notify_one();
+		return true;
 	}
 
 	case EventType_Pause:
-		mPaused = !mPaused;
+	{
+		{
+			std::lock_guard<std::mutex> lock(mFrameMutex);
+			mPaused = !mPaused;
+		}
+		mRenderWake.notify_one();
 		return true;
 	}
+	}
 	return false;
-}
\ No newline at end of file
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 #include "EventDispatcher.h"
 #include "video/n64.h"
@@ -18,22 +21,53 @@ public:
 	void Run();
 
 	// EventListener
-	bool HandleEvent(InputEvent event) override;
+	bool HandleEvent(const InputEvent& event) override;
 
 private:
-	void Render(double delta);
+	// granularities the debugger can step playback by
+	enum StepMode {
+		StepMode_None,
+		StepMode_Frame,
+		StepMode_Command,
+		StepMode_Scanline
+	};
+
+	// render thread
+	void RenderThread();
+	bool Render(uint32_t* frame, bool debugging, StepMode step);
+	bool Step(uint32_t* frame, StepMode mode);
+	void EndFrame();
+
+	// main thread
+	void Present();
+
+	static const uint32_t FRAME_COUNT = 3;
 
 	bool mInitialized;
 	bool mRunning;
-	bool mPaused;
-	
-	uint64_t mCurrTime;
-	uint64_t mLastTime;
-	
+
 	SDL_Window* mWindow;
 	SDL_Renderer* mRenderer;
 	SDL_Texture* mFramebuffer;
-	std::unique_ptr<uint8_t[]> mFB;
+
+	// the render thread fills frames in order and the main thread presents
+	// them in the same order; the render thread only waits once all of them
+	// are waiting to be presented. everything here is guarded by mFrameMutex
+	std::unique_ptr<uint8_t[]> mFrames[FRAME_COUNT];
+	uint32_t mFramesRendered;
+	uint32_t mFramesPresented;
+	bool mPaused;
+	bool mDebugging;
+	StepMode mPendingStep;
+	bool mExiting;
+
+	std::thread mRenderThread;
+	std::mutex mFrameMutex;
+	std::condition_variable mRenderWake;
+
+	// held by the render thread while it runs the capture, and by the main
+	// thread around anything else that touches mCapture or mRDP
+	std::mutex mRenderMutex;
 
 	EventDispatcher* mEventDispatcher;
 
@@ -2,6 +2,7 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
 #include <stdarg.h>
 
 typedef uint32_t u32;
@@ -1,9 +1,15 @@
 #include <iostream>
+#include <cstring>
 #include <SDL.h>
 #include "Logger.h"
 #include "Game.h"
+#include "pin64/catalog.h"
+
+int main(int argc, char** argv) {
+	// queries over a directory of captures run without opening a window
+	if (argc > 1 && strcmp(argv[1], "catalog") == 0)
+		return pin64_catalog_t::command(argc - 2, argv + 2);
 
-int main(int, char**) {
 	Logger::StartLogging("run.log");
 	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
 		Logger::Log("SDL Init Error: %s\n", SDL_GetError());
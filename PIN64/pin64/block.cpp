@@ -2,13 +2,18 @@
 // copyright-holders:Ryan Holtz
 
 #include "block.h"
+#include "pin64.h"
+
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
 
-#ifdef PIN64_STANDALONE_BUILD
-#include <CRC.h>
-#endif
 
 const uint8_t pin64_block_t::BLOCK_ID[4] = { 'P', '6', '4', 'B' };
 
+static const uint64_t CHECK_SEED = 0x50494e3634434b53ULL; // "PIN64CKS"
+static const int COMPRESS_LEVEL = Z_DEFAULT_COMPRESSION;
+
 pin64_block_t::pin64_block_t(uint8_t* data, size_t size)
 	: pin64_block_t() {
 	m_data.put(data, size);
@@ -21,26 +26,189 @@ pin64_block_t::pin64_block_t(pin64_data_t* data, size_t size)
 	finalize();
 }
 
-void pin64_block_t::finalize() {
-	if (m_data.size() > 0)
+pin64_block_t::pin64_block_t(const uint8_t* data, size_t size, uint64_t hash, uint32_t flags)
+	: pin64_block_t() {
+	m_hash = hash;
+	m_flags = flags;
+	if (compressed())
+		m_stored.view(data, size);
+	else
+		m_data.view(data, size);
+}
+
+uint64_t pin64_block_t::calculate_hash(const uint8_t* data, size_t size, uint32_t seed) {
+	return pin64_hash64(data, size, seed);
+}
+
+uint32_t pin64_block_t::calculate_crc32(const uint8_t* data, size_t size) {
+	if (size == 0)
+		return ~0;
 #ifdef PIN64_STANDALONE_BUILD
-		m_crc32 = CRC::Calculate(m_data.bytes(), m_data.size(), CRC::CRC_32());
+	// zlib's word-at-a-time CRC-32, which matches CRCpp's CRC_32 table loop
+	uLong crc = crc32(0L, Z_NULL, 0);
+	while (size > 0) {
+		const uInt length = (uInt)std::min<size_t>(size, 0x40000000);
+		crc = crc32(crc, data, length);
+		data += length;
+		size -= length;
+	}
+	return (uint32_t)crc;
 #else
-		m_crc32 = (uint32_t)util::crc32_creator::simple(m_data.bytes(), (uint32_t)m_data.size());
+	return (uint32_t)util::crc32_creator::simple(data, (uint32_t)size);
 #endif
-	else
-		m_crc32 = ~0;
+}
+
+size_t pin64_block_t::header_size(uint32_t revision) {
+	if (revision == 0) {
+		return sizeof(uint8_t) * 4  // block header
+			+ sizeof(uint32_t)      // data CRC32
+			+ sizeof(uint32_t);     // data size
+	}
+
+	return sizeof(uint8_t) * 4  // block header
+		+ sizeof(uint64_t)      // data hash
+		+ sizeof(uint32_t)      // flags
+		+ sizeof(uint32_t);     // data size
+}
+
+void pin64_block_t::finalize() {
+	m_flags &= ~SEED_MASK;
+	m_hash = calculate_hash(m_data.bytes(), m_data.size(), 0);
 	m_data.reset();
 }
 
+void pin64_block_t::rehash() {
+	const uint32_t next_seed = seed() + 1;
+	if (next_seed > SEED_MASK)
+		fatalerror("PIN64: Unable to find a unique id for block %08x%08x\n", (uint32_t)(m_hash >> 32), (uint32_t)m_hash);
+
+	m_flags = (m_flags & ~SEED_MASK) | next_seed;
+	m_hash = calculate_hash(m_data.bytes(), m_data.size(), next_seed);
+}
+
+bool pin64_block_t::matches(pin64_block_t* other) {
+	if (data_size() != other->data_size() || chunked() != other->chunked())
+		return false;
+
+	if (m_released)
+		return m_check == pin64_hash64(other->data()->bytes(), other->data_size(), CHECK_SEED);
+
+	return data_size() == 0 || memcmp(m_data.bytes(), other->data()->bytes(), data_size()) == 0;
+}
+
+void pin64_block_t::release() {
+	if (m_released)
+		return;
+
+	m_check = pin64_hash64(m_data.bytes(), m_data.size(), CHECK_SEED);
+	m_released_size = m_data.size();
+	m_released_stored_size = stored_size();
+	m_released = true;
+	m_data.clear();
+	m_stored.clear();
+}
+
 void pin64_block_t::clear() {
-	m_crc32 = 0;
+	m_hash = 0;
+	m_flags = 0;
+	m_released = false;
+	m_released_size = 0;
+	m_released_stored_size = 0;
+	m_data.clear();
+	m_stored.clear();
+}
+
+bool pin64_block_t::compress() {
+	if (compressed() || chunked() || m_released || m_data.size() < COMPRESS_MIN_SIZE)
+		return false;
+
+	const uLong raw_size = (uLong)m_data.size();
+	uLongf packed_size = compressBound(raw_size);
+
+	uint8_t* stored = m_stored.resize(4 + packed_size);
+	if (compress2(stored + 4, &packed_size, m_data.bytes(), raw_size, COMPRESS_LEVEL) != Z_OK || (4 + packed_size) >= raw_size) {
+		m_stored.clear();
+		return false;
+	}
+
+	stored[0] = (uint8_t)(raw_size >> 24);
+	stored[1] = (uint8_t)(raw_size >> 16);
+	stored[2] = (uint8_t)(raw_size >> 8);
+	stored[3] = (uint8_t)raw_size;
+	m_stored.resize(4 + packed_size);
+
+	m_flags |= FLAG_COMPRESSED;
+	return true;
+}
+
+bool pin64_block_t::decompress() {
+	if (!compressed() || m_released || m_data.size() > 0)
+		return true;
+
+	if (!inflate(m_stored.bytes(), m_stored.size(), &m_data))
+		return false;
+
+	m_data.reset();
+	return true;
+}
+
+// checks the contents against the id; legacy captures identify blocks by
+// CRC32, and compressed blocks must have been decompressed first
+bool pin64_block_t::verify(uint32_t revision) {
+	if (revision == 0)
+		return calculate_crc32(m_data.bytes(), m_data.size()) == m_hash;
+
+	return calculate_hash(m_data.bytes(), m_data.size(), seed()) == m_hash;
+}
+
+bool pin64_block_t::inflate(const uint8_t* stored, size_t stored_size, pin64_data_t* out) {
+	if (stored_size < 4)
+		return false;
+
+	const uint32_t raw_size = ((uint32_t)stored[0] << 24) | ((uint32_t)stored[1] << 16) | ((uint32_t)stored[2] << 8) | stored[3];
+	if (raw_size == 0)
+		return false;
+
+	uLongf out_size = raw_size;
+	uint8_t* raw = out->resize(raw_size);
+	if (uncompress(raw, &out_size, stored + 4, (uLong)(stored_size - 4)) != Z_OK)
+		return false;
+
+	return out_size == raw_size;
+}
+
+void pin64_block_t::assemble(const std::vector<pin64_block_t*>& chunks) {
+	if (!chunked() || m_stored.size() > 0)
+		return;
+
+	size_t total = 0;
+	for (pin64_block_t* chunk : chunks)
+		total += chunk->data_size();
+
+	// keep the chunk list as the stored form
+	m_stored = m_data;
 	m_data.clear();
+
+	uint8_t* dst = m_data.resize(total);
+	for (pin64_block_t* chunk : chunks) {
+		if (chunk->data_size() > 0)
+			memcpy(dst, chunk->data()->bytes(), chunk->data_size());
+		dst += chunk->data_size();
+	}
+	m_data.reset();
+}
+
+size_t pin64_block_t::stored_size() const {
+	if (m_released)
+		return m_released_stored_size;
+
+	return (m_stored.size() > 0) ? m_stored.size() : m_data.size();
+}
+
+const uint8_t* pin64_block_t::stored_bytes() {
+	return (m_stored.size() > 0) ? m_stored.bytes() : m_data.bytes();
 }
 
 size_t pin64_block_t::size() const {
-	return sizeof(uint8_t) * 4  // block header
-		+ sizeof(uint32_t)     // data CRC32
-		+ sizeof(uint32_t)     // data size
-		+ m_data.size();       // data
+	return header_size(pin64_t::CAP_REVISION) + stored_size();
 }
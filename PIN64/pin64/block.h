@@ -6,30 +6,87 @@
 #define PIN64_BLOCK_H
 
 #include <cstdint>
+#include <vector>
 #include "data.h"
+#include "hash.h"
 
 class pin64_block_t {
 public:
 	pin64_block_t()
-		: m_crc32{ 0 } {
+		: m_hash{ 0 }
+		, m_flags{ 0 }
+		, m_check{ 0 }
+		, m_released_size{ 0 }
+		, m_released_stored_size{ 0 }
+		, m_released{ false } {
 	}
 	pin64_block_t(uint8_t* data, size_t size);
 	pin64_block_t(pin64_data_t* data, size_t size);
+	pin64_block_t(const uint8_t* data, size_t size, uint64_t hash, uint32_t flags);
 	virtual ~pin64_block_t() {}
 
 	void finalize();
+	void rehash();
+	bool matches(pin64_block_t* other);
+	void release();
 	void clear();
+	bool compress();
+	bool decompress();
+	bool verify(uint32_t revision);
+	void assemble(const std::vector<pin64_block_t*>& chunks);
 
 	// getters
 	size_t size() const;
+	size_t data_size() const { return m_released ? m_released_size : m_data.size(); }
 	pin64_data_t* data() { return &m_data; }
-	uint32_t crc32() const { return m_crc32; }
+	size_t stored_size() const;
+	const uint8_t* stored_bytes();
+	bool compressed() const { return (m_flags & FLAG_COMPRESSED) != 0; }
+	bool chunked() const { return (m_flags & FLAG_CHUNKED) != 0; }
+	void set_chunked() { m_flags |= FLAG_CHUNKED; }
+	uint64_t hash() const { return m_hash; }
+	uint32_t flags() const { return m_flags; }
+	uint32_t seed() const { return m_flags & SEED_MASK; }
+
+	static uint64_t calculate_hash(const uint8_t* data, size_t size, uint32_t seed);
+	static uint32_t calculate_crc32(const uint8_t* data, size_t size);
+	static size_t header_size(uint32_t revision);
+	static bool inflate(const uint8_t* stored, size_t stored_size, pin64_data_t* out);
 
 	static const uint8_t BLOCK_ID[4];
 
+	// the low flag bits hold the seed the id was hashed with; a block whose
+	// seed-0 id collides with different content is re-hashed with seed 1, etc.
+	static const uint32_t SEED_MASK = 0x000000ff;
+
+	// the stored payload is a big-endian raw size followed by a zlib stream;
+	// blocks below the minimum size, or that don't shrink, are stored raw
+	static const uint32_t FLAG_COMPRESSED = 0x00000100;
+	static const size_t COMPRESS_MIN_SIZE = 64;
+
+	// the stored payload is a list of big-endian chunk ids whose contents,
+	// concatenated, make up the block; chunk lists are never compressed
+	static const uint32_t FLAG_CHUNKED = 0x00000200;
+
 protected:
-	uint32_t m_crc32;
+	uint64_t m_hash;
+	uint32_t m_flags;
+
+	// released (already written) blocks keep a second, independently seeded
+	// hash so later duplicates can still be told apart from collisions
+	uint64_t m_check;
+	size_t m_released_size;
+	size_t m_released_stored_size;
+	bool m_released;
+
 	pin64_data_t m_data;
+
+	// stored form of compressed blocks and of loaded chunked blocks, when it
+	// differs from the contents; owned when compressed at capture time, a
+	// view into the capture file when loaded
+	pin64_data_t m_stored;
 };
 
+typedef pin64_hash_table_t<pin64_block_t*> pin64_block_map_t;
+
 #endif // PIN64_BLOCK_H
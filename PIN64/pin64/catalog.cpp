@@ -0,0 +1,452 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#include "catalog.h"
+#include "pin64.h"
+#include "mapping.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+const char* pin64_catalog_t::INDEX_NAME = "pin64.cat";
+const uint8_t pin64_catalog_t::INDEX_ID[8] = { 'P', 'I', 'N', '6', '4', 'C', 'A', 'T' };
+
+static const char* const s_cycle_names[4] = { "1cycle", "2cycle", "copy", "fill" };
+static const char* const s_format_names[8] = { "rgba", "yuv", "ci", "ia", "i", "fmt5", "fmt6", "fmt7" };
+
+#ifdef _WIN32
+
+bool pin64_catalog_t::list_captures(const char* directory, std::vector<file_t>& files) {
+	const std::string pattern = std::string(directory) + "\\*.cap";
+
+	WIN32_FIND_DATAA found;
+	HANDLE search = FindFirstFileA(pattern.c_str(), &found);
+	if (search == INVALID_HANDLE_VALUE)
+		return GetLastError() == ERROR_FILE_NOT_FOUND;
+
+	do {
+		if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+
+		file_t file;
+		file.name = found.cFileName;
+		file.size = ((uint64_t)found.nFileSizeHigh << 32) | found.nFileSizeLow;
+		file.time = ((uint64_t)found.ftLastWriteTime.dwHighDateTime << 32) | found.ftLastWriteTime.dwLowDateTime;
+		files.push_back(file);
+	} while (FindNextFileA(search, &found));
+
+	FindClose(search);
+	return true;
+}
+
+#else
+
+bool pin64_catalog_t::list_captures(const char* directory, std::vector<file_t>& files) {
+	DIR* dir = opendir(directory);
+	if (dir == nullptr)
+		return false;
+
+	while (struct dirent* found = readdir(dir)) {
+		const size_t length = strlen(found->d_name);
+		if (length < 4 || strcmp(found->d_name + length - 4, ".cap") != 0)
+			continue;
+
+		const std::string path = std::string(directory) + "/" + found->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		file_t file;
+		file.name = found->d_name;
+		file.size = (uint64_t)st.st_size;
+		file.time = (uint64_t)st.st_mtime;
+		files.push_back(file);
+	}
+
+	closedir(dir);
+	return true;
+}
+
+#endif
+
+bool pin64_catalog_t::scan(const std::string& path, pin64_catalog_entry_t& entry) {
+	pin64_mapping_t mapping;
+	if (!mapping.open(path.c_str()))
+		return false;
+	entry.content_hash = pin64_hash64(mapping.bytes(), mapping.size());
+	mapping.close();
+
+	// blocks stay in their stored form; only command blocks are unpacked
+	pin64_t capture;
+	if (!capture.load(path.c_str(), true))
+		return false;
+
+	pin64_block_map_t& blocks = capture.blocks();
+	entry.frames = (uint32_t)capture.frames().size();
+	entry.commands = (uint32_t)capture.commands().size();
+	entry.blocks = (uint32_t)blocks.size();
+	entry.stored_bytes = 0;
+	entry.referenced_bytes = 0;
+	entry.cycle_types = 0;
+	entry.texture_types = 0;
+	memset(entry.opcodes, 0, sizeof(entry.opcodes));
+
+	for (pin64_block_map_t::entry_t& block_pair : blocks)
+		entry.stored_bytes += block_pair.second->stored_size();
+
+	auto reference = [&blocks, &entry](uint64_t id, uint32_t count) {
+		pin64_block_t** block = blocks.find(id);
+		if (block)
+			entry.referenced_bytes += (uint64_t)(*block)->stored_size() * count;
+		return block ? *block : nullptr;
+	};
+
+	for (uint64_t id : capture.metas())
+		reference(id, 1);
+	for (pin64_keyframe_t& keyframe : capture.keyframes()) {
+		for (uint64_t id : keyframe.blocks)
+			reference(id, 1);
+	}
+
+	// each unique command is decoded once and counted for all of its uses
+	pin64_hash_table_t<uint32_t> uses;
+	uses.reserve(blocks.size());
+	for (uint64_t id : capture.commands()) {
+		uint32_t* count = uses.find(id);
+		if (count)
+			(*count)++;
+		else
+			uses.insert(id, 1);
+	}
+
+	std::vector<uint64_t> arena;
+	for (pin64_hash_table_t<uint32_t>::entry_t& use : uses) {
+		pin64_block_t* block = reference(use.first, use.second);
+		if (!block || !block->decompress())
+			return false;
+
+		pin64_command_t command;
+		size_t offset;
+		arena.clear();
+		if (!pin64_t::decode_command(block, command, arena, offset))
+			return false;
+
+		uint64_t data_id;
+		if (pin64_t::data_ref(block, capture.revision(), data_id))
+			reference(data_id, use.second);
+
+		entry.opcodes[command.opcode] += use.second;
+		if (command.length == 0)
+			continue;
+
+		const uint64_t word = arena[offset];
+		if (command.opcode == 0x2f) // set_other_modes
+			entry.cycle_types |= 1 << ((word >> 52) & 3);
+		else if (command.opcode == 0x35) // set_tile
+			entry.texture_types |= 1 << (((word >> 53) & 7) * 4 + ((word >> 51) & 3));
+	}
+
+	return true;
+}
+
+bool pin64_catalog_t::update(const char* directory) {
+	std::vector<file_t> files;
+	if (!list_captures(directory, files)) {
+		printf("Unable to list the captures in %s.\n", directory);
+		return false;
+	}
+
+	std::sort(files.begin(), files.end(), [](const file_t& a, const file_t& b) { return a.name < b.name; });
+
+	// entries are kept sorted by name, so unchanged captures are found by
+	// walking both lists together
+	std::vector<pin64_catalog_entry_t> entries(files.size());
+	std::vector<size_t> stale;
+	size_t existing = 0;
+	for (size_t i = 0; i < files.size(); i++) {
+		while (existing < m_entries.size() && m_entries[existing].name < files[i].name)
+			existing++;
+
+		if (existing < m_entries.size() && m_entries[existing].name == files[i].name
+			&& m_entries[existing].file_size == files[i].size && m_entries[existing].file_time == files[i].time) {
+			entries[i] = m_entries[existing];
+			continue;
+		}
+
+		entries[i].name = files[i].name;
+		entries[i].file_size = files[i].size;
+		entries[i].file_time = files[i].time;
+		stale.push_back(i);
+	}
+
+	// each capture is read on its own thread; loads share the common pool
+	// for their own work, so the scan gets a pool of its own
+	std::vector<uint8_t> scanned(stale.size(), 0);
+	pin64_thread_pool_t pool;
+	pool.parallel_for(stale.size(), [&](size_t i) {
+		pin64_catalog_entry_t& entry = entries[stale[i]];
+		scanned[i] = scan(std::string(directory) + "/" + entry.name, entry) ? 1 : 0;
+	});
+
+	m_entries.clear();
+	for (size_t i = 0, next = 0; i < entries.size(); i++) {
+		if (next < stale.size() && stale[next] == i) {
+			if (!scanned[next++]) {
+				printf("Unable to read capture %s; leaving it out of the catalog.\n", entries[i].name.c_str());
+				continue;
+			}
+		}
+		m_entries.push_back(entries[i]);
+	}
+
+	printf("Catalogued %d captures in %s, %d of them re-read.\n", (uint32_t)m_entries.size(), directory, (uint32_t)stale.size());
+	return true;
+}
+
+void pin64_catalog_t::write_entry(pin64_data_t* data, const pin64_catalog_entry_t& entry) {
+	data->put32((uint32_t)entry.name.size());
+	data->put((const uint8_t*)entry.name.data(), entry.name.size());
+	data->put64(entry.file_size);
+	data->put64(entry.file_time);
+	data->put64(entry.content_hash);
+	data->put32(entry.frames);
+	data->put32(entry.commands);
+	data->put32(entry.blocks);
+	data->put64(entry.stored_bytes);
+	data->put64(entry.referenced_bytes);
+	data->put32(entry.cycle_types);
+	data->put32(entry.texture_types);
+	for (uint32_t count : entry.opcodes)
+		data->put32(count);
+}
+
+bool pin64_catalog_t::read_entry(pin64_data_t* data, pin64_catalog_entry_t& entry) {
+	static const size_t FIXED_SIZE = 8 * 5 + 4 * 5 + sizeof(entry.opcodes);
+
+	if (data->remaining() < 4)
+		return false;
+
+	const uint32_t name_size = data->get32();
+	if (name_size == 0 || (size_t)name_size + FIXED_SIZE > data->remaining())
+		return false;
+
+	entry.name.assign((const char*)data->curr(), name_size);
+	data->relative_offset(name_size);
+
+	entry.file_size = data->get64();
+	entry.file_time = data->get64();
+	entry.content_hash = data->get64();
+	entry.frames = data->get32();
+	entry.commands = data->get32();
+	entry.blocks = data->get32();
+	entry.stored_bytes = data->get64();
+	entry.referenced_bytes = data->get64();
+	entry.cycle_types = data->get32();
+	entry.texture_types = data->get32();
+	for (uint32_t& count : entry.opcodes)
+		count = data->get32();
+
+	return true;
+}
+
+bool pin64_catalog_t::load(const char* index_name) {
+	m_entries.clear();
+
+	FILE* file = fopen(index_name, "rb");
+	if (file == nullptr)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	const size_t file_size = (size_t)ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	pin64_data_t data;
+	const size_t read_size = (file_size > 0) ? fread(data.resize(file_size), 1, file_size, file) : 0;
+	fclose(file);
+	data.reset();
+
+	if (read_size != file_size || file_size < 16 || memcmp(data.bytes(), INDEX_ID, 8) != 0 || data.get32(8) != INDEX_VERSION) {
+		printf("Ignoring invalid catalog index %s.\n", index_name);
+		return false;
+	}
+
+	data.offset(12);
+	const uint32_t count = data.get32();
+	for (uint32_t i = 0; i < count; i++) {
+		pin64_catalog_entry_t entry;
+		if (!read_entry(&data, entry)) {
+			printf("Ignoring invalid catalog index %s.\n", index_name);
+			m_entries.clear();
+			return false;
+		}
+		m_entries.push_back(entry);
+	}
+
+	std::sort(m_entries.begin(), m_entries.end(), [](const pin64_catalog_entry_t& a, const pin64_catalog_entry_t& b) { return a.name < b.name; });
+	return true;
+}
+
+bool pin64_catalog_t::save(const char* index_name) {
+	pin64_data_t data;
+	data.put(INDEX_ID, 8);
+	data.put32(INDEX_VERSION);
+	data.put32((uint32_t)m_entries.size());
+	for (const pin64_catalog_entry_t& entry : m_entries)
+		write_entry(&data, entry);
+
+	const std::string temp_name = std::string(index_name) + ".tmp";
+	FILE* file = fopen(temp_name.c_str(), "wb");
+	if (file == nullptr) {
+		printf("Unable to open file %s for writing.\n", temp_name.c_str());
+		return false;
+	}
+
+	const bool written = fwrite(data.bytes(), 1, data.size(), file) == data.size();
+	fclose(file);
+
+	remove(index_name);
+	return written && rename(temp_name.c_str(), index_name) == 0;
+}
+
+// texel types are named as in the RDP documentation, e.g. ci4 or rgba16
+bool pin64_catalog_t::parse_texture_type(const char* name, uint32_t& type) {
+	for (uint32_t format = 0; format < 5; format++) {
+		const size_t length = strlen(s_format_names[format]);
+		if (strncmp(name, s_format_names[format], length) != 0)
+			continue;
+
+		const int bits = atoi(name + length);
+		for (uint32_t size = 0; size < 4; size++) {
+			if (bits == (4 << size)) {
+				type = format * 4 + size;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void pin64_catalog_t::print_entry(const pin64_catalog_entry_t& entry) {
+	printf("%-24s %10llu bytes %6d frames %8d commands %7d blocks %6.2fx dedup %08x%08x",
+		entry.name.c_str(), (unsigned long long)entry.file_size, entry.frames, entry.commands, entry.blocks,
+		entry.dedup_ratio(), (uint32_t)(entry.content_hash >> 32), (uint32_t)entry.content_hash);
+
+	for (uint32_t cycle = 0; cycle < 4; cycle++) {
+		if (entry.cycle_types & (1 << cycle))
+			printf(" %s", s_cycle_names[cycle]);
+	}
+
+	for (uint32_t type = 0; type < 32; type++) {
+		if (entry.texture_types & (1 << type))
+			printf(" %s%d", s_format_names[type / 4], 4 << (type % 4));
+	}
+
+	printf("\n");
+}
+
+int pin64_catalog_t::command(int argc, char** argv) {
+	if (argc < 1) {
+		printf("usage: catalog <directory> [--cycle 1cycle|2cycle|copy|fill] [--texture <type>] [--opcode <n>]\n");
+		printf("                           [--sort name|size|frames|commands|dedup] [--limit <n>]\n");
+		return 1;
+	}
+
+	const char* directory = argv[0];
+	uint32_t cycle_mask = 0;
+	uint32_t texture_mask = 0;
+	std::vector<uint32_t> opcodes;
+	std::string sort = "name";
+	size_t limit = ~(size_t)0;
+
+	for (int i = 1; i < argc; i++) {
+		const std::string option = argv[i];
+		const char* value = (i + 1 < argc) ? argv[++i] : nullptr;
+		if (!value) {
+			printf("Missing value for %s.\n", option.c_str());
+			return 1;
+		}
+
+		if (option == "--cycle") {
+			uint32_t cycle = 0;
+			while (cycle < 4 && strcmp(value, s_cycle_names[cycle]) != 0)
+				cycle++;
+			if (cycle == 4) {
+				printf("Unknown cycle type %s.\n", value);
+				return 1;
+			}
+			cycle_mask |= 1 << cycle;
+		} else if (option == "--texture") {
+			uint32_t type;
+			if (!parse_texture_type(value, type)) {
+				printf("Unknown texture type %s.\n", value);
+				return 1;
+			}
+			texture_mask |= 1 << type;
+		} else if (option == "--opcode") {
+			const uint32_t opcode = (uint32_t)strtoul(value, nullptr, 0);
+			if (opcode >= 64) {
+				printf("Opcode %s is out of range.\n", value);
+				return 1;
+			}
+			opcodes.push_back(opcode);
+		} else if (option == "--sort") {
+			sort = value;
+			if (sort != "name" && sort != "size" && sort != "frames" && sort != "commands" && sort != "dedup") {
+				printf("Unknown sort order %s.\n", value);
+				return 1;
+			}
+		} else if (option == "--limit") {
+			limit = (size_t)strtoul(value, nullptr, 0);
+		} else {
+			printf("Unknown option %s.\n", option.c_str());
+			return 1;
+		}
+	}
+
+	const std::string index_name = std::string(directory) + "/" + INDEX_NAME;
+	pin64_catalog_t catalog;
+	catalog.load(index_name.c_str());
+	if (!catalog.update(directory))
+		return 1;
+	if (!catalog.save(index_name.c_str()))
+		printf("Unable to write catalog index %s.\n", index_name.c_str());
+
+	// every filter has to match
+	std::vector<const pin64_catalog_entry_t*> matches;
+	for (const pin64_catalog_entry_t& entry : catalog.entries()) {
+		bool match = (entry.cycle_types & cycle_mask) == cycle_mask && (entry.texture_types & texture_mask) == texture_mask;
+		for (uint32_t opcode : opcodes)
+			match = match && entry.opcodes[opcode] > 0;
+		if (match)
+			matches.push_back(&entry);
+	}
+
+	// everything but names sorts largest first
+	auto key = [&sort](const pin64_catalog_entry_t* entry) -> double {
+		if (sort == "size") return (double)entry->file_size;
+		if (sort == "frames") return (double)entry->frames;
+		if (sort == "commands") return (double)entry->commands;
+		if (sort == "dedup") return entry->dedup_ratio();
+		return 0.0;
+	};
+	if (sort != "name") {
+		std::stable_sort(matches.begin(), matches.end(), [&key](const pin64_catalog_entry_t* a, const pin64_catalog_entry_t* b) { return key(a) > key(b); });
+	}
+
+	for (size_t i = 0; i < matches.size() && i < limit; i++)
+		print_entry(*matches[i]);
+
+	printf("%d of %d captures match.\n", (uint32_t)matches.size(), (uint32_t)catalog.entries().size());
+	return 0;
+}
@@ -0,0 +1,79 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#pragma once
+
+#ifndef PIN64_CATALOG_H
+#define PIN64_CATALOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class pin64_data_t;
+
+// summary of one capture, as kept in the catalog index; byte counts are
+// of blocks in their stored form
+struct pin64_catalog_entry_t {
+	std::string name;
+	uint64_t file_size;
+	uint64_t file_time;
+	uint64_t content_hash;
+
+	uint32_t frames;
+	uint32_t commands;
+	uint32_t blocks;
+
+	// stored bytes of every unique block, and of every reference to one;
+	// their ratio is how much block deduplication saves
+	uint64_t stored_bytes;
+	uint64_t referenced_bytes;
+
+	// one bit per cycle type set through set_other_modes, and one bit per
+	// (format * 4 + size) texel type set through set_tile
+	uint32_t cycle_types;
+	uint32_t texture_types;
+
+	uint32_t opcodes[64];
+
+	double dedup_ratio() const { return stored_bytes ? (double)referenced_bytes / (double)stored_bytes : 0.0; }
+};
+
+// index over a directory of captures, for queries that would otherwise
+// have to load every capture; updating only re-reads captures whose size
+// or modification time changed since the index was written
+class pin64_catalog_t {
+public:
+	bool load(const char* index_name);
+	bool save(const char* index_name);
+	bool update(const char* directory);
+
+	const std::vector<pin64_catalog_entry_t>& entries() const { return m_entries; }
+
+	// command line front end: updates the index of a directory, then lists
+	// the captures that pass every filter
+	static int command(int argc, char** argv);
+
+	static const char* INDEX_NAME;
+	static const uint8_t INDEX_ID[8];
+	static const uint32_t INDEX_VERSION = 1;
+
+private:
+	struct file_t {
+		std::string name;
+		uint64_t size;
+		uint64_t time;
+	};
+
+	static bool list_captures(const char* directory, std::vector<file_t>& files);
+	static bool scan(const std::string& path, pin64_catalog_entry_t& entry);
+	static void write_entry(pin64_data_t* data, const pin64_catalog_entry_t& entry);
+	static bool read_entry(pin64_data_t* data, pin64_catalog_entry_t& entry);
+
+	static bool parse_texture_type(const char* name, uint32_t& type);
+	static void print_entry(const pin64_catalog_entry_t& entry);
+
+	std::vector<pin64_catalog_entry_t> m_entries;
+};
+
+#endif // PIN64_CATALOG_H
@@ -0,0 +1,54 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#include "chunker.h"
+
+// a boundary falls where the top bits of the hash are clear, for an
+// average of 256 bytes past the minimum chunk size
+static const uint32_t BOUNDARY_SHIFT = 56;
+
+const uint64_t* pin64_chunker_t::gear_table() {
+	struct table_t {
+		table_t() {
+			uint64_t state = 0x50494e3634434443ULL; // "PIN64CDC"
+			for (int i = 0; i < 256; i++) {
+				// splitmix64
+				uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+				z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+				z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+				gear[i] = z ^ (z >> 31);
+			}
+		}
+
+		uint64_t gear[256];
+	};
+
+	static const table_t s_table;
+	return s_table.gear;
+}
+
+size_t pin64_chunker_t::next_chunk(const uint8_t* data, size_t size) {
+	if (size <= MIN_CHUNK_SIZE)
+		return size;
+
+	const uint64_t* gear = gear_table();
+	const size_t limit = (size < MAX_CHUNK_SIZE) ? size : MAX_CHUNK_SIZE;
+
+	uint64_t hash = 0;
+	for (size_t i = 0; i < limit; i++) {
+		hash = (hash << 1) + gear[data[i]];
+		if (i >= MIN_CHUNK_SIZE && (hash >> BOUNDARY_SHIFT) == 0)
+			return i + 1;
+	}
+
+	return limit;
+}
+
+void pin64_chunker_t::split(const uint8_t* data, size_t size, std::vector<size_t>& ends) {
+	ends.clear();
+
+	size_t start = 0;
+	while (start < size) {
+		start += next_chunk(data + start, size - start);
+		ends.push_back(start);
+	}
+}
@@ -0,0 +1,29 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#pragma once
+
+#ifndef PIN64_CHUNKER_H
+#define PIN64_CHUNKER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// content-defined chunking for texture data blocks: boundaries are picked
+// by a rolling (gear) hash over the last 64 bytes, so an upload that only
+// changes a few rows still shares its other chunks with earlier uploads
+class pin64_chunker_t {
+public:
+	// fills ends with the end offset of each chunk
+	static void split(const uint8_t* data, size_t size, std::vector<size_t>& ends);
+
+	static const size_t MIN_SPLIT_SIZE = 1024;
+	static const size_t MIN_CHUNK_SIZE = 256;
+	static const size_t MAX_CHUNK_SIZE = 2048;
+
+private:
+	static size_t next_chunk(const uint8_t* data, size_t size);
+	static const uint64_t* gear_table();
+};
+
+#endif // PIN64_CHUNKER_H
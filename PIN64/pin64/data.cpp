@@ -3,6 +3,22 @@
 #include "data.h"
 #include "../emu.h"
 
+pin64_data_t& pin64_data_t::operator=(const pin64_data_t& other) {
+	m_data = other.m_data;
+	m_view = other.m_view;
+	m_offset = other.m_offset;
+	m_old_offset = other.m_old_offset;
+
+	if (m_view) {
+		m_bytes = other.m_bytes;
+		m_size = other.m_size;
+	} else {
+		sync();
+	}
+
+	return *this;
+}
+
 bool pin64_data_t::load_file(const char* name) {
 	FILE* file = fopen(name, "rb");
 
@@ -12,54 +28,137 @@ bool pin64_data_t::load_file(const char* name) {
 	}
 
 	fseek(file, 0, SEEK_END);
-	uint32_t file_size = (uint32_t)ftell(file);
+	const size_t file_size = (size_t)ftell(file);
 	fseek(file, 0, SEEK_SET);
 
-	uint8_t* data = new uint8_t[file_size];
-	fread(data, 1, file_size, file);
-	m_data.assign(data, data + file_size);
-	delete[] data;
+	m_view = false;
+	m_data.resize(file_size);
+	const size_t read_size = (file_size > 0) ? fread(&m_data[0], 1, file_size, file) : 0;
+	sync();
+	reset();
 
 	fclose(file);
 
-	return true;
+	return read_size == file_size;
+}
+
+void pin64_data_t::view(const uint8_t* data, size_t size) {
+	m_data.clear();
+	m_data.shrink_to_fit();
+
+	m_bytes = const_cast<uint8_t*>(data);
+	m_size = size;
+	m_view = true;
+
+	reset();
+}
+
+uint8_t* pin64_data_t::resize(size_t size) {
+	check_writable();
+	m_data.resize(size);
+	sync();
+	return bytes();
+}
+
+void pin64_data_t::reserve(size_t size) {
+	check_writable();
+	m_data.reserve(size);
+	sync();
+}
+
+void pin64_data_t::check_writable() {
+	if (m_view)
+		fatalerror("PIN64: Call to pin64_data_t::put() on a read-only view\n");
 }
 
-void pin64_data_t::put(uint8_t* data, size_t size) {
+void pin64_data_t::put(const uint8_t* data, size_t size) {
+	check_writable();
 	m_data.insert(m_data.end(), data, data + size);
 	m_offset += size;
+	sync();
 }
 
 void pin64_data_t::put(pin64_data_t* data, size_t size) {
+	check_writable();
 	m_data.insert(m_data.end(), data->curr(), data->curr(size));
 	m_offset += size;
+	sync();
 }
 
 void pin64_data_t::put8(uint8_t data) {
+	check_writable();
 	m_data.push_back(data);
 	m_offset++;
+	sync();
 }
 
 void pin64_data_t::put16(uint16_t data) {
-	put8((uint8_t)(data >> 8));
-	put8((uint8_t)data);
+	const uint8_t bytes[2] = { (uint8_t)(data >> 8), (uint8_t)data };
+	put(bytes, 2);
 }
 
 void pin64_data_t::put32(uint32_t data) {
-	put16((uint16_t)(data >> 16));
-	put16((uint16_t)data);
+	const uint8_t bytes[4] = { (uint8_t)(data >> 24), (uint8_t)(data >> 16), (uint8_t)(data >> 8), (uint8_t)data };
+	put(bytes, 4);
 }
 
 void pin64_data_t::put64(uint64_t data) {
-	put32((uint32_t)(data >> 32));
-	put32((uint32_t)data);
+	const uint8_t bytes[8] = {
+		(uint8_t)(data >> 56), (uint8_t)(data >> 48), (uint8_t)(data >> 40), (uint8_t)(data >> 32),
+		(uint8_t)(data >> 24), (uint8_t)(data >> 16), (uint8_t)(data >> 8), (uint8_t)data
+	};
+	put(bytes, 8);
+}
+
+void pin64_data_t::put64(const uint64_t* data, size_t count) {
+	check_writable();
+	const size_t start = m_data.size();
+	m_data.resize(start + count * 8);
+
+	uint8_t* out = &m_data[start];
+	for (size_t i = 0; i < count; i++, out += 8) {
+		const uint64_t value = data[i];
+		out[0] = (uint8_t)(value >> 56);
+		out[1] = (uint8_t)(value >> 48);
+		out[2] = (uint8_t)(value >> 40);
+		out[3] = (uint8_t)(value >> 32);
+		out[4] = (uint8_t)(value >> 24);
+		out[5] = (uint8_t)(value >> 16);
+		out[6] = (uint8_t)(value >> 8);
+		out[7] = (uint8_t)value;
+	}
+
+	m_offset += count * 8;
+	sync();
+}
+
+void pin64_data_t::put_le32(uint32_t data) {
+	const uint8_t bytes[4] = { (uint8_t)data, (uint8_t)(data >> 8), (uint8_t)(data >> 16), (uint8_t)(data >> 24) };
+	put(bytes, 4);
+}
+
+void pin64_data_t::put_le64(uint64_t data) {
+	put_le32((uint32_t)data);
+	put_le32((uint32_t)(data >> 32));
+}
+
+uint32_t pin64_data_t::get_le32(size_t offset) {
+	if (offset > m_size || m_size - offset < 4)
+		fatalerror("PIN64: Call to pin64_data_t::get_le32() at end of block (requested offset %x, size %x)\n", (uint32_t)offset, (uint32_t)m_size);
+
+	const uint8_t* p = m_bytes + offset;
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint64_t pin64_data_t::get_le64(size_t offset) {
+	return (uint64_t)get_le32(offset) | ((uint64_t)get_le32(offset + 4) << 32);
 }
 
 uint8_t pin64_data_t::get8() {
-	if (m_offset >= m_data.size())
-		fatalerror("PIN64: Call to pin64_data_t::get8() at end of block (requested offset %x, size %x)\n", (uint32_t)m_offset, (uint32_t)m_data.size());
+	if (m_offset >= m_size)
+		fatalerror("PIN64: Call to pin64_data_t::get8() at end of block (requested offset %x, size %x)\n", (uint32_t)m_offset, (uint32_t)m_size);
 
-	uint8_t ret = m_data[m_offset];
+	uint8_t ret = m_bytes[m_offset];
 	m_offset++;
 
 	return ret;
@@ -120,6 +219,8 @@ void pin64_data_t::reset() {
 void pin64_data_t::clear() {
 	reset();
 	m_data.clear();
+	m_view = false;
+	sync();
 }
 
 void pin64_data_t::update_offset(size_t offset, bool store_new_offset) {
@@ -5,28 +5,41 @@
 #ifndef PIN64_DATA_H
 #define PIN64_DATA_H
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
 class pin64_data_t {
 public:
 	pin64_data_t()
-		: m_offset(0)
+		: m_bytes(nullptr)
+		, m_size(0)
+		, m_view(false)
+		, m_offset(0)
 		, m_old_offset(0) {
 	}
+	pin64_data_t(const pin64_data_t& other) { *this = other; }
 	virtual ~pin64_data_t() {}
 
+	pin64_data_t& operator=(const pin64_data_t& other);
+
 	void reset();
 	void clear();
 	bool load_file(const char* name);
+	void view(const uint8_t* data, size_t size);
+	uint8_t* resize(size_t size);
+	void reserve(size_t size);
 
 	// setters
-	virtual void put(uint8_t* data, size_t size);
+	virtual void put(const uint8_t* data, size_t size);
 	virtual void put(pin64_data_t* data, size_t size);
 	virtual void put8(uint8_t data);
 	virtual void put16(uint16_t data);
 	virtual void put32(uint32_t data);
 	virtual void put64(uint64_t data);
+	virtual void put64(const uint64_t* data, size_t count);
+	void put_le32(uint32_t data);
+	void put_le64(uint64_t data);
 	void offset(size_t offset) { m_offset = offset; }
 	void relative_offset(size_t offset) { m_offset += offset; }
 
@@ -40,29 +53,42 @@ public:
 	virtual uint64_t get64();
 	virtual uint64_t get64(size_t offset, bool store_new_offset = false);
 	virtual size_t offset() { return m_offset; }
-	uint8_t* bytes() { return (m_data.size() > 0) ? &m_data[0] : nullptr; }
-	uint8_t* curr(size_t off = 0) { return (m_data.size() >= (m_offset + off)) ? &m_data[m_offset + off] : nullptr; }
-	size_t size() const { return m_data.size(); }
+
+	// little-endian values, as used by the version-2 capture layout
+	uint32_t get_le32(size_t offset);
+	uint64_t get_le64(size_t offset);
+	uint8_t* bytes() { return (m_size > 0) ? m_bytes : nullptr; }
+	uint8_t* curr(size_t off = 0) { return (m_size >= (m_offset + off)) ? m_bytes + m_offset + off : nullptr; }
+	size_t size() const { return m_size; }
 	size_t remaining() const { return size() - m_offset; }
+	bool is_view() const { return m_view; }
 
 private:
 	void update_offset(size_t offset, bool store_new_offset = false);
+	void sync() { m_bytes = m_data.data(); m_size = m_data.size(); }
+	void check_writable();
 
 protected:
 	std::vector<uint8_t> m_data;
 
+	// either m_data's storage or a non-owning, read-only view
+	uint8_t* m_bytes;
+	size_t m_size;
+	bool m_view;
+
 	size_t m_offset;
 	size_t m_old_offset;
 };
 
 class pin64_dummy_data_t : public pin64_data_t {
 public:
-	void put(uint8_t* data, size_t size) override {}
+	void put(const uint8_t* data, size_t size) override {}
 	void put(pin64_data_t* data, size_t size) override {}
 	void put8(uint8_t data) override {}
 	void put16(uint16_t data) override {}
 	void put32(uint32_t data) override {}
 	void put64(uint64_t data) override {}
+	void put64(const uint64_t* data, size_t count) override {}
 
 	uint8_t get8() override { return 0; }
 	uint8_t get8(size_t offset, bool update_current = true) override { return 0; }
@@ -0,0 +1,91 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#include "hash.h"
+
+static const uint64_t PRIME64_1 = 0x9e3779b185ebca87ULL;
+static const uint64_t PRIME64_2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t PRIME64_3 = 0x165667b19e3779f9ULL;
+static const uint64_t PRIME64_4 = 0x85ebca77c2b2ae63ULL;
+static const uint64_t PRIME64_5 = 0x27d4eb2f165667c5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+// XXH64 is specified over little-endian words
+static inline uint64_t read64(const uint8_t* p) {
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+		| ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline uint32_t read32(const uint8_t* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline uint64_t merge_round64(uint64_t acc, uint64_t val) {
+	acc ^= round64(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t pin64_hash64(const uint8_t* data, size_t size, uint64_t seed) {
+	const uint8_t* p = data;
+	const uint8_t* const end = data + size;
+	uint64_t h;
+
+	if (size >= 32) {
+		const uint8_t* const limit = end - 32;
+		uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t v2 = seed + PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME64_1;
+
+		do {
+			v1 = round64(v1, read64(p)); p += 8;
+			v2 = round64(v2, read64(p)); p += 8;
+			v3 = round64(v3, read64(p)); p += 8;
+			v4 = round64(v4, read64(p)); p += 8;
+		} while (p <= limit);
+
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = merge_round64(h, v1);
+		h = merge_round64(h, v2);
+		h = merge_round64(h, v3);
+		h = merge_round64(h, v4);
+	} else {
+		h = seed + PRIME64_5;
+	}
+
+	h += (uint64_t)size;
+
+	while (p + 8 <= end) {
+		h ^= round64(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+
+	if (p + 4 <= end) {
+		h ^= (uint64_t)read32(p) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	while (p < end) {
+		h ^= (*p) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
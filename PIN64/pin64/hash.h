@@ -0,0 +1,141 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#pragma once
+
+#ifndef PIN64_HASH_H
+#define PIN64_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// 64-bit content hash used for block identity (XXH64)
+uint64_t pin64_hash64(const uint8_t* data, size_t size, uint64_t seed = 0);
+
+// open-addressing hash table keyed by 64-bit block ids; keys are already
+// well-mixed hashes, so slots are chosen by Fibonacci hashing and probed
+// linearly
+template <typename T>
+class pin64_hash_table_t {
+public:
+	typedef std::pair<uint64_t, T> entry_t;
+
+	class iterator {
+	public:
+		iterator(pin64_hash_table_t* table, size_t index) : m_table(table), m_index(index) { skip(); }
+
+		entry_t& operator*() const { return m_table->m_entries[m_index]; }
+		entry_t* operator->() const { return &m_table->m_entries[m_index]; }
+		iterator& operator++() { m_index++; skip(); return *this; }
+		bool operator==(const iterator& other) const { return m_index == other.m_index; }
+		bool operator!=(const iterator& other) const { return m_index != other.m_index; }
+
+	private:
+		void skip() { while (m_index < m_table->m_used.size() && !m_table->m_used[m_index]) m_index++; }
+
+		pin64_hash_table_t* m_table;
+		size_t m_index;
+	};
+
+	pin64_hash_table_t()
+		: m_count(0)
+		, m_shift(64) {
+	}
+
+	T* find(uint64_t key) {
+		if (m_count == 0)
+			return nullptr;
+
+		const size_t mask = m_used.size() - 1;
+		for (size_t i = slot(key); m_used[i]; i = (i + 1) & mask) {
+			if (m_entries[i].first == key)
+				return &m_entries[i].second;
+		}
+		return nullptr;
+	}
+
+	bool contains(uint64_t key) { return find(key) != nullptr; }
+
+	// returns false if the key was already present
+	bool insert(uint64_t key, T value) {
+		if ((m_count + 1) * 2 > m_used.size())
+			rehash(m_used.empty() ? 64 : m_used.size() * 2);
+
+		const size_t mask = m_used.size() - 1;
+		size_t i = slot(key);
+		for (; m_used[i]; i = (i + 1) & mask) {
+			if (m_entries[i].first == key)
+				return false;
+		}
+
+		m_entries[i] = entry_t(key, value);
+		m_used[i] = 1;
+		m_count++;
+		return true;
+	}
+
+	T& operator[](uint64_t key) {
+		T* value = find(key);
+		if (value)
+			return *value;
+
+		insert(key, T());
+		return *find(key);
+	}
+
+	void reserve(size_t count) {
+		size_t capacity = 64;
+		while (capacity < count * 2)
+			capacity <<= 1;
+		if (capacity > m_used.size())
+			rehash(capacity);
+	}
+
+	void clear() {
+		m_entries.clear();
+		m_used.clear();
+		m_count = 0;
+		m_shift = 64;
+	}
+
+	size_t size() const { return m_count; }
+	bool empty() const { return m_count == 0; }
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, m_used.size()); }
+
+private:
+	size_t slot(uint64_t key) const { return (size_t)((key * 0x9e3779b97f4a7c15ULL) >> m_shift); }
+
+	void rehash(size_t capacity) {
+		std::vector<entry_t> entries(capacity);
+		std::vector<uint8_t> used(capacity, 0);
+		entries.swap(m_entries);
+		used.swap(m_used);
+
+		m_shift = 64;
+		for (size_t c = capacity; c > 1; c >>= 1)
+			m_shift--;
+
+		const size_t mask = capacity - 1;
+		for (size_t j = 0; j < used.size(); j++) {
+			if (!used[j])
+				continue;
+
+			size_t i = slot(entries[j].first);
+			while (m_used[i])
+				i = (i + 1) & mask;
+
+			m_entries[i] = entries[j];
+			m_used[i] = 1;
+		}
+	}
+
+	std::vector<entry_t> m_entries;
+	std::vector<uint8_t> m_used;
+	size_t m_count;
+	uint32_t m_shift;
+};
+
+#endif // PIN64_HASH_H
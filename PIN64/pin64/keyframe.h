@@ -0,0 +1,53 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#pragma once
+
+#ifndef PIN64_KEYFRAME_H
+#define PIN64_KEYFRAME_H
+
+#include <cstdint>
+#include <vector>
+
+class pin64_block_t;
+
+// renderer state at the start of a frame, stored as ordinary blocks so that
+// unchanged state and memory pages are shared between keyframes
+struct pin64_keyframe_t {
+	uint32_t frame;
+	std::vector<uint64_t> blocks;
+};
+
+// hashes of what a frame left in memory at its end: the displayed color
+// region, the depth buffer under it, and its hidden bits; a hash that
+// wasn't recorded is zero
+struct pin64_frame_hashes_t {
+	uint64_t color;
+	uint64_t depth;
+	uint64_t hidden;
+};
+
+// implemented by the renderer that plays captures back, so that keyframes
+// can be taken, restored, and played forward from
+class pin64_player_t {
+public:
+	virtual ~pin64_player_t() {}
+
+	// appends new, unfinalized blocks holding the current state
+	virtual void save_keyframe(std::vector<pin64_block_t*>& blocks) = 0;
+	virtual bool load_keyframe(std::vector<pin64_block_t*>& blocks) = 0;
+
+	// puts the player back in its power-on state, with memory, TMEM and
+	// registers cleared
+	virtual void clear_state() = 0;
+	virtual void execute_command() = 0;
+
+	// hash of everything rendered so far, used to check that a rewritten
+	// capture still renders identically
+	virtual uint64_t frame_hash() = 0;
+
+	// hashes of the current frame, computed with pin64_t::hash_frame so that
+	// they can be compared with those recorded at capture time
+	virtual void frame_hashes(pin64_frame_hashes_t& hashes) = 0;
+};
+
+#endif // PIN64_KEYFRAME_H
@@ -0,0 +1,106 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#include "mapping.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool pin64_mapping_t::open(const char* name) {
+	close();
+
+	HANDLE file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		printf("Unable to open file %s for mapping.\n", name);
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (map == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+
+	const void* view = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr) {
+		CloseHandle(map);
+		CloseHandle(file);
+		return false;
+	}
+
+	m_file = file;
+	m_map = map;
+	m_bytes = static_cast<const uint8_t*>(view);
+	m_size = (size_t)file_size.QuadPart;
+
+	return true;
+}
+
+void pin64_mapping_t::close() {
+	if (m_bytes)
+		UnmapViewOfFile(m_bytes);
+	if (m_map)
+		CloseHandle((HANDLE)m_map);
+	if (m_file)
+		CloseHandle((HANDLE)m_file);
+
+	m_bytes = nullptr;
+	m_size = 0;
+	m_map = nullptr;
+	m_file = nullptr;
+}
+
+#else
+
+bool pin64_mapping_t::open(const char* name) {
+	close();
+
+	int fd = ::open(name, O_RDONLY);
+	if (fd < 0) {
+		printf("Unable to open file %s for mapping.\n", name);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (view == MAP_FAILED)
+		return false;
+
+	m_bytes = static_cast<const uint8_t*>(view);
+	m_size = (size_t)st.st_size;
+
+	return true;
+}
+
+void pin64_mapping_t::close() {
+	if (m_bytes)
+		munmap(const_cast<uint8_t*>(m_bytes), m_size);
+
+	m_bytes = nullptr;
+	m_size = 0;
+}
+
+#endif
@@ -0,0 +1,47 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#pragma once
+
+#ifndef PIN64_MAPPING_H
+#define PIN64_MAPPING_H
+
+#include <cstddef>
+#include <cstdint>
+
+// read-only memory mapping of a capture file; blocks loaded from a
+// capture are non-owning views into this mapping
+class pin64_mapping_t {
+public:
+	pin64_mapping_t()
+		: m_bytes(nullptr)
+		, m_size(0)
+#ifdef _WIN32
+		, m_file(nullptr)
+		, m_map(nullptr)
+#endif
+	{
+	}
+	~pin64_mapping_t() { close(); }
+
+	bool open(const char* name);
+	void close();
+
+	// getters
+	const uint8_t* bytes() const { return m_bytes; }
+	size_t size() const { return m_size; }
+	bool is_open() const { return m_bytes != nullptr; }
+
+private:
+	pin64_mapping_t(const pin64_mapping_t&) = delete;
+	pin64_mapping_t& operator=(const pin64_mapping_t&) = delete;
+
+	const uint8_t* m_bytes;
+	size_t m_size;
+
+#ifdef _WIN32
+	void* m_file;
+	void* m_map;
+#endif
+};
+
+#endif // PIN64_MAPPING_H
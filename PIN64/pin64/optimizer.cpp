@@ -0,0 +1,140 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#include "optimizer.h"
+#include "pin64.h"
+
+// the opcode bits are the same for every write to a slot, and the two bits
+// above them are ignored by the RDP
+static const uint64_t REGISTER_MASK = 0x3fffffffffffffffULL;
+
+bool pin64_optimizer_t::is_noop(const pin64_command_t& command) {
+	if (command.length == 0)
+		return true;
+
+	switch (command.opcode) {
+	case 0x00: // noop
+	case 0x26: // sync_load
+	case 0x27: // sync_pipe
+	case 0x28: // sync_tile
+	case 0x29: // sync_full
+		return true;
+	}
+
+	return false;
+}
+
+int32_t pin64_optimizer_t::register_slot(const pin64_command_t& command) {
+	switch (command.opcode) {
+	case 0x2a: // set_key_gb
+	case 0x2b: // set_key_r
+	case 0x2c: // set_convert
+	case 0x2d: // set_scissor
+	case 0x2e: // set_prim_depth
+	case 0x2f: // set_other_modes
+	case 0x37: // set_fill_color
+	case 0x38: // set_fog_color
+	case 0x39: // set_blend_color
+	case 0x3a: // set_prim_color
+	case 0x3b: // set_env_color
+	case 0x3c: // set_combine
+	case 0x3d: // set_texture_image
+	case 0x3e: // set_mask_image
+	case 0x3f: // set_color_image
+		return command.opcode;
+
+	case 0x35: // set_tile
+		return TILE_SLOT + (int32_t)((command.words[0] >> 24) & 7);
+
+	case 0x32: // set_tile_size
+		return TILE_SIZE_SLOT + (int32_t)((command.words[0] >> 24) & 7);
+	}
+
+	return -1;
+}
+
+bool pin64_optimizer_t::is_load(uint8_t opcode) {
+	return pin64_t::uses_data(opcode);
+}
+
+void pin64_optimizer_t::optimize(const std::vector<pin64_command_t>& commands, const std::vector<uint32_t>& frames, std::vector<bool>& keep, stats_t& stats) {
+	stats = stats_t();
+	keep.assign(commands.size(), true);
+
+	// dropping an overwritten write can make the write before it repeat the
+	// value in place, so passes continue until nothing more is dropped
+	while (optimize_pass(commands, frames, keep, stats)) { }
+
+	if (!commands.empty() && !keep.back()) {
+		keep.back() = true;
+		if (is_noop(commands.back()))
+			stats.noops--;
+		else
+			stats.repeated--;
+	}
+}
+
+bool pin64_optimizer_t::optimize_pass(const std::vector<pin64_command_t>& commands, const std::vector<uint32_t>& frames, std::vector<bool>& keep, stats_t& stats) {
+	// register contents are unknown until first set, since playback may
+	// start from any earlier state
+	uint64_t values[SLOT_COUNT];
+	bool known[SLOT_COUNT] = { false };
+
+	// the last write to each slot that nothing has read yet
+	int64_t unread[SLOT_COUNT];
+	for (int64_t& index : unread)
+		index = -1;
+
+	bool dropped = false;
+	size_t frame = 0;
+	for (size_t i = 0; i < commands.size(); i++) {
+		// keyframes hold the state at frame starts, so writes are never
+		// treated as overwritten across a frame boundary
+		for (; frame < frames.size() && frames[frame] <= i; frame++) {
+			for (int64_t& index : unread)
+				index = -1;
+		}
+
+		if (!keep[i])
+			continue;
+
+		const pin64_command_t& command = commands[i];
+		if (is_noop(command)) {
+			keep[i] = false;
+			stats.noops++;
+			dropped = true;
+			continue;
+		}
+
+		const int32_t slot = register_slot(command);
+		if (slot < 0) {
+			// anything else may read every register
+			for (int64_t& index : unread)
+				index = -1;
+
+			// loads also rewrite the size of the tile they load through
+			if (is_load(command.opcode))
+				known[TILE_SIZE_SLOT + (int32_t)((command.words[0] >> 24) & 7)] = false;
+			continue;
+		}
+
+		const uint64_t value = command.words[0] & REGISTER_MASK;
+		if (known[slot] && values[slot] == value) {
+			keep[i] = false;
+			stats.repeated++;
+			dropped = true;
+			continue;
+		}
+
+		if (unread[slot] >= 0) {
+			keep[(size_t)unread[slot]] = false;
+			stats.overwritten++;
+			dropped = true;
+		}
+
+		values[slot] = value;
+		known[slot] = true;
+		unread[slot] = (int64_t)i;
+	}
+
+	return dropped;
+}
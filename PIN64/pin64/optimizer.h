@@ -0,0 +1,44 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#pragma once
+
+#ifndef PIN64_OPTIMIZER_H
+#define PIN64_OPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct pin64_command_t;
+
+// finds the commands of a capture that have no observable effect: sync
+// and no-op commands, register sets that repeat the value already in
+// place, and register sets that are overwritten within the frame before
+// anything can read them
+class pin64_optimizer_t {
+public:
+	struct stats_t {
+		uint32_t noops;
+		uint32_t repeated;
+		uint32_t overwritten;
+	};
+
+	// fills keep with one flag per command; the last command is always kept,
+	// so that every frame still starts inside the command list
+	static void optimize(const std::vector<pin64_command_t>& commands, const std::vector<uint32_t>& frames, std::vector<bool>& keep, stats_t& stats);
+
+private:
+	static bool optimize_pass(const std::vector<pin64_command_t>& commands, const std::vector<uint32_t>& frames, std::vector<bool>& keep, stats_t& stats);
+
+	// register sets only depend on their command word; each one writes a
+	// single register, or the parameters or size of a single tile
+	static bool is_noop(const pin64_command_t& command);
+	static int32_t register_slot(const pin64_command_t& command);
+	static bool is_load(uint8_t opcode);
+
+	static const int32_t TILE_SLOT = 0x40;
+	static const int32_t TILE_SIZE_SLOT = 0x48;
+	static const int32_t SLOT_COUNT = 0x50;
+};
+
+#endif // PIN64_OPTIMIZER_H
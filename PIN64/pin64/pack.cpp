@@ -0,0 +1,214 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#include "pack.h"
+#include "pin64.h"
+#include "writer.h"
+
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+
+static const uint64_t PACK_CHECK_SEED = 0x50494e3634504b43ULL; // "PIN64PKC"
+
+static std::mutex s_cache_mutex;
+static std::map<std::string, std::shared_ptr<pin64_pack_t>> s_cache;
+
+// pin64_pack_t members
+
+bool pin64_pack_t::open(const char* name) {
+	close();
+
+	if (!m_mapping.open(name))
+		return false;
+
+	pin64_data_t data;
+	data.view(m_mapping.bytes(), m_mapping.size());
+
+	if (data.size() < HEADER_SIZE + 8 || memcmp(data.bytes(), pin64_t::PAK_ID, 8) != 0) {
+		printf("%s is not a PIN64 pack.\n", name);
+		close();
+		return false;
+	}
+
+	m_revision = data.get32(8);
+	const uint32_t block_count = data.get32(12);
+	const uint64_t dir_start = data.get64(16);
+	if (m_revision == 0 || m_revision > pin64_t::CAP_REVISION || dir_start < HEADER_SIZE + 8 || dir_start + 8 + (uint64_t)block_count * 8 > data.size()
+		|| memcmp(data.bytes() + dir_start, pin64_t::BDR_ID, 8) != 0) {
+		printf("Invalid header in pack %s.\n", name);
+		close();
+		return false;
+	}
+
+	const size_t block_header_size = pin64_block_t::header_size(m_revision);
+	m_mapped_blocks.reserve(block_count);
+	m_blocks.reserve(block_count);
+	for (uint32_t i = 0; i < block_count; i++) {
+		const uint64_t block_offset = data.get64((size_t)dir_start + 8 + i * 8);
+		if (block_offset < HEADER_SIZE + 8 || block_offset + block_header_size > dir_start) {
+			close();
+			return false;
+		}
+
+		data.offset((size_t)block_offset + 4); // skip header
+		const uint64_t block_id = data.get64();
+		const uint32_t block_flags = data.get32();
+		const size_t block_size = data.get32();
+		if (block_offset + block_header_size + block_size > dir_start) {
+			close();
+			return false;
+		}
+
+		m_mapped_blocks.emplace_back(data.curr(), block_size, block_id, block_flags);
+		if (!m_blocks.insert(block_id, &m_mapped_blocks.back())) {
+			printf("Duplicate block %08x%08x in pack %s.\n", (uint32_t)(block_id >> 32), (uint32_t)block_id, name);
+			close();
+			return false;
+		}
+	}
+
+	if (!check_chunks() || !pin64_t::unpack_blocks(m_mapped_blocks, m_revision)) {
+		printf("Unable to unpack blocks from %s.\n", name);
+		close();
+		return false;
+	}
+
+	pin64_t::assemble_blocks(m_mapped_blocks, m_blocks);
+	return true;
+}
+
+bool pin64_pack_t::check_chunks() {
+	// chunk lists are stored raw, and chunks are never chunked themselves
+	for (pin64_block_t& block : m_mapped_blocks) {
+		if (!block.chunked())
+			continue;
+
+		pin64_data_t* list = block.data();
+		if (block.compressed() || (list->size() % 8) != 0)
+			return false;
+
+		for (size_t offset = 0; offset < list->size(); offset += 8) {
+			pin64_block_t** chunk = m_blocks.find(list->get64(offset));
+			if (!chunk || (*chunk)->chunked())
+				return false;
+		}
+	}
+
+	return true;
+}
+
+void pin64_pack_t::close() {
+	m_blocks.clear();
+	m_mapped_blocks.clear();
+	m_mapping.close();
+	m_revision = 0;
+}
+
+pin64_block_t* pin64_pack_t::find(uint64_t id) {
+	pin64_block_t** block = m_blocks.find(id);
+	return block ? *block : nullptr;
+}
+
+std::shared_ptr<pin64_pack_t> pin64_pack_t::shared(const char* name) {
+	std::lock_guard<std::mutex> lock(s_cache_mutex);
+
+	std::shared_ptr<pin64_pack_t>& pack = s_cache[name];
+	if (!pack) {
+		std::shared_ptr<pin64_pack_t> opened = std::make_shared<pin64_pack_t>();
+		if (!opened->open(name)) {
+			s_cache.erase(name);
+			return nullptr;
+		}
+		pack = opened;
+	}
+
+	return pack;
+}
+
+void pin64_pack_t::evict(const char* name) {
+	// captures still playing from the pack keep it alive until they're cleared
+	std::lock_guard<std::mutex> lock(s_cache_mutex);
+	s_cache.erase(name);
+}
+
+void pin64_pack_t::flush() {
+	std::lock_guard<std::mutex> lock(s_cache_mutex);
+	s_cache.clear();
+}
+
+bool pin64_pack_t::is_manifest(pin64_data_t* data) {
+	return data->size() >= 8 && memcmp(data->bytes(), pin64_t::MAN_ID, 8) == 0;
+}
+
+// pin64_pack_writer_t members
+
+bool pin64_pack_writer_t::open(const char* name) {
+	close();
+
+	m_file = fopen(name, "wb");
+	if (m_file == nullptr) {
+		printf("Unable to open file %s for writing.\n", name);
+		return false;
+	}
+
+	// placeholder header, rewritten once the directory is known
+	pin64_writer_t::write(m_file, pin64_t::PAK_ID, 8);
+	pin64_writer_t::write(m_file, (uint32_t)0);
+	pin64_writer_t::write(m_file, (uint32_t)0);
+	pin64_writer_t::write(m_file, (uint64_t)0);
+	pin64_writer_t::write(m_file, pin64_t::BLK_ID, 8);
+	m_offset = pin64_pack_t::HEADER_SIZE + 8;
+
+	m_entries.clear();
+	m_directory.clear();
+	return true;
+}
+
+bool pin64_pack_writer_t::close() {
+	if (!m_file)
+		return false;
+
+	const uint64_t dir_start = m_offset;
+	pin64_writer_t::write(m_file, pin64_t::BDR_ID, 8);
+	for (uint64_t offset : m_directory)
+		pin64_writer_t::write(m_file, offset);
+
+	fseek(m_file, 0, SEEK_SET);
+	pin64_writer_t::write(m_file, pin64_t::PAK_ID, 8);
+	pin64_writer_t::write(m_file, pin64_t::CAP_REVISION);
+	pin64_writer_t::write(m_file, (uint32_t)m_directory.size());
+	pin64_writer_t::write(m_file, dir_start);
+
+	const bool ok = ferror(m_file) == 0;
+	fclose(m_file);
+	m_file = nullptr;
+	return ok;
+}
+
+uint64_t pin64_pack_writer_t::check_hash(pin64_block_t* block) {
+	return pin64_hash64(block->data()->bytes(), block->data_size(), PACK_CHECK_SEED);
+}
+
+bool pin64_pack_writer_t::conflicts(pin64_block_t* block) {
+	entry_t* entry = m_entries.find(block->hash());
+	if (!entry)
+		return false;
+
+	return entry->chunked != block->chunked() || entry->check != check_hash(block);
+}
+
+void pin64_pack_writer_t::add(pin64_block_t* block) {
+	if (!m_file || m_entries.contains(block->hash()))
+		return;
+
+	entry_t entry;
+	entry.check = check_hash(block);
+	entry.chunked = block->chunked();
+	m_entries.insert(block->hash(), entry);
+
+	// blocks keep the stored form they were loaded with
+	m_directory.push_back(m_offset);
+	pin64_writer_t::write(m_file, block);
+	m_offset += block->size();
+}
@@ -0,0 +1,83 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#pragma once
+
+#ifndef PIN64_PACK_H
+#define PIN64_PACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "block.h"
+#include "mapping.h"
+
+class pin64_data_t;
+
+// shared block store: blocks deduplicated across many captures, which are
+// then reduced to manifests that reference pack blocks by id
+class pin64_pack_t {
+public:
+	pin64_pack_t() : m_revision(0) { }
+
+	// maps the pack, then unpacks and assembles every block once
+	bool open(const char* name);
+	void close();
+
+	pin64_block_t* find(uint64_t id);
+	pin64_block_map_t& blocks() { return m_blocks; }
+	uint32_t revision() const { return m_revision; }
+
+	// packs stay open once used, so playing many manifests from the same
+	// pack unpacks each block only once
+	static std::shared_ptr<pin64_pack_t> shared(const char* name);
+	static void evict(const char* name);
+	static void flush();
+
+	static bool is_manifest(pin64_data_t* data);
+
+	// "PIN64PAK", revision, block count, start of block directory
+	static const size_t HEADER_SIZE = 24;
+
+private:
+	pin64_pack_t(const pin64_pack_t&) = delete;
+	pin64_pack_t& operator=(const pin64_pack_t&) = delete;
+
+	bool check_chunks();
+
+	pin64_mapping_t m_mapping;
+	std::vector<pin64_block_t> m_mapped_blocks;
+	pin64_block_map_t m_blocks;
+	uint32_t m_revision;
+};
+
+// writes a pack sequentially; the directory and final header follow the
+// last block
+class pin64_pack_writer_t {
+public:
+	pin64_pack_writer_t() : m_file(nullptr), m_offset(0) { }
+	~pin64_pack_writer_t() { close(); }
+
+	bool open(const char* name);
+	bool close();
+
+	// a block conflicts if the pack already holds different contents under its id
+	bool conflicts(pin64_block_t* block);
+	void add(pin64_block_t* block);
+
+private:
+	struct entry_t {
+		uint64_t check;
+		bool chunked;
+	};
+
+	static uint64_t check_hash(pin64_block_t* block);
+
+	FILE* m_file;
+	uint64_t m_offset;
+	pin64_hash_table_t<entry_t> m_entries;
+	std::vector<uint64_t> m_directory;
+};
+
+#endif // PIN64_PACK_H
@@ -5,8 +5,21 @@
 #include "block.h"
 #include "writer.h"
 #include "verifier.h"
+#include "threadpool.h"
+#include "chunker.h"
+#include "writequeue.h"
+#include "pack.h"
+#include "varint.h"
+#include "stream.h"
+#include "optimizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
 
 #define CAP_NAME "pin64_%d.cap"
+#define TRACE_NAME "pin64_%d.trace"
 
 // pin64_t members
 
@@ -16,6 +29,12 @@ const uint8_t pin64_t::CDR_ID[8] = { 'P', 'I', 'N', '6', '4', 'C', 'D', 'R' };
 const uint8_t pin64_t::BLK_ID[8] = { 'P', 'I', 'N', '6', '4', 'B', 'L', 'K' };
 const uint8_t pin64_t::CMD_ID[8] = { 'P', 'I', 'N', '6', '4', 'C', 'M', 'D' };
 const uint8_t pin64_t::MET_ID[8] = { 'P', 'I', 'N', '6', '4', 'M', 'E', 'T' };
+const uint8_t pin64_t::KEY_ID[8] = { 'P', 'I', 'N', '6', '4', 'K', 'E', 'Y' };
+const uint8_t pin64_t::PAK_ID[8] = { 'P', 'I', 'N', '6', '4', 'P', 'A', 'K' };
+const uint8_t pin64_t::MAN_ID[8] = { 'P', 'I', 'N', '6', '4', 'M', 'A', 'N' };
+const uint8_t pin64_t::CP2_ID[8] = { 'P', 'I', 'N', '6', '4', 'C', 'P', '2' };
+const uint8_t pin64_t::FRR_ID[8] = { 'P', 'I', 'N', '6', '4', 'F', 'R', 'R' };
+const uint8_t pin64_t::FHS_ID[8] = { 'P', 'I', 'N', '6', '4', 'F', 'H', 'S' };
 
 enum pin64_meta_offset : uint32_t {
 	VI_CONTROL = 0,
@@ -27,6 +46,25 @@ enum pin64_meta_offset : uint32_t {
 	VI_WIDTH = 24
 };
 
+static inline uint32_t read_be32(const uint8_t* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint64_t read_be64(const uint8_t* p) {
+	return ((uint64_t)read_be32(p) << 32) | read_be32(p + 4);
+}
+
+// manifest sections are read front to back: an id, an entry count, then
+// the entries, all of which have to fit in what is left of the file
+static bool read_preamble(pin64_data_t* data, const uint8_t* id, size_t entry_size, uint32_t& count) {
+	if (data->remaining() < 12 || memcmp(data->curr(), id, 8) != 0)
+		return false;
+
+	data->relative_offset(8);
+	count = data->get32();
+	return (uint64_t)count * entry_size <= data->remaining();
+}
+
 uint32_t pin64_t::vi_control() { return (m_playing ? m_current_meta->data()->get32(VI_CONTROL) : 0); }
 uint32_t pin64_t::vi_origin() { return (m_playing ? m_current_meta->data()->get32(VI_ORIGIN) : 0); }
 uint32_t pin64_t::vi_hstart() { return (m_playing ? m_current_meta->data()->get32(VI_HSTART) : 0); }
@@ -40,9 +78,14 @@ pin64_t::~pin64_t() {
 		finish();
 
 	clear();
+
+	// queued tasks may still hand batches back
+	m_writer.sync();
+	for (pin64_batch_t* batch : m_free_batches)
+		delete batch;
 }
 
-void pin64_t::start(int frames, uint32_t vi_control, uint32_t vi_origin, uint32_t vi_hstart, uint32_t vi_xscale, uint32_t vi_vstart, uint32_t vi_yscale, uint32_t vi_width) {
+void pin64_t::start(int frames, uint32_t vi_control, uint32_t vi_origin, uint32_t vi_hstart, uint32_t vi_xscale, uint32_t vi_vstart, uint32_t vi_yscale, uint32_t vi_width, bool streaming) {
 #if PIN64_ENABLE_CAPTURE
 	if (m_capture_index == ~0)
 		init_capture_index();
@@ -50,150 +93,1406 @@ void pin64_t::start(int frames, uint32_t vi_control, uint32_t vi_origin, uint32_
 	if (capturing())
 		fatalerror("PIN64: Call to start() while already capturing\n");
 
-	char name_buf[256];
-	sprintf(name_buf, CAP_NAME, m_capture_index);
-	m_capture_index++;
+	char name_buf[256];
+	sprintf(name_buf, CAP_NAME, m_capture_index);
+	m_capture_index++;
+
+	m_capture_file = fopen(name_buf, "wb");
+	if (m_capture_file == nullptr) {
+		printf("Unable to open file %s for writing.\n", name_buf);
+		return;
+	}
+
+	// the file belongs to the writer thread from here on
+	m_writer.open(m_capture_file);
+
+	m_capture_frames = frames;
+
+	if (m_trace_enabled) {
+		sprintf(name_buf, TRACE_NAME, m_capture_index - 1);
+		m_trace_file = fopen(name_buf, "wb");
+		if (m_trace_file == nullptr)
+			printf("Unable to open file %s for writing.\n", name_buf);
+	}
+
+	// the recording is only touched by the writer thread from here on
+	m_recording = new pin64_t();
+	m_streaming = streaming;
+	m_recording->m_streaming = streaming;
+	if (m_streaming) {
+		pin64_data_t* header = new pin64_data_t();
+		pin64_writer_t::write_stream_header(header);
+		m_writer.write(header, 0);
+		m_recording->m_stream_offset = header_size() + 8;
+	}
+
+	next_batch();
+	add_frame(vi_control, vi_origin, vi_hstart, vi_xscale, vi_vstart, vi_yscale, vi_width);
+	m_current_frame = 0;
+#endif
+}
+
+void pin64_t::finish(bool verify_in_memory) {
+	if (!capturing())
+		return;
+
+	data_end();
+	trace_frame();
+	submit_batch();
+
+	recycle_batch(m_batch);
+	m_batch = nullptr;
+
+	if (m_trace_file) {
+		fclose(m_trace_file);
+		m_trace_file = nullptr;
+	}
+
+	// ending a capture only hands work to the writer thread, which
+	// finishes the recording once it has taken in every batch
+	const int index = m_capture_index - 1;
+	pin64_t* recording = m_recording;
+	m_recording = nullptr;
+	if (m_streaming) {
+		// streamed blocks have already been released, so there is no
+		// in-memory image to check
+		m_writer.run([recording](FILE* file) {
+			recording->finish_command();
+
+			const uint64_t start = recording->m_stream_offset;
+			recording->flush_blocks(file);
+			recording->m_frame_ranges.push_back({ start, recording->m_stream_offset });
+
+			pin64_data_t trailer;
+			pin64_data_t header;
+			pin64_writer_t::write_stream_trailer(&trailer, &header, recording);
+			pin64_writer_t::seek(file, recording->m_stream_offset);
+			pin64_writer_t::write(file, trailer.bytes(), (uint32_t)trailer.size());
+			pin64_writer_t::seek(file, 0);
+			pin64_writer_t::write(file, header.bytes(), (uint32_t)header.size());
+			delete recording;
+		});
+		verify_in_memory = false;
+	} else {
+		m_writer.run([recording, verify_in_memory](FILE* file) {
+			recording->finish_command();
+			if (!recording->write_capture(file, verify_in_memory))
+				printf("Warning: Captured file did not pass verification.\n");
+			delete recording;
+		});
+	}
+
+	m_writer.close();
+	if (!verify_in_memory) {
+		m_writer.run([index](FILE*) {
+			if (!verify_file(index))
+				printf("Warning: Captured file did not pass verification.\n");
+		});
+	}
+
+	m_capture_file = nullptr;
+	clear();
+}
+
+bool pin64_t::write_capture(FILE* file, bool verify_in_memory) {
+	std::vector<pin64_block_t*> blocks;
+	blocks.reserve(m_blocks.size());
+	for (pin64_block_map_t::entry_t& block_pair : m_blocks)
+		blocks.push_back(block_pair.second);
+
+	compress_blocks(blocks);
+
+	if (!verify_in_memory) {
+		pin64_writer_t::write(file, this);
+		return true;
+	}
+
+	pin64_data_t image;
+	pin64_writer_t::write(&image, this);
+	pin64_writer_t::write(file, image.bytes(), (uint32_t)image.size());
+	return pin64_verifier_t::verify(&image);
+}
+
+bool pin64_t::load(int index, bool streaming) {
+	char name_buf[256];
+	sprintf(name_buf, CAP_NAME, index);
+	return load(name_buf, streaming);
+}
+
+bool pin64_t::load(const char* name, bool streaming) {
+	if (capturing())
+		return false;
+
+	// a capture that just finished may still be being written
+	m_writer.sync();
+
+	clear();
+
+	if (!m_mapping.open(name))
+		return false;
+
+	pin64_data_t data;
+	data.view(m_mapping.bytes(), m_mapping.size());
+
+	// manifests play from their pack, which is resident once opened, so
+	// they are never streamed
+	if (pin64_pack_t::is_manifest(&data)) {
+		if (!load_manifest(&data, name)) {
+			clear();
+			return false;
+		}
+		return true;
+	}
+
+	// block contents are checked as they are unpacked below
+	if (!pin64_verifier_t::verify(&data, false)) {
+		m_mapping.close();
+		return false;
+	}
+
+	if (is_v2(&data)) {
+		if (!load_v2(&data, name, streaming)) {
+			clear();
+			return false;
+		}
+		return true;
+	}
+
+	m_revision = revision(&data);
+
+	const uint32_t block_dir_start = data.get32(12);
+	const uint32_t block_dir_data_start = block_dir_start + 12;
+	const uint32_t block_count = data.get32(block_dir_start + 8); // skip header
+
+	m_mapped_blocks.reserve(block_count);
+	m_blocks.reserve(block_count);
+	for (uint32_t i = 0; i < block_count; i++) {
+		uint32_t block_offset = data.get32(block_dir_data_start + i * 4);
+		data.offset(block_offset + 4); // skip header
+		const uint64_t block_id = read_id(&data, m_revision);
+		const uint32_t block_flags = (m_revision > 0) ? data.get32() : 0;
+		const size_t block_size = data.get32();
+
+		m_mapped_blocks.emplace_back(data.curr(), block_size, block_id, block_flags);
+		m_blocks.insert(block_id, &m_mapped_blocks.back());
+		m_blocks_size += m_mapped_blocks.back().size();
+	}
+
+	if (!streaming) {
+		if (!unpack_blocks(m_mapped_blocks, m_revision)) {
+			printf("Unable to unpack blocks from %s.\n", name);
+			clear();
+			return false;
+		}
+
+		assemble_blocks(m_mapped_blocks, m_blocks);
+	}
+
+	data.offset(data.get32(16) + 8); // skip header
+	const uint32_t frame_count = data.get32();
+	m_frames.reserve(frame_count);
+	for (uint32_t i = 0; i < frame_count; i++)
+		m_frames.push_back(data.get32());
+
+	data.offset(data.get32(24) + 8); // skip header
+	const uint32_t command_count = data.get32();
+	m_commands.reserve(command_count);
+	for (uint32_t i = 0; i < command_count; i++)
+		m_commands.push_back(read_id(&data, m_revision));
+
+	if (!streaming && !build_command_arena()) {
+		printf("Unable to decode commands from %s.\n", name);
+		clear();
+		return false;
+	}
+
+	data.offset(data.get32(28) + 8); // skip header
+	const uint32_t meta_count = data.get32();
+	m_metas.reserve(meta_count);
+	for (uint32_t i = 0; i < meta_count; i++)
+		m_metas.push_back(read_id(&data, m_revision));
+
+	const uint32_t keyframes_start = (m_revision >= 4) ? data.get32(36) : 0;
+	if (keyframes_start != 0) {
+		data.offset(keyframes_start + 8); // skip header
+		const uint32_t keyframe_count = data.get32();
+		m_keyframes.resize(keyframe_count);
+		for (pin64_keyframe_t& keyframe : m_keyframes) {
+			keyframe.frame = data.get32();
+			keyframe.blocks.resize(data.get32());
+			for (uint64_t& block_id : keyframe.blocks)
+				block_id = data.get64();
+		}
+	}
+
+	const uint32_t frame_ranges_start = (m_revision >= 5) ? data.get32(40) : 0;
+	if (frame_ranges_start != 0) {
+		data.offset(frame_ranges_start + 8); // skip header
+		m_frame_ranges.resize(data.get32());
+		for (pin64_frame_range_t& range : m_frame_ranges) {
+			range.start = data.get32();
+			range.end = data.get32();
+		}
+	}
+
+	const uint32_t frame_hashes_start = (m_revision >= 6) ? data.get32(44) : 0;
+	if (frame_hashes_start != 0) {
+		data.offset(frame_hashes_start + 8); // skip header
+		m_frame_hashes.resize(data.get32());
+		for (pin64_frame_hashes_t& hashes : m_frame_hashes) {
+			hashes.color = data.get64();
+			hashes.depth = data.get64();
+			hashes.hidden = data.get64();
+		}
+	}
+
+	if (streaming)
+		m_stream = new pin64_stream_t(m_mapped_blocks, m_blocks, m_revision, m_commands, m_frames, m_metas);
+
+	return true;
+}
+
+bool pin64_t::load_v2(pin64_data_t* data, const char* name, bool streaming) {
+	// the verifier has already checked every offset and index used here
+	m_revision = data->get_le32(8);
+
+	const size_t block_dir_start = (size_t)data->get_le64(24);
+	const size_t block_count = (size_t)data->get_le64(block_dir_start + 8);
+	m_mapped_blocks.reserve(block_count);
+	m_blocks.reserve(block_count);
+	for (size_t i = 0; i < block_count; i++) {
+		const size_t entry = block_dir_start + 16 + i * V2_DIRECTORY_ENTRY_SIZE;
+		const uint64_t block_id = data->get_le64(entry);
+		const uint32_t block_flags = data->get_le32(entry + 8);
+		const size_t payload = (size_t)data->get_le64(entry + 16);
+		const size_t payload_size = (size_t)data->get_le64(entry + 24);
+
+		m_mapped_blocks.emplace_back(data->bytes() + payload, payload_size, block_id, block_flags);
+		m_blocks.insert(block_id, &m_mapped_blocks.back());
+		m_blocks_size += m_mapped_blocks.back().size();
+	}
+
+	if (!streaming) {
+		if (!unpack_blocks(m_mapped_blocks, m_revision)) {
+			printf("Unable to unpack blocks from %s.\n", name);
+			return false;
+		}
+
+		assemble_blocks(m_mapped_blocks, m_blocks);
+	}
+
+	std::vector<uint32_t> list;
+	pin64_get_index_list(data, data->get_le64(32), CDR_ID, m_frames);
+
+	pin64_get_index_list(data, data->get_le64(48), CMD_ID, list);
+	m_commands.reserve(list.size());
+	for (uint32_t index : list)
+		m_commands.push_back(m_mapped_blocks[index].hash());
+
+	pin64_get_index_list(data, data->get_le64(56), MET_ID, list);
+	m_metas.reserve(list.size());
+	for (uint32_t index : list)
+		m_metas.push_back(m_mapped_blocks[index].hash());
+
+	const size_t keyframes_start = (size_t)data->get_le64(64);
+	if (keyframes_start != 0) {
+		size_t offset = keyframes_start + 16;
+		m_keyframes.resize((size_t)data->get_le64(keyframes_start + 8));
+		for (pin64_keyframe_t& keyframe : m_keyframes) {
+			keyframe.frame = data->get_le32(offset);
+			keyframe.blocks.resize(data->get_le32(offset + 4));
+			offset += 8;
+			for (uint64_t& block_id : keyframe.blocks) {
+				block_id = m_mapped_blocks[data->get_le32(offset)].hash();
+				offset += 4;
+			}
+		}
+	}
+
+	const size_t frame_ranges_start = (m_revision >= 5) ? (size_t)data->get_le64(72) : 0;
+	if (frame_ranges_start != 0) {
+		m_frame_ranges.resize((size_t)data->get_le64(frame_ranges_start + 8));
+		for (size_t i = 0; i < m_frame_ranges.size(); i++) {
+			m_frame_ranges[i].start = data->get_le64(frame_ranges_start + 16 + i * 16);
+			m_frame_ranges[i].end = data->get_le64(frame_ranges_start + 24 + i * 16);
+		}
+	}
+
+	const size_t frame_hashes_start = (m_revision >= 6) ? (size_t)data->get_le64(80) : 0;
+	if (frame_hashes_start != 0) {
+		m_frame_hashes.resize((size_t)data->get_le64(frame_hashes_start + 8));
+		for (size_t i = 0; i < m_frame_hashes.size(); i++) {
+			m_frame_hashes[i].color = data->get_le64(frame_hashes_start + 16 + i * 24);
+			m_frame_hashes[i].depth = data->get_le64(frame_hashes_start + 24 + i * 24);
+			m_frame_hashes[i].hidden = data->get_le64(frame_hashes_start + 32 + i * 24);
+		}
+	}
+
+	if (streaming) {
+		m_stream = new pin64_stream_t(m_mapped_blocks, m_blocks, m_revision, m_commands, m_frames, m_metas);
+		return true;
+	}
+
+	if (!build_command_arena()) {
+		printf("Unable to decode commands from %s.\n", name);
+		return false;
+	}
+
+	return true;
+}
+
+bool pin64_t::convert(int index) {
+	if (capturing())
+		return false;
+
+	m_playing = false;
+	if (!load(index))
+		return false;
+
+	if (m_pack || m_revision == 0 || m_mapped_blocks.empty()) {
+		printf("Unable to convert pin64_%d.cap.\n", index);
+		clear();
+		return false;
+	}
+
+	// an already converted capture is left as it is
+	pin64_data_t check;
+	check.view(m_mapping.bytes(), m_mapping.size());
+	if (is_v2(&check)) {
+		clear();
+		return true;
+	}
+
+	// block payloads are copied as stored, so nothing is recompressed; the
+	// contents were checked while loading, so only the layout is verified
+	pin64_data_t image;
+	pin64_writer_t::write_v2(&image, this);
+	clear();
+
+	if (!pin64_verifier_t::verify(&image, false)) {
+		printf("Converted pin64_%d.cap did not pass verification.\n", index);
+		return false;
+	}
+
+	char name_buf[256];
+	char temp_buf[256];
+	sprintf(name_buf, CAP_NAME, index);
+	sprintf(temp_buf, CAP_NAME ".tmp", index);
+
+	FILE* file = fopen(temp_buf, "wb");
+	if (file == nullptr) {
+		printf("Unable to open file %s for writing.\n", temp_buf);
+		return false;
+	}
+
+	const bool written = fwrite(image.bytes(), 1, image.size(), file) == image.size();
+	fclose(file);
+	if (!written) {
+		remove(temp_buf);
+		return false;
+	}
+
+	remove(name_buf);
+	return rename(temp_buf, name_buf) == 0;
+}
+
+bool pin64_t::load_manifest(pin64_data_t* data, const char* name) {
+	data->offset(8); // skip header
+	if (data->remaining() < 8)
+		return false;
+
+	m_revision = data->get32();
+	const uint32_t name_size = data->get32();
+	if (m_revision == 0 || m_revision > CAP_REVISION || name_size == 0 || name_size > data->remaining()) {
+		printf("Invalid header in manifest %s.\n", name);
+		return false;
+	}
+
+	const std::string pack_name((const char*)data->curr(), name_size);
+	data->relative_offset(name_size);
+
+	uint32_t count = 0;
+	if (!read_preamble(data, CDR_ID, sizeof(uint32_t), count) || count == 0)
+		return false;
+	m_frames.reserve(count);
+	for (uint32_t i = 0; i < count; i++)
+		m_frames.push_back(data->get32());
+
+	if (!read_preamble(data, CMD_ID, sizeof(uint64_t), count))
+		return false;
+	m_commands.reserve(count);
+	for (uint32_t i = 0; i < count; i++)
+		m_commands.push_back(data->get64());
+
+	if (!read_preamble(data, MET_ID, sizeof(uint64_t), count) || count != m_frames.size())
+		return false;
+	m_metas.reserve(count);
+	for (uint32_t i = 0; i < count; i++)
+		m_metas.push_back(data->get64());
+
+	// keyframes and frame hashes are both optional, in that order
+	if (data->remaining() >= 8 && memcmp(data->curr(), KEY_ID, 8) == 0) {
+		if (!read_preamble(data, KEY_ID, sizeof(uint32_t) * 2, count))
+			return false;
+		m_keyframes.resize(count);
+		for (pin64_keyframe_t& keyframe : m_keyframes) {
+			if (data->remaining() < sizeof(uint32_t) * 2)
+				return false;
+			keyframe.frame = data->get32();
+			keyframe.blocks.resize(data->get32());
+			if (keyframe.blocks.size() * sizeof(uint64_t) > data->remaining())
+				return false;
+			for (uint64_t& block_id : keyframe.blocks)
+				block_id = data->get64();
+		}
+	}
+
+	if (data->remaining() > 0) {
+		if (!read_preamble(data, FHS_ID, sizeof(uint64_t) * 3, count) || count != m_frames.size() || data->remaining() != (size_t)count * 24)
+			return false;
+		m_frame_hashes.resize(count);
+		for (pin64_frame_hashes_t& hashes : m_frame_hashes) {
+			hashes.color = data->get64();
+			hashes.depth = data->get64();
+			hashes.hidden = data->get64();
+		}
+	}
+
+	for (size_t i = 0; i < m_frames.size(); i++) {
+		if (m_frames[i] > m_commands.size() || (i > 0 && m_frames[i] < m_frames[i - 1]))
+			return false;
+	}
+
+	m_pack = pin64_pack_t::shared(pack_name.c_str());
+	if (!m_pack) {
+		printf("Unable to open pack %s for manifest %s.\n", pack_name.c_str(), name);
+		return false;
+	}
+
+	for (uint64_t meta_id : m_metas) {
+		if (!find_block(meta_id))
+			return false;
+	}
+
+	for (const pin64_keyframe_t& keyframe : m_keyframes) {
+		for (uint64_t block_id : keyframe.blocks) {
+			if (!find_block(block_id))
+				return false;
+		}
+	}
+
+	if (!build_command_arena()) {
+		printf("Unable to decode commands from %s.\n", name);
+		return false;
+	}
+
+	return true;
+}
+
+bool pin64_t::pack(const char* pack_name, const std::vector<int>& indices) {
+	if (capturing())
+		return false;
+
+	m_playing = false;
+	m_writer.sync();
+	clear();
+
+	char temp_buf[256];
+	sprintf(temp_buf, "%s.tmp", pack_name);
+
+	pin64_pack_writer_t writer;
+	if (!writer.open(temp_buf))
+		return false;
+
+	// blocks already in the pack are carried over, so manifests that use
+	// it stay valid
+	FILE* existing_file = fopen(pack_name, "rb");
+	if (existing_file != nullptr) {
+		fclose(existing_file);
+
+		pin64_pack_t existing;
+		if (!existing.open(pack_name)) {
+			writer.close();
+			remove(temp_buf);
+			return false;
+		}
+
+		for (pin64_block_map_t::entry_t& block_pair : existing.blocks())
+			writer.add(block_pair.second);
+	}
+
+	// manifests are only swapped in once the pack holding their blocks is
+	std::vector<int> packed;
+	bool ok = true;
+	for (int index : indices) {
+		if (!load(index)) {
+			ok = false;
+			continue;
+		}
+
+		if (m_pack || m_revision == 0) {
+			printf("Unable to pack %s capture pin64_%d.cap.\n", m_pack ? "manifest" : "legacy", index);
+			clear();
+			ok = false;
+			continue;
+		}
+
+		bool conflict = false;
+		for (pin64_block_t& block : m_mapped_blocks)
+			conflict = conflict || writer.conflicts(&block);
+
+		if (conflict) {
+			printf("Block id collision while packing pin64_%d.cap.\n", index);
+			clear();
+			ok = false;
+			continue;
+		}
+
+		for (pin64_block_t& block : m_mapped_blocks)
+			writer.add(&block);
+
+		sprintf(temp_buf, CAP_NAME ".tmp", index);
+		FILE* file = fopen(temp_buf, "wb");
+		if (file == nullptr) {
+			printf("Unable to open file %s for writing.\n", temp_buf);
+			clear();
+			ok = false;
+			continue;
+		}
+
+		pin64_writer_t::write_manifest(file, this, pack_name);
+		fclose(file);
+		packed.push_back(index);
+		clear();
+	}
+
+	sprintf(temp_buf, "%s.tmp", pack_name);
+	if (!writer.close()) {
+		remove(temp_buf);
+		return false;
+	}
+
+	pin64_pack_t::evict(pack_name);
+	remove(pack_name);
+	if (rename(temp_buf, pack_name) != 0)
+		return false;
+
+	char name_buf[256];
+	for (int index : packed) {
+		sprintf(name_buf, CAP_NAME, index);
+		sprintf(temp_buf, CAP_NAME ".tmp", index);
+		remove(name_buf);
+		if (rename(temp_buf, name_buf) != 0)
+			ok = false;
+	}
+
+	return ok;
+}
+
+void pin64_t::play(int index, bool streaming) {
+	char name_buf[256];
+	sprintf(name_buf, CAP_NAME, index);
+	play(name_buf, streaming);
+}
+
+void pin64_t::play(const char* name, bool streaming) {
+	if (capturing() || m_playing)
+		return;
+
+	if (!load(name, streaming))
+		return;
+
+	// captures that start with a keyframe, such as slices, start from its state
+	if (m_player && !m_keyframes.empty() && m_keyframes[0].frame == 0 && !restore_keyframe(m_keyframes[0]))
+		printf("Unable to restore the starting state of %s.\n", name);
+
+	if (m_player)
+		m_player->save_keyframe(m_rewind_state);
+	m_rewindable = true;
+
+	m_current_frame = 0;
+	if (m_stream)
+		m_stream->start(0, m_stream_budget, m_stream_ahead);
+
+	m_divergent_frame = NO_DIVERGENCE;
+	m_playing = true;
+	update_blocks();
+}
+
+bool pin64_t::rewind() {
+	if (capturing() || m_playing || !m_rewindable)
+		return false;
+
+	if (m_player && !m_player->load_keyframe(m_rewind_state))
+		return false;
+
+	restart(0);
+	return true;
+}
+
+bool pin64_t::cue(uint32_t frame) {
+	if (capturing() || m_playing || !m_rewindable || frame >= m_frames.size())
+		return false;
+
+	restart(frame);
+	return true;
+}
+
+// resident blocks stay in the stream, so within the budget a restart
+// unpacks nothing it already has
+void pin64_t::restart(uint32_t frame) {
+	if (m_stream) {
+		if (m_stream_frame)
+			m_stream->release(m_stream_frame);
+		m_stream_frame = nullptr;
+		m_stream->start(frame, m_stream_budget, m_stream_ahead);
+	}
+
+	m_current_frame = frame;
+	m_divergent_frame = NO_DIVERGENCE;
+	m_playing = true;
+	update_blocks();
+}
+
+bool pin64_t::build_keyframes(int index, uint32_t interval) {
+	char name_buf[256];
+	sprintf(name_buf, CAP_NAME, index);
+	return build_keyframes(name_buf, interval);
+}
+
+bool pin64_t::build_keyframes(const char* name, uint32_t interval) {
+	if (capturing() || !m_player || interval == 0)
+		return false;
+
+	m_playing = false;
+	if (!load(name))
+		return false;
+
+	// legacy block ids can't be rewritten under the current revision, and
+	// manifests don't hold the blocks a rewrite would need
+	if (m_revision == 0 || m_pack) {
+		printf("Unable to add keyframes to %s %s.\n", m_pack ? "manifest" : "legacy capture", name);
+		clear();
+		return false;
+	}
+
+	// keyframes are taken from the state the capture starts in, not from
+	// whatever an earlier pass left in the player
+	m_player->clear_state();
+	if (!m_keyframes.empty() && m_keyframes[0].frame == 0 && !restore_keyframe(m_keyframes[0])) {
+		printf("Unable to restore the starting state of %s.\n", name);
+		clear();
+		return false;
+	}
+
+	m_keyframes.clear();
+	m_current_frame = 0;
+	update_blocks();
+
+	m_playing = true;
+	while (m_playing) {
+		if ((m_current_frame % interval) == 0)
+			add_keyframe();
+		run_frame();
+	}
+
+	compress_blocks(m_added_blocks);
+
+	return replace_capture(name);
+}
+
+bool pin64_t::optimize(int index) {
+	if (capturing() || !m_player)
+		return false;
+
+	m_playing = false;
+	if (!load(index))
+		return false;
+
+	if (m_revision == 0 || m_pack) {
+		printf("Unable to optimize %s pin64_%d.cap.\n", m_pack ? "manifest" : "legacy capture", index);
+		clear();
+		return false;
+	}
+
+	std::vector<bool> keep;
+	pin64_optimizer_t::stats_t stats;
+	pin64_optimizer_t::optimize(m_native_commands, m_frames, keep, stats);
+
+	const uint32_t removed = stats.noops + stats.repeated + stats.overwritten;
+	if (removed == 0) {
+		clear();
+		return true;
+	}
+
+	std::vector<uint64_t> commands;
+	std::vector<uint32_t> frames(m_frames.size());
+	commands.reserve(m_commands.size() - removed);
+	size_t frame = 0;
+	for (size_t i = 0; i < m_commands.size(); i++) {
+		for (; frame < m_frames.size() && m_frames[frame] <= i; frame++)
+			frames[frame] = (uint32_t)commands.size();
+		if (keep[i])
+			commands.push_back(m_commands[i]);
+	}
+	// frames with no commands at the end start past the last one
+	for (; frame < m_frames.size(); frame++)
+		frames[frame] = (uint32_t)commands.size();
+
+	// both command lists are played from the same starting state, and the
+	// rewrite only goes ahead if every frame renders identically
+	std::vector<pin64_block_t*> start;
+	m_player->save_keyframe(start);
+
+	std::vector<uint64_t> expected;
+	std::vector<uint64_t> hashes;
+	hash_frames(expected);
+
+	m_commands.swap(commands);
+	m_frames.swap(frames);
+	m_command_arena.clear();
+	m_native_commands.clear();
+	const bool decoded = build_command_arena();
+
+	if (decoded && m_player->load_keyframe(start))
+		hash_frames(hashes);
+
+	for (pin64_block_t* block : start)
+		delete block;
+
+	if (hashes != expected) {
+		printf("Optimized pin64_%d.cap does not render identically; leaving it unchanged.\n", index);
+		clear();
+		return false;
+	}
+
+	printf("Removed %u of %u commands from pin64_%d.cap (%u no-ops, %u repeated and %u overwritten register sets).\n",
+		removed, (uint32_t)commands.size(), index, stats.noops, stats.repeated, stats.overwritten);
+
+	collect_blocks();
+	return replace_capture(index);
+}
+
+bool pin64_t::slice(int index, int out_index, uint32_t first_frame, uint32_t frame_count) {
+	if (capturing() || frame_count == 0)
+		return false;
+
+	m_playing = false;
+	if (!load(index, true))
+		return false;
+
+	if ((uint64_t)first_frame + frame_count > m_frames.size()) {
+		printf("pin64_%d.cap has no frames %d to %d.\n", index, first_frame, first_frame + frame_count - 1);
+		clear();
+		return false;
+	}
+
+	const uint32_t end_frame = first_frame + frame_count;
+	const uint32_t command_end = (end_frame == m_frames.size()) ? (uint32_t)m_commands.size() : m_frames[end_frame];
+	return slice_range(index, out_index, first_frame, end_frame, m_frames[first_frame], command_end);
+}
+
+bool pin64_t::slice_commands(int index, int out_index, uint32_t frame, uint32_t first_command, uint32_t command_count) {
+	if (capturing() || command_count == 0)
+		return false;
+
+	m_playing = false;
+	if (!load(index, true))
+		return false;
+
+	const uint32_t frame_start = (frame < m_frames.size()) ? m_frames[frame] : 0;
+	const uint32_t frame_end = (frame + 1 >= m_frames.size()) ? (uint32_t)m_commands.size() : m_frames[frame + 1];
+	if (frame >= m_frames.size() || (uint64_t)first_command + command_count > frame_end - frame_start) {
+		printf("pin64_%d.cap has no commands %d to %d in frame %d.\n", index, first_command, first_command + command_count - 1, frame);
+		clear();
+		return false;
+	}
+
+	return slice_range(index, out_index, frame, frame + 1, frame_start + first_command, frame_start + first_command + command_count);
+}
+
+// the capture is loaded for streaming, so only the blocks of the slice, and
+// those played to reach its start, are ever unpacked
+bool pin64_t::slice_range(int index, int out_index, uint32_t first_frame, uint32_t end_frame, uint32_t command_start, uint32_t command_end) {
+	// legacy block ids can't be carried over into the current revision, and
+	// manifests don't hold the blocks a slice would need
+	if (m_revision == 0 || m_pack) {
+		printf("Unable to slice %s pin64_%d.cap.\n", m_pack ? "manifest" : "legacy capture", index);
+		clear();
+		return false;
+	}
+
+	// the source's keyframes carry over when the slice starts on a frame,
+	// and its frame hashes when it is made of whole frames
+	std::vector<pin64_keyframe_t> keyframes;
+	if (command_start == m_frames[first_frame]) {
+		for (const pin64_keyframe_t& keyframe : m_keyframes) {
+			if (keyframe.frame >= first_frame && keyframe.frame < end_frame) {
+				keyframes.push_back(keyframe);
+				keyframes.back().frame -= first_frame;
+			}
+		}
+	}
+
+	std::vector<pin64_frame_hashes_t> frame_hashes;
+	const uint32_t frames_end = (end_frame == m_frames.size()) ? (uint32_t)m_commands.size() : m_frames[end_frame];
+	if (!m_frame_hashes.empty() && command_start == m_frames[first_frame] && command_end == frames_end)
+		frame_hashes.assign(m_frame_hashes.begin() + first_frame, m_frame_hashes.begin() + end_frame);
+
+	std::vector<pin64_block_t*> state;
+	if (command_start > 0 && (keyframes.empty() || keyframes[0].frame != 0)) {
+		if (!m_player) {
+			printf("Unable to slice pin64_%d.cap from frame %d without a player for the state at the cut.\n", index, first_frame);
+			clear();
+			return false;
+		}
+
+		if (!run_to(first_frame, command_start)) {
+			printf("Unable to play pin64_%d.cap up to frame %d.\n", index, first_frame);
+			clear();
+			return false;
+		}
+
+		m_player->save_keyframe(state);
+	}
+
+	// the stream refers to the lists that are about to be replaced
+	close_stream();
+
+	std::vector<uint64_t> commands(m_commands.begin() + command_start, m_commands.begin() + command_end);
+	std::vector<uint64_t> metas(m_metas.begin() + first_frame, m_metas.begin() + end_frame);
+	std::vector<uint32_t> frames;
+	for (uint32_t frame = first_frame; frame < end_frame; frame++) {
+		const uint32_t start = std::max(m_frames[frame], command_start) - command_start;
+		if (start >= commands.size()) {
+			printf("Frame %d of pin64_%d.cap has no commands to slice.\n", frame, index);
+			for (pin64_block_t* block : state)
+				delete block;
+			clear();
+			return false;
+		}
+		frames.push_back(start);
+	}
+
+	m_commands.swap(commands);
+	m_metas.swap(metas);
+	m_frames.swap(frames);
+	m_keyframes.swap(keyframes);
+	m_frame_hashes.swap(frame_hashes);
+	m_frame_ranges.clear();
+
+	// command blocks stay in their stored form while streaming; unpacking the
+	// slice's lets their data blocks be found
+	for (uint64_t id : m_commands) {
+		pin64_block_t* block = find_block(id);
+		if (block && !block->decompress()) {
+			printf("Unable to unpack a command block of pin64_%d.cap.\n", index);
+			for (pin64_block_t* state_block : state)
+				delete state_block;
+			clear();
+			return false;
+		}
+	}
+
+	collect_blocks();
+
+	if (!state.empty()) {
+		pin64_keyframe_t keyframe;
+		keyframe.frame = 0;
+		for (pin64_block_t* block : state) {
+			const bool inserted = insert_block(block);
+			keyframe.blocks.push_back(block->hash());
+
+			if (inserted)
+				m_added_blocks.push_back(block);
+			else
+				delete block;
+		}
+
+		m_keyframes.insert(m_keyframes.begin(), keyframe);
+		compress_blocks(m_added_blocks);
+	}
+
+	printf("Sliced %d frames and %d commands from pin64_%d.cap into pin64_%d.cap.\n",
+		(uint32_t)m_frames.size(), (uint32_t)m_commands.size(), index, out_index);
+
+	return replace_capture(out_index);
+}
+
+bool pin64_t::validate(int index) {
+	if (capturing() || !m_player)
+		return false;
+
+	m_playing = false;
+	if (!load(index, true))
+		return false;
+
+	if (m_frame_hashes.empty()) {
+		printf("pin64_%d.cap has no frame hashes to validate against.\n", index);
+		clear();
+		return false;
+	}
+
+	if (!m_keyframes.empty() && m_keyframes[0].frame == 0 && !restore_keyframe(m_keyframes[0])) {
+		printf("Unable to restore the starting state of pin64_%d.cap.\n", index);
+		clear();
+		return false;
+	}
+
+	const bool enabled = m_validate;
+	m_validate = true;
+	m_divergent_frame = NO_DIVERGENCE;
+
+	m_current_frame = 0;
+	if (m_stream)
+		m_stream->start(0, m_stream_budget, m_stream_ahead);
+
+	m_playing = true;
+	update_blocks();
+	while (m_playing)
+		run_frame();
+
+	m_validate = enabled;
+	const bool matched = (m_divergent_frame == NO_DIVERGENCE) && (m_current_frame >= m_frames.size());
+	if (matched)
+		printf("All %d frames of pin64_%d.cap match their recorded hashes.\n", (uint32_t)m_frames.size(), index);
+
+	clear();
+	return matched;
+}
+
+void pin64_t::hash_frames(std::vector<uint64_t>& hashes) {
+	hashes.clear();
+	hashes.reserve(m_frames.size());
+
+	m_current_frame = 0;
+	update_blocks();
+
+	m_playing = true;
+	while (m_playing) {
+		run_frame();
+		hashes.push_back(m_player->frame_hash());
+	}
+}
+
+void pin64_t::collect_blocks() {
+	// keeps the blocks the command list, metas and keyframes still refer
+	// to, including data blocks and the chunks of chunked blocks
+	pin64_hash_table_t<uint8_t> reachable;
+	std::vector<pin64_block_t*> pending;
+	reachable.reserve(m_blocks.size());
+
+	auto reach = [this, &reachable, &pending](uint64_t id) {
+		pin64_block_t** block = m_blocks.find(id);
+		if (block && reachable.insert(id, 1))
+			pending.push_back(*block);
+	};
+
+	for (uint64_t id : m_commands)
+		reach(id);
+	for (uint64_t id : m_metas)
+		reach(id);
+	for (pin64_keyframe_t& keyframe : m_keyframes) {
+		for (uint64_t id : keyframe.blocks)
+			reach(id);
+	}
+
+	while (!pending.empty()) {
+		pin64_block_t* block = pending.back();
+		pending.pop_back();
+
+		uint64_t data_id;
+		if (data_ref(block, m_revision, data_id))
+			reach(data_id);
+
+		if (block->chunked()) {
+			pin64_data_t list;
+			list.view(block->stored_bytes(), block->stored_size());
+			for (size_t i = 0; i < list.size() / 8; i++)
+				reach(list.get64());
+		}
+	}
 
-	m_capture_file = fopen(name_buf, "wb");
+	if (reachable.size() == m_blocks.size())
+		return;
 
-	m_capture_frames = frames;
+	pin64_block_map_t blocks;
+	blocks.reserve(reachable.size());
+	m_blocks_size = 0;
+	for (pin64_block_map_t::entry_t& block_pair : m_blocks) {
+		if (reachable.contains(block_pair.first)) {
+			blocks.insert(block_pair.first, block_pair.second);
+			m_blocks_size += block_pair.second->size();
+		} else if (m_mapped_blocks.empty()) {
+			delete block_pair.second;
+		}
+	}
 
-	m_frames.push_back(0);
-	add_meta(vi_control, vi_origin, vi_hstart, vi_xscale, vi_vstart, vi_yscale, vi_width);
-	m_current_frame = 0;
-#endif
+	m_blocks = blocks;
 }
 
-void pin64_t::finish() {
-	if (!capturing())
-		return;
+bool pin64_t::replace_capture(int index) {
+	char name_buf[256];
+	sprintf(name_buf, CAP_NAME, index);
+	return replace_capture(name_buf);
+}
+
+bool pin64_t::replace_capture(const char* name) {
+	char temp_buf[256];
+	sprintf(temp_buf, "%s.tmp", name);
 
-	finalize();
+	FILE* file = fopen(temp_buf, "wb");
+	if (file == nullptr) {
+		printf("Unable to open file %s for writing.\n", temp_buf);
+		clear();
+		return false;
+	}
 
-	pin64_writer_t::write(m_capture_file, this);
+	// converted captures keep the version-2 layout
+	bool written = true;
+	pin64_data_t loaded;
+	loaded.view(m_mapping.bytes(), m_mapping.size());
+	if (is_v2(&loaded)) {
+		pin64_data_t image;
+		pin64_writer_t::write_v2(&image, this);
+		written = fwrite(image.bytes(), 1, image.size(), file) == image.size();
+	} else {
+		pin64_writer_t::write(file, this);
+	}
+	written = !ferror(file) && written;
+	if (fclose(file) != 0)
+		written = false;
+
+	// a short write, such as on a full disk, leaves the original in place
+	if (!written) {
+		printf("Unable to write file %s.\n", temp_buf);
+		remove(temp_buf);
+		clear();
+		return false;
+	}
 
+	// the mapping has to be closed before the capture can be replaced
 	clear();
+	remove(name);
+	if (rename(temp_buf, name) != 0)
+		return false;
 
-	if (!verify(m_capture_index - 1))
-		printf("Warning: Captured file did not pass verification.\n");
+	m_writer.sync();
+	return verify_file(name);
 }
 
-void pin64_t::finalize() {
-	finish_command();
-	data_end();
-}
+bool pin64_t::seek(uint32_t frame) {
+	if (capturing() || !m_player || frame >= m_frames.size())
+		return false;
 
-bool pin64_t::load(int index) {
-	if (capturing())
+	std::vector<pin64_keyframe_t>::iterator it = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), frame,
+		[](uint32_t target, const pin64_keyframe_t& keyframe) { return target < keyframe.frame; });
+	if (it == m_keyframes.begin())
 		return false;
 
-	char name_buf[256];
-	sprintf(name_buf, CAP_NAME, index);
+	// a keyframe's blocks can only be pinned while the stream is stopped
+	if (m_stream) {
+		if (m_stream_frame)
+			m_stream->release(m_stream_frame);
+		m_stream_frame = nullptr;
+		m_stream->stop();
+	}
 
-	pin64_data_t data;
-	if (!data.load_file(name_buf))
+	const pin64_keyframe_t& keyframe = *(it - 1);
+	if (!restore_keyframe(keyframe)) {
+		m_playing = false;
 		return false;
+	}
 
-	if (!pin64_verifier_t::verify(&data))
-		return false;
+	restart(keyframe.frame);
+	while (m_playing && m_current_frame < frame)
+		run_frame();
 
-	clear();
+	return m_current_frame == frame;
+}
 
-	const uint32_t block_dir_start = data.get32(12);
-	const uint32_t block_dir_data_start = block_dir_start + 12;
-	const uint32_t block_count = data.get32(block_dir_start + 8); // skip header
+bool pin64_t::restore_keyframe(const pin64_keyframe_t& keyframe) {
+	std::vector<pin64_block_t*> blocks;
+	blocks.reserve(keyframe.blocks.size());
 
-	for (uint32_t i = 0; i < block_count; i++) {
-		uint32_t block_offset = data.get32(block_dir_data_start + i * 4);
-		data.offset(block_offset + 8); // skip header + CRC
-		const size_t block_size = data.get32();
+	if (!m_stream) {
+		for (uint64_t block_id : keyframe.blocks)
+			blocks.push_back(find_block(block_id));
+
+		return m_player->load_keyframe(blocks);
+	}
 
-		pin64_block_t *block = new pin64_block_t(&data, block_size);
+	std::vector<uint32_t> pins;
+	const bool loaded = m_stream->pin_blocks(keyframe.blocks, blocks, pins) && m_player->load_keyframe(blocks);
+	m_stream->unpin_blocks(pins);
+	return loaded;
+}
 
-		m_blocks[block->crc32()] = block;
+// streams the capture through the player up to the given frame and
+// command, starting from the nearest keyframe; without one, playback
+// starts at the first frame from the player's current state
+bool pin64_t::run_to(uint32_t frame, uint32_t command) {
+	std::vector<pin64_keyframe_t>::iterator it = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), frame,
+		[](uint32_t target, const pin64_keyframe_t& keyframe) { return target < keyframe.frame; });
+
+	uint32_t start = 0;
+	if (it != m_keyframes.begin()) {
+		if (!restore_keyframe(*(it - 1)))
+			return false;
+		start = (it - 1)->frame;
 	}
 
-	data.offset(data.get32(16) + 8); // skip header
-	const uint32_t frame_count = data.get32();
-	for (uint32_t i = 0; i < frame_count; i++)
-		m_frames.push_back(data.get32());
+	m_current_frame = start;
+	m_stream->start(start, m_stream_budget, m_stream_ahead);
 
-	data.offset(data.get32(24) + 8); // skip header
-	const uint32_t command_count = data.get32();
-	for (uint32_t i = 0; i < command_count; i++)
-		m_commands.push_back(data.get32());
+	m_playing = true;
+	update_blocks();
+	while (m_playing && m_current_frame < frame)
+		run_frame();
 
-	data.offset(data.get32(28) + 8); // skip header
-	const uint32_t meta_count = data.get32();
-	for (uint32_t i = 0; i < meta_count; i++)
-		m_metas.push_back(data.get32());
+	while (m_playing && m_command_index < command) {
+		m_player->execute_command();
+		next_command();
+	}
 
-	return true;
+	const bool reached = m_playing;
+	m_playing = false;
+	return reached;
 }
 
-void pin64_t::play(int index) {
-	if (capturing() || m_playing)
-		return;
+void pin64_t::run_frame() {
+	while (m_commands_left > 0) {
+		m_player->execute_command();
+		next_command();
+	}
 
-	if (!load(index))
-		return;
+	next_frame();
+}
 
-	m_current_frame = 0;
+void pin64_t::next_frame() {
+	if (m_validate && m_player && m_current_frame < m_frame_hashes.size())
+		check_frame();
 
-	update_blocks();
+	m_current_frame++;
+	if (m_current_frame >= m_frames.size()) {
+		m_playing = false;
+	} else {
+		update_blocks();
+	}
+}
 
-	m_playing = true;
+void pin64_t::check_frame() {
+	const pin64_frame_hashes_t& expected = m_frame_hashes[m_current_frame];
+	pin64_frame_hashes_t actual;
+	m_player->frame_hashes(actual);
+
+	const char* kind = nullptr;
+	if (expected.color && expected.color != actual.color)
+		kind = "color";
+	else if (expected.depth && expected.depth != actual.depth)
+		kind = "depth";
+	else if (expected.hidden && expected.hidden != actual.hidden)
+		kind = "hidden bits";
+
+	// later frames usually follow from the first divergence, so only that
+	// one is reported
+	if (kind && m_divergent_frame == NO_DIVERGENCE) {
+		m_divergent_frame = m_current_frame;
+		printf("Frame %d diverges from the capture (%s).\n", m_current_frame, kind);
+	}
+}
+
+void pin64_t::add_keyframe() {
+	std::vector<pin64_block_t*> blocks;
+	m_player->save_keyframe(blocks);
+
+	pin64_keyframe_t keyframe;
+	keyframe.frame = m_current_frame;
+	for (pin64_block_t* block : blocks) {
+		const bool inserted = insert_block(block);
+		keyframe.blocks.push_back(block->hash());
+
+		if (inserted)
+			m_added_blocks.push_back(block);
+		else
+			delete block;
+	}
+
+	m_keyframes.push_back(keyframe);
 }
 
 void pin64_t::update_blocks() {
-	m_current_meta = m_blocks[m_metas[m_current_frame]];
+	if (m_stream && !update_stream())
+		return;
+
+	m_current_meta = m_stream ? m_stream_frame->meta : find_block(m_metas[m_current_frame]);
 	m_command_index = m_frames[m_current_frame];
 	m_commands_left = ((m_current_frame == ((uint32_t)m_frames.size() - 1)) ? (uint32_t)m_commands.size() : m_frames[m_current_frame + 1]) - m_command_index;
 	update_command();
 }
 
+bool pin64_t::update_stream() {
+	// the previous frame's blocks become evictable once it has been played
+	if (m_stream_frame)
+		m_stream->release(m_stream_frame);
+
+	m_stream_frame = m_stream->acquire();
+	if (m_stream_frame->valid && m_stream_frame->frame == m_current_frame)
+		return true;
+
+	printf("Unable to stream frame %d of the capture.\n", m_current_frame);
+	m_stream->release(m_stream_frame);
+	m_stream_frame = nullptr;
+
+	m_playing = false;
+	m_current_meta = nullptr;
+	m_commands_left = 0;
+	update_command();
+	return false;
+}
+
 void pin64_t::update_command() {
-	m_current_command = ((m_commands_left > 0) ? m_blocks[m_commands[m_command_index]] : nullptr);
+	if (m_commands_left == 0)
+		m_native_command = nullptr;
+	else if (m_stream_frame)
+		m_native_command = &m_stream_frame->commands[m_command_index - m_frames[m_current_frame]];
+	else
+		m_native_command = &m_native_commands[m_command_index];
+
+	m_current_command = (m_native_command ? m_native_command->block : nullptr);
+	m_current_data = (m_native_command ? m_native_command->data : nullptr);
+}
 
-	if (m_current_command) {
-		pin64_data_t* data = m_current_command->data();
-		const uint8_t command_byte = data->get8(4) & 0x3f;
-		if (command_byte == 0x30 || command_byte == 0x33 || command_byte == 0x34) {
-			m_current_data = m_blocks[data->get32(data->get32(0) * 8 + 4)];
-		} else {
-			m_current_data = nullptr;
+bool pin64_t::build_command_arena() {
+	// decode each unique command block once, then resolve every command in
+	// the stream to its words and data block
+	pin64_hash_table_t<uint32_t> offsets;
+	std::vector<uint32_t> command_offsets(m_commands.size());
+	m_native_commands.resize(m_commands.size());
+
+	for (size_t i = 0; i < m_commands.size(); i++) {
+		uint32_t* existing = offsets.find(m_commands[i]);
+		if (existing) {
+			const pin64_command_t& first = m_native_commands[*existing];
+			m_native_commands[i] = first;
+			command_offsets[i] = command_offsets[*existing];
+			continue;
 		}
-	} else {
-		m_current_data = nullptr;
+
+		pin64_block_t* block = find_block(m_commands[i]);
+		if (!block)
+			return false;
+
+		pin64_command_t& command = m_native_commands[i];
+		size_t offset;
+		if (!decode_command(block, command, m_command_arena, offset))
+			return false;
+
+		if (uses_data(command.opcode)) {
+			uint64_t data_id;
+			if (!data_ref(block, m_revision, data_id))
+				return false;
+
+			command.data = find_block(data_id);
+		}
+
+		command_offsets[i] = (uint32_t)offset;
+		offsets.insert(m_commands[i], (uint32_t)i);
 	}
+
+	// the arena is complete, so its storage no longer moves
+	for (size_t i = 0; i < m_native_commands.size(); i++)
+		m_native_commands[i].words = m_command_arena.data() + command_offsets[i];
+
+	return true;
+}
+
+bool pin64_t::decode_command(pin64_block_t* block, pin64_command_t& command, std::vector<uint64_t>& arena, size_t& offset) {
+	const uint8_t* bytes = block->data()->bytes();
+	const size_t size = block->data()->size();
+	if (size < 4)
+		return false;
+
+	const uint32_t length = read_be32(bytes);
+	if (length > MAX_COMMAND_LENGTH || 4 + (size_t)length * 8 > size)
+		return false;
+
+	command.words = nullptr;
+	command.length = length;
+	command.opcode = (length > 0) ? (bytes[4] & 0x3f) : 0;
+	command.block = block;
+	command.data = nullptr;
+
+	offset = arena.size();
+	for (uint32_t j = 0; j < length; j++)
+		arena.push_back(read_be64(bytes + 4 + j * 8));
+
+	return true;
 }
 
-void pin64_t::add_meta(uint32_t vi_control, uint32_t vi_origin, uint32_t vi_hstart, uint32_t vi_xscale, uint32_t vi_vstart, uint32_t vi_yscale, uint32_t vi_width) {
-	pin64_block_t* info = new pin64_block_t();
-	info->data()->put32(vi_control);
-	info->data()->put32(vi_origin);
-	info->data()->put32(vi_hstart);
-	info->data()->put32(vi_xscale);
-	info->data()->put32(vi_vstart);
-	info->data()->put32(vi_yscale);
-	info->data()->put32(vi_width);
+bool pin64_t::uses_data(uint8_t opcode) {
+	// load_tlut, load_block and load_tile reference a data block
+	return opcode == 0x30 || opcode == 0x33 || opcode == 0x34;
+}
+
+void pin64_t::add_frame(uint32_t vi_control, uint32_t vi_origin, uint32_t vi_hstart, uint32_t vi_xscale, uint32_t vi_vstart, uint32_t vi_yscale, uint32_t vi_width) {
+	pin64_data_t& arena = m_batch->arena;
+	m_batch->entries.push_back({ pin64_batch_t::ENTRY_FRAME, arena.size(), 7 * sizeof(uint32_t) });
+
+	const uint32_t meta[7] = { vi_control, vi_origin, vi_hstart, vi_xscale, vi_vstart, vi_yscale, vi_width };
+	for (uint32_t value : meta)
+		arena.put32(value);
+
+	memcpy(m_frame_vi, meta, sizeof(meta));
+}
 
-	bool inserted = insert_block(info);
+void pin64_t::add_frame_hashes(const uint8_t* rdram, const uint8_t* hidden_bits, size_t size, uint32_t zb_address) {
+	if (!capturing() || m_hash_kinds == 0)
+		return;
 
-	m_metas.push_back(info->crc32());
+	// hashing is cheap next to the frame itself, so it is done here rather
+	// than copying the memory over to the writer thread
+	pin64_frame_hashes_t hashes;
+	hash_frame(hashes, m_hash_kinds, rdram, hidden_bits, size, zb_address,
+		m_frame_vi[VI_CONTROL / 4], m_frame_vi[VI_ORIGIN / 4], m_frame_vi[VI_VSTART / 4], m_frame_vi[VI_YSCALE / 4], m_frame_vi[VI_WIDTH / 4]);
+
+	pin64_data_t& arena = m_batch->arena;
+	m_batch->entries.push_back({ pin64_batch_t::ENTRY_HASHES, arena.size(), 3 * sizeof(uint64_t) });
+	arena.put64(hashes.color);
+	arena.put64(hashes.depth);
+	arena.put64(hashes.hidden);
+}
 
-	if (!inserted)
-		delete info;
+void pin64_t::hash_frame(pin64_frame_hashes_t& hashes, uint32_t kinds, const uint8_t* rdram, const uint8_t* hidden_bits, size_t size,
+	uint32_t zb_address, uint32_t vi_control, uint32_t vi_origin, uint32_t vi_vstart, uint32_t vi_yscale, uint32_t vi_width) {
+	hashes = pin64_frame_hashes_t();
+
+	// the displayed height as the VI scales it; blanked and unsupported
+	// pixel sizes display nothing
+	const int32_t vdiff = ((int32_t)(vi_vstart & 0x3ff) - (int32_t)((vi_vstart >> 16) & 0x3ff)) >> 1;
+	const uint64_t rows = (vdiff > 0) ? ((uint64_t)vdiff * (vi_yscale & 0xfff)) >> 10 : 0;
+	const uint64_t pixels = rows * (vi_width & 0xfff);
+	const uint64_t pixel_size = ((vi_control & 3) == 3) ? 4 : ((vi_control & 3) == 2) ? 2 : 0;
+
+	// regions are clamped to memory, as the VI wraps rather than faults
+	auto hash_region = [size](const uint8_t* base, uint64_t start, uint64_t length) {
+		if (start >= size)
+			return pin64_hash64(base, 0);
+		return pin64_hash64(base + start, (size_t)std::min<uint64_t>(length, size - start));
+	};
+
+	const uint32_t origin = vi_origin & 0xffffff;
+	if ((kinds & FRAME_HASH_COLOR) && rdram)
+		hashes.color = hash_region(rdram, origin, pixels * pixel_size);
+	if ((kinds & FRAME_HASH_DEPTH) && rdram)
+		hashes.depth = hash_region(rdram, zb_address & 0xffffff, pixels * 2);
+	if ((kinds & FRAME_HASH_HIDDEN) && hidden_bits)
+		hashes.hidden = hash_region(hidden_bits, origin >> 1, pixels);
 }
 
 void pin64_t::mark_frame(running_machine& machine, uint32_t vi_control, uint32_t vi_origin, uint32_t vi_hstart, uint32_t vi_xscale, uint32_t vi_vstart, uint32_t vi_yscale, uint32_t vi_width) {
 	if (m_playing) {
-		m_current_frame++;
-		if (m_current_frame >= m_frames.size()) {
-			m_playing = false;
-		} else {
-			update_blocks();
-		}
+		next_frame();
 	}
 #if PIN64_ENABLE_CAPTURE
 	else if (capturing()) {
@@ -201,8 +1500,10 @@ void pin64_t::mark_frame(running_machine& machine, uint32_t vi_control, uint32_t
 			finish();
 			machine.popmessage("Done recording.");
 		} else {
-			m_frames.push_back((uint32_t)m_commands.size());
-			add_meta(vi_control, vi_origin, vi_hstart, vi_xscale, vi_vstart, vi_yscale, vi_width);
+			trace_frame();
+			add_frame(vi_control, vi_origin, vi_hstart, vi_xscale, vi_vstart, vi_yscale, vi_width);
+			if (m_batch->arena.size() >= BATCH_SIZE)
+				submit_batch();
 			m_current_frame++;
 		}
 	}
@@ -217,7 +1518,7 @@ void pin64_t::mark_frame(running_machine& machine, uint32_t vi_control, uint32_t
 			finish();
 			machine.popmessage("Done recording.");
 		} else {
-			start(0, vi_control, vi_origin, vi_hstart, vi_xscale, vi_vstart, vi_yscale, vi_width);
+			start(0, vi_control, vi_origin, vi_hstart, vi_xscale, vi_vstart, vi_yscale, vi_width, true);
 			machine.popmessage("Recording PIN64 movie to pin64_%d.cap", m_capture_index - 1);
 		}
 	}
@@ -227,7 +1528,8 @@ void pin64_t::mark_frame(running_machine& machine, uint32_t vi_control, uint32_t
 void pin64_t::next_command() {
 #ifdef PIN64_STANDALONE_BUILD
 	if (m_commands_left == 0) {
-		mark_frame(running_machine());
+		running_machine machine;
+		mark_frame(machine);
 	}
 #endif
 	m_commands_left--;
@@ -240,17 +1542,134 @@ void pin64_t::command(uint64_t* cmd_data, uint32_t size) {
 	if (!capturing())
 		return;
 
-	finish_command();
+	// a command and the data block that follows it always share a batch
+	if (!m_data_open && m_batch->arena.size() >= BATCH_SIZE)
+		submit_batch();
+
+	pin64_data_t& arena = m_batch->arena;
+	m_batch->entries.push_back({ pin64_batch_t::ENTRY_COMMAND, arena.size(), sizeof(uint32_t) + size * sizeof(uint64_t) });
+	arena.put32(size);
+	arena.put64(cmd_data, size);
+
+	if (m_trace_file) {
+		m_trace_buffer.put32(size);
+		m_trace_buffer.put64(cmd_data, size);
+	}
+}
+
+void pin64_t::trace_frame() {
+	if (!m_trace_file)
+		return;
+
+	m_trace_buffer.put32(0);
+	fwrite(m_trace_buffer.bytes(), 1, m_trace_buffer.size(), m_trace_file);
+	m_trace_buffer.clear();
+}
+
+void pin64_t::next_batch() {
+	m_batch = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_batch_mutex);
+		if (!m_free_batches.empty()) {
+			m_batch = m_free_batches.back();
+			m_free_batches.pop_back();
+		}
+	}
+
+	if (!m_batch) {
+		m_batch = new pin64_batch_t();
+		m_batch->arena.reserve(BATCH_SIZE + MAX_COMMAND_LENGTH * sizeof(uint64_t));
+		m_batch->entries.reserve(BATCH_SIZE / 16);
+	}
+}
+
+void pin64_t::submit_batch() {
+	if (m_batch->entries.empty())
+		return;
+
+	pin64_batch_t* batch = m_batch;
+	pin64_t* recording = m_recording;
+	m_writer.run([this, batch, recording](FILE* file) {
+		recording->ingest(batch, file);
+		recycle_batch(batch);
+	});
+
+	next_batch();
+}
+
+void pin64_t::recycle_batch(pin64_batch_t* batch) {
+	// cleared batches keep their storage, so steady-state capture doesn't allocate
+	batch->arena.clear();
+	batch->entries.clear();
+
+	std::lock_guard<std::mutex> lock(m_batch_mutex);
+	m_free_batches.push_back(batch);
+}
+
+void pin64_t::ingest(pin64_batch_t* batch, FILE* file) {
+	const uint8_t* bytes = batch->arena.bytes();
+	for (const pin64_batch_t::entry_t& entry : batch->entries) {
+		switch (entry.type) {
+		case pin64_batch_t::ENTRY_COMMAND:
+			finish_command();
+			m_current_command = new pin64_block_t();
+			m_current_command->data()->put(bytes + entry.offset, entry.size);
+			break;
+
+		case pin64_batch_t::ENTRY_DATA: {
+			pin64_block_t* data = new pin64_block_t();
+			data->data()->put(bytes + entry.offset, entry.size);
+			if (data->data()->size() >= pin64_chunker_t::MIN_SPLIT_SIZE)
+				data = chunk_block(data);
+
+			const bool inserted = insert_block(data);
+			if (m_current_command) {
+				m_current_command->data()->put64(data->hash());
+				finish_command();
+			}
+
+			if (!inserted)
+				delete data;
+			break;
+		}
+
+		case pin64_batch_t::ENTRY_FRAME: {
+			// the pending command is only finished by the next command or
+			// data block, so it is counted in the frame that follows; the
+			// verifier relies on every frame starting before the last command
+			if (m_streaming && !m_frames.empty()) {
+				const uint64_t start = m_stream_offset;
+				flush_blocks(file);
+				m_frame_ranges.push_back({ start, m_stream_offset });
+			}
 
-	m_current_command = new pin64_block_t();
-	m_current_command->data()->put32(size);
+			m_frames.push_back((uint32_t)m_commands.size());
+			if (!m_frame_hashes.empty())
+				m_frame_hashes.resize(m_frames.size());
+
+			pin64_block_t* info = new pin64_block_t();
+			info->data()->put(bytes + entry.offset, entry.size);
+
+			const bool inserted = insert_block(info);
+			m_metas.push_back(info->hash());
+			if (!inserted)
+				delete info;
+			break;
+		}
 
-	printf("c");
-	for (uint32_t i = 0; i < size; i++) {
-		m_current_command->data()->put64(cmd_data[i]);
-		printf(" %08x%08x", (uint32_t)(cmd_data[i] >> 32), (uint32_t)cmd_data[i]);
+		case pin64_batch_t::ENTRY_HASHES: {
+			// frames captured before hashing was enabled are left unchecked;
+			// the pending command that moves to the next frame is the display
+			// list's closing sync, which leaves memory as it was
+			m_frame_hashes.resize(m_frames.size());
+			pin64_frame_hashes_t& hashes = m_frame_hashes.back();
+			hashes.color = read_be64(bytes + entry.offset);
+			hashes.depth = read_be64(bytes + entry.offset + 8);
+			hashes.hidden = read_be64(bytes + entry.offset + 16);
+			break;
+		}
+		}
 	}
-	printf("\n");
 }
 
 void pin64_t::finish_command() {
@@ -259,7 +1678,7 @@ void pin64_t::finish_command() {
 
 	bool inserted = insert_block(m_current_command);
 
-	m_commands.push_back(m_current_command->crc32());
+	m_commands.push_back(m_current_command->hash());
 
 	if (!inserted) {
 		delete m_current_command;
@@ -272,55 +1691,235 @@ void pin64_t::data_begin() {
 	if (!capturing())
 		return;
 
-	if (m_current_data)
-		data_end();
+	data_end();
 
-	m_current_data = new pin64_block_t();
+	// the data is written straight into the batch; its size is known at data_end()
+	m_batch->entries.push_back({ pin64_batch_t::ENTRY_DATA, m_batch->arena.size(), 0 });
+	m_data_open = true;
 }
 
 pin64_data_t* pin64_t::data_block() {
+	if (m_data_open)
+		return &m_batch->arena;
+
 	if (!m_current_data)
 		return &m_dummy_data;
 
 	return m_current_data->data();
 }
 
+pin64_block_t* pin64_t::find_block(uint64_t id) {
+	pin64_block_t** block = m_blocks.find(id);
+	if (block)
+		return *block;
+
+	return m_pack ? m_pack->find(id) : nullptr;
+}
+
 bool pin64_t::insert_block(pin64_block_t* block) {
 	block->finalize();
-	if (m_blocks.find(block->crc32()) == m_blocks.end()) {
-		m_blocks[block->crc32()] = block;
-		return true;
+
+	for (;;) {
+		pin64_block_t** existing = m_blocks.find(block->hash());
+		if (!existing)
+			break;
+
+		// same id: either a true duplicate, or a hash collision that needs a new id
+		if ((*existing)->matches(block))
+			return false;
+
+		block->rehash();
 	}
-	return false;
+
+	m_blocks.insert(block->hash(), block);
+	m_blocks_size += block->size();
+	if (m_streaming)
+		m_pending_blocks.push_back(block);
+	return true;
+}
+
+void pin64_t::compress_blocks(std::vector<pin64_block_t*>& blocks) {
+	size_t old_size = 0;
+	for (pin64_block_t* block : blocks)
+		old_size += block->size();
+
+	pin64_thread_pool_t::shared().parallel_for(blocks.size(), [&blocks](size_t i) {
+		blocks[i]->compress();
+	});
+
+	size_t new_size = 0;
+	for (pin64_block_t* block : blocks)
+		new_size += block->size();
+
+	m_blocks_size = m_blocks_size - old_size + new_size;
+}
+
+bool pin64_t::unpack_blocks(std::vector<pin64_block_t>& blocks, uint32_t revision) {
+	// each block is decompressed and hashed exactly once, in parallel
+	std::atomic<bool> failed(false);
+	pin64_thread_pool_t::shared().parallel_for(blocks.size(), [&blocks, revision, &failed](size_t i) {
+		if (failed)
+			return;
+
+		pin64_block_t& block = blocks[i];
+		if (!block.decompress() || !block.verify(revision))
+			failed = true;
+	});
+
+	return !failed;
+}
+
+void pin64_t::assemble_blocks(std::vector<pin64_block_t>& blocks, pin64_block_map_t& map) {
+	// chunk ids were checked by the verifier, and chunks are never chunked
+	std::vector<pin64_block_t*> lists;
+	for (pin64_block_t& block : blocks) {
+		if (block.chunked())
+			lists.push_back(&block);
+	}
+
+	pin64_thread_pool_t::shared().parallel_for(lists.size(), [&lists, &map](size_t i) {
+		pin64_data_t* list = lists[i]->data();
+		std::vector<pin64_block_t*> chunks(list->size() / 8);
+		for (pin64_block_t*& chunk : chunks)
+			chunk = *map.find(list->get64());
+
+		lists[i]->assemble(chunks);
+	});
+}
+
+void pin64_t::flush_blocks(FILE* file) {
+	if (m_pending_blocks.empty())
+		return;
+
+	compress_blocks(m_pending_blocks);
+
+	// runs on the writer thread, which owns the file; the frame's new
+	// blocks are appended at the stream offset
+	pin64_writer_t::seek(file, m_stream_offset);
+	for (pin64_block_t* block : m_pending_blocks) {
+		pin64_writer_t::write(file, block);
+
+		m_stream_directory.push_back((uint32_t)m_stream_offset);
+		m_stream_offset += block->size();
+
+		block->release();
+	}
+
+	m_pending_blocks.clear();
 }
 
 void pin64_t::data_end() {
-	if (!capturing() || !m_current_data)
+	if (!capturing() || !m_data_open)
 		return;
 
-	bool inserted = insert_block(m_current_data);
+	pin64_batch_t::entry_t& entry = m_batch->entries.back();
+	entry.size = m_batch->arena.size() - entry.offset;
+	m_data_open = false;
+}
 
-	m_current_command->data()->put32(m_current_data->crc32());
-	finish_command();
+pin64_block_t* pin64_t::chunk_block(pin64_block_t* block) {
+	pin64_data_t* data = block->data();
 
-	if (!inserted)
-		delete m_current_data;
+	std::vector<size_t> ends;
+	pin64_chunker_t::split(data->bytes(), data->size(), ends);
+	if (ends.size() < 2)
+		return block;
 
-	m_current_data = nullptr;
+	pin64_block_t* list = new pin64_block_t();
+	list->set_chunked();
+
+	size_t start = 0;
+	for (size_t end : ends) {
+		pin64_block_t* chunk = new pin64_block_t();
+		chunk->data()->put(data->bytes() + start, end - start);
+
+		const bool inserted = insert_block(chunk);
+		list->data()->put64(chunk->hash());
+		if (!inserted)
+			delete chunk;
+
+		start = end;
+	}
+
+	delete block;
+	return list;
 }
 
 size_t pin64_t::size() {
-	return header_size() + block_directory_size() + cmdlist_directory_size() + cmdlist_size() + blocks_size() + metas_size();
+	return header_size() + block_directory_size() + cmdlist_directory_size() + cmdlist_size() + blocks_size() + metas_size() + keyframes_size() + frame_ranges_size() + frame_hashes_size();
 }
 
-size_t pin64_t::header_size() {
+size_t pin64_t::header_size(uint32_t revision) {
+	if (revision == 0)
+		return LEGACY_HEADER_SIZE;
+
+	if (revision < 4)
+		return LEGACY_HEADER_SIZE + sizeof(uint32_t); // revision
+
+	if (revision < 5)
+		return LEGACY_HEADER_SIZE + sizeof(uint32_t) * 2; // revision, start of keyframes
+
+	if (revision < 6)
+		return LEGACY_HEADER_SIZE + sizeof(uint32_t) * 3; // revision, start of keyframes, start of frame ranges
+
 	return sizeof(char) * 8 // "PIN64CAP"
 		+ sizeof(uint32_t) // total file size
 		+ sizeof(uint32_t) // start of block directory data
 		+ sizeof(uint32_t) // start of command-list directory data
 		+ sizeof(uint32_t) // start of blocks
 		+ sizeof(uint32_t) // start of commands
-		+ sizeof(uint32_t);// start of metas
+		+ sizeof(uint32_t) // start of metas
+		+ sizeof(uint32_t) // revision
+		+ sizeof(uint32_t) // start of keyframes, or 0
+		+ sizeof(uint32_t) // start of frame ranges, or 0
+		+ sizeof(uint32_t);// start of frame hashes, or 0
+}
+
+uint32_t pin64_t::revision(pin64_data_t* data) {
+	// the header ends where the first section begins; revision 0 captures
+	// have no room for the revision field
+	const uint32_t block_dir_start = data->get32(12);
+	const uint32_t blocks_start = data->get32(20);
+	const uint32_t header_end = (block_dir_start < blocks_start) ? block_dir_start : blocks_start;
+	return (header_end > LEGACY_HEADER_SIZE) ? data->get32(LEGACY_HEADER_SIZE) : 0;
+}
+
+uint64_t pin64_t::read_id(pin64_data_t* data, uint32_t revision) {
+	return (revision > 0) ? data->get64() : data->get32();
+}
+
+bool pin64_t::is_v2(pin64_data_t* data) {
+	return data->size() >= 8 && memcmp(data->bytes(), CP2_ID, 8) == 0;
+}
+
+size_t pin64_t::v2_header_size(uint32_t revision) {
+	if (revision < 5)
+		return V2_HEADER_SIZE;
+
+	if (revision < 6)
+		return V2_HEADER_SIZE + sizeof(uint64_t); // start of frame ranges, or 0
+
+	return V2_HEADER_SIZE + sizeof(uint64_t) * 2; // start of frame ranges and of frame hashes, or 0
+}
+
+bool pin64_t::data_ref(pin64_block_t* command, uint32_t revision, uint64_t& id) {
+	const uint8_t* bytes = command->data()->bytes();
+	const size_t size = command->data()->size();
+	if (size < 5)
+		return false;
+
+	const uint32_t length = read_be32(bytes);
+	const uint8_t opcode = bytes[4] & 0x3f;
+	if (length == 0 || !uses_data(opcode))
+		return false;
+
+	const size_t offset = 4 + (size_t)length * 8;
+	const size_t id_size = (revision > 0) ? 8 : 4;
+	if (offset + id_size > size)
+		return false;
+
+	id = (revision > 0) ? read_be64(bytes + offset) : read_be32(bytes + offset);
+	return true;
 }
 
 size_t pin64_t::block_directory_size() const {
@@ -332,55 +1931,147 @@ size_t pin64_t::cmdlist_directory_size() const {
 }
 
 size_t pin64_t::blocks_size() {
-	size_t block_size = sizeof(char) * 8;
-	for (std::pair<uint32_t, pin64_block_t*> block_pair : m_blocks)
-		block_size += (block_pair.second)->size();
-
-	return block_size;
+	return sizeof(char) * 8 + m_blocks_size;
 }
 
 size_t pin64_t::cmdlist_size() const {
-	return (m_commands.size() + 1) * sizeof(uint32_t) + sizeof(char) * 8;
+	return m_commands.size() * sizeof(uint64_t) + sizeof(uint32_t) + sizeof(char) * 8;
 }
 
 size_t pin64_t::metas_size() const {
-	return (m_metas.size() + 1) * sizeof(uint32_t) + sizeof(char) * 8;
+	return m_metas.size() * sizeof(uint64_t) + sizeof(uint32_t) + sizeof(char) * 8;
+}
+
+size_t pin64_t::keyframes_size() const {
+	if (m_keyframes.empty())
+		return 0;
+
+	size_t size = sizeof(char) * 8 + sizeof(uint32_t);
+	for (const pin64_keyframe_t& keyframe : m_keyframes)
+		size += sizeof(uint32_t) * 2 + keyframe.blocks.size() * sizeof(uint64_t);
+	return size;
+}
+
+size_t pin64_t::frame_ranges_size() const {
+	if (m_frame_ranges.empty())
+		return 0;
+
+	return sizeof(char) * 8 + sizeof(uint32_t) + m_frame_ranges.size() * sizeof(uint32_t) * 2;
+}
+
+size_t pin64_t::frame_hashes_size() const {
+	if (m_frame_hashes.empty())
+		return 0;
+
+	return sizeof(char) * 8 + sizeof(uint32_t) + m_frame_hashes.size() * sizeof(uint64_t) * 3;
 }
 
 bool pin64_t::verify(int index) {
+	m_writer.sync();
+	return verify_file(index);
+}
+
+bool pin64_t::verify_file(int index) {
 	char name_buf[256];
 	sprintf(name_buf, CAP_NAME, index);
+	return verify_file(name_buf);
+}
 
-	pin64_data_t data;
-	if (!data.load_file(name_buf))
+bool pin64_t::verify_file(const char* name) {
+	pin64_mapping_t mapping;
+	if (!mapping.open(name))
 		return false;
 
+	pin64_data_t data;
+	data.view(mapping.bytes(), mapping.size());
+
+	// a manifest is checked against its pack by loading it
+	if (pin64_pack_t::is_manifest(&data)) {
+		pin64_t capture;
+		return capture.load(name);
+	}
+
 	return pin64_verifier_t::verify(&data);
 }
 
 void pin64_t::clear() {
 	if (capturing()) {
-		fclose(m_capture_file);
+		// abandoned captures are dropped once the writer is done with them
+		pin64_t* recording = m_recording;
+		m_writer.run([recording](FILE*) { delete recording; });
+		m_writer.close();
 		m_capture_file = nullptr;
+
+		recycle_batch(m_batch);
+		m_recording = nullptr;
+		m_batch = nullptr;
+		m_data_open = false;
+
+		if (m_trace_file) {
+			fclose(m_trace_file);
+			m_trace_file = nullptr;
+		}
+		m_trace_buffer.clear();
+	}
+
+	// the stream's blocks are copies of the mapped ones, so it goes first
+	close_stream();
+
+	for (pin64_block_t* block : m_rewind_state)
+		delete block;
+	m_rewind_state.clear();
+	m_rewindable = false;
+
+	if (m_mapped_blocks.empty()) {
+		for (pin64_block_map_t::entry_t& block_pair : m_blocks)
+			delete block_pair.second;
+	} else {
+		for (pin64_block_t* block : m_added_blocks)
+			delete block;
 	}
+	m_added_blocks.clear();
 
-	for (std::pair<uint32_t, pin64_block_t*> block_pair : m_blocks)
-		delete block_pair.second;
+	m_blocks_size = 0;
+	m_streaming = false;
+	m_stream_offset = 0;
+	m_stream_directory.clear();
+	m_pending_blocks.clear();
 
 	m_current_frame = 0;
 	m_commands_left = 0;
 	m_command_index = 0;
 
 	m_blocks.clear();
+	m_mapped_blocks.clear();
+	m_mapping.close();
+	m_pack.reset();
+	m_revision = CAP_REVISION;
 	m_commands.clear();
 	m_frames.clear();
 	m_metas.clear();
+	m_keyframes.clear();
+	m_frame_ranges.clear();
+	m_frame_hashes.clear();
+	m_command_arena.clear();
+	m_native_commands.clear();
 
 	m_current_data = nullptr;
 	m_current_command = nullptr;
+	m_native_command = nullptr;
 	m_current_meta = nullptr;
 }
 
+void pin64_t::close_stream() {
+	if (!m_stream)
+		return;
+
+	if (m_stream_frame)
+		m_stream->release(m_stream_frame);
+	delete m_stream;
+	m_stream = nullptr;
+	m_stream_frame = nullptr;
+}
+
 void pin64_t::init_capture_index() {
 	char name_buf[256];
 	bool found = true;
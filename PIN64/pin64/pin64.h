@@ -6,8 +6,13 @@
 #define PIN64_H
 
 #include "data.h"
+#include "block.h"
+#include "mapping.h"
+#include "keyframe.h"
+#include "writequeue.h"
+#include <memory>
+#include <mutex>
 #include <vector>
-#include <map>
 
 #define PIN64_ENABLE_CAPTURE (0)
 
@@ -16,6 +21,48 @@
 class pin64_t;
 class pin64_block_t;
 class pin64_data_t;
+class pin64_pack_t;
+class pin64_stream_t;
+struct pin64_stream_frame_t;
+
+// playback command pre-decoded at load time: host-endian words in the
+// capture's command arena plus the opcode and the resolved command and
+// data blocks
+struct pin64_command_t {
+	const uint64_t* words;
+	uint32_t length;
+	uint8_t opcode;
+	pin64_block_t* block;
+	pin64_block_t* data;
+};
+
+// file range holding the blocks first used in a frame, so that a reader
+// can fetch each frame's new blocks with one contiguous read
+struct pin64_frame_range_t {
+	uint64_t start;
+	uint64_t end;
+};
+
+// capture-side staging: commands, data blocks and frame metas are appended
+// to the arena as the big-endian bytes of their eventual blocks, and are
+// hashed and deduplicated later on the writer thread
+struct pin64_batch_t {
+	enum entry_type_t : uint32_t {
+		ENTRY_COMMAND,
+		ENTRY_DATA,
+		ENTRY_FRAME,
+		ENTRY_HASHES
+	};
+
+	struct entry_t {
+		entry_type_t type;
+		size_t offset;
+		size_t size;
+	};
+
+	pin64_data_t arena;
+	std::vector<entry_t> entries;
+};
 
 class pin64_t {
 public:
@@ -24,28 +71,115 @@ public:
 		, m_capture_index(~0)
 		, m_current_frame(0)
 		, m_capture_frames(0)
+		, m_recording(nullptr)
+		, m_batch(nullptr)
+		, m_data_open(false)
+		, m_trace_enabled(false)
+		, m_trace_file(nullptr)
+		, m_hash_kinds(0)
 		, m_commands_left(0)
 		, m_command_index(0)
 		, m_current_data(nullptr)
 		, m_current_command(nullptr)
 		, m_current_meta(nullptr)
-		, m_playing(false) {
+		, m_native_command(nullptr)
+		, m_blocks_size(0)
+		, m_streaming(false)
+		, m_stream_offset(0)
+		, m_revision(CAP_REVISION)
+		, m_player(nullptr)
+		, m_playing(false)
+		, m_validate(false)
+		, m_divergent_frame(NO_DIVERGENCE)
+		, m_rewindable(false)
+		, m_stream(nullptr)
+		, m_stream_frame(nullptr)
+		, m_stream_budget(STREAM_BUDGET)
+		, m_stream_ahead(STREAM_AHEAD) {
 	}
 	~pin64_t();
 
-	void start(int frames, uint32_t vi_control, uint32_t vi_origin, uint32_t vi_hstart, uint32_t vi_xscale, uint32_t vi_vstart, uint32_t vi_yscale, uint32_t vi_width);
-	void finish();
+	void start(int frames, uint32_t vi_control, uint32_t vi_origin, uint32_t vi_hstart, uint32_t vi_xscale, uint32_t vi_vstart, uint32_t vi_yscale, uint32_t vi_width, bool streaming = false);
+	void finish(bool verify_in_memory = false);
 	void clear();
 	void print();
 
+	// opt-in binary trace of every captured command, written next to the
+	// capture as a big-endian word count followed by the words; a count of
+	// zero marks the end of a frame
+	void set_trace(bool enable) { m_trace_enabled = enable; }
+
+	// opt-in per-frame hashes of the given FRAME_HASH_* kinds; the emulator
+	// passes its memory to add_frame_hashes at the end of each frame, just
+	// before the mark_frame that starts the next one
+	void set_frame_hashes(uint32_t kinds) { m_hash_kinds = kinds; }
+	void add_frame_hashes(const uint8_t* rdram, const uint8_t* hidden_bits, size_t size, uint32_t zb_address);
+
 	void mark_frame(running_machine& machine, uint32_t vi_control = 0, uint32_t vi_origin = 0,
 		uint32_t vi_hstart = 0, uint32_t vi_xscale = 0, uint32_t vi_vstart = 0, uint32_t vi_yscale = 0, uint32_t vi_width = 0);
-	bool load(int index);
-	void play(int index);
+	bool load(int index, bool streaming = false);
+	bool load(const char* name, bool streaming = false);
+	void play(int index, bool streaming = false);
+	void play(const char* name, bool streaming = false);
+
+	// ends playback where it is, so that rewind() can restart it early
+	void stop() { m_playing = false; }
+
+	// restarts the capture that play() loaded from its first frame, without
+	// reloading it; the player is put back in the state it was in when play()
+	// started, so every pass renders the same
+	bool rewind();
+
+	// restarts the capture that play() loaded at the start of the given
+	// frame, leaving the player in whatever state its caller restored, such
+	// as a checkpoint taken from another player at that frame
+	bool cue(uint32_t frame);
 	bool verify(int index);
 
+	// checks every frame played against the hashes recorded with it, and
+	// reports the first one that differs; validate plays a whole capture
+	// through the player and returns whether every frame matched
+	void set_validate(bool enable) { m_validate = enable; }
+	bool validating() const { return m_validate; }
+	uint32_t first_divergent_frame() const { return m_divergent_frame; }
+	bool validate(int index);
+
+	// streaming playback leaves blocks in the capture file until a frame
+	// needs them: the next frames_ahead frames are unpacked in the
+	// background, and unused blocks are evicted beyond the budget in bytes
+	void set_stream_budget(size_t budget, uint32_t frames_ahead = STREAM_AHEAD) { m_stream_budget = budget; m_stream_ahead = frames_ahead; }
+
+	// keyframes are built by playing an existing capture through the player
+	// and rewriting it with a keyframe section; seek restores the nearest
+	// keyframe at or before the frame and plays forward from there, whether
+	// the capture is resident or streamed
+	void set_player(pin64_player_t* player) { m_player = player; }
+	bool build_keyframes(int index, uint32_t interval = KEYFRAME_INTERVAL);
+	bool build_keyframes(const char* name, uint32_t interval = KEYFRAME_INTERVAL);
+	bool seek(uint32_t frame);
+
+	// moves the blocks of the given captures into a shared pack and
+	// replaces each capture with a manifest that load() resolves through it
+	bool pack(const char* pack_name, const std::vector<int>& indices);
+
+	// rewrites a capture in the version-2 layout
+	bool convert(int index);
+
+	// drops commands that don't affect rendering; the result is played
+	// against the original through the player, and only replaces it if
+	// every frame renders identically
+	bool optimize(int index);
+
+	// writes a range of frames, or a range of commands within one frame, to
+	// a new self-contained capture holding only the blocks the range uses;
+	// the source is streamed rather than loaded, and a slice that starts
+	// mid-capture begins with a keyframe of the player's state at the cut
+	bool slice(int index, int out_index, uint32_t first_frame, uint32_t frame_count);
+	bool slice_commands(int index, int out_index, uint32_t frame, uint32_t first_command, uint32_t command_count);
+
 	void command(uint64_t* cmd_data, uint32_t size);
 	pin64_block_t* command() { return m_current_command; }
+	const pin64_command_t* native_command() const { return m_native_command; }
 	void next_command();
 
 	uint32_t vi_control();
@@ -59,16 +193,23 @@ public:
 	void data_begin();
 	pin64_data_t* data_block();
 	pin64_block_t& block() { return *m_current_data; }
-	std::map<uint32_t, pin64_block_t*>& blocks() { return m_blocks; }
-	std::vector<uint32_t>& commands() { return m_commands; }
+	pin64_block_map_t& blocks() { return m_blocks; }
+	std::vector<uint64_t>& commands() { return m_commands; }
 	std::vector<uint32_t>& frames() { return m_frames; }
-	std::vector<uint32_t>& metas() { return m_metas; }
+	std::vector<uint64_t>& metas() { return m_metas; }
+	std::vector<uint32_t>& stream_directory() { return m_stream_directory; }
+	std::vector<pin64_keyframe_t>& keyframes() { return m_keyframes; }
+	std::vector<pin64_frame_range_t>& frame_ranges() { return m_frame_ranges; }
+	std::vector<pin64_frame_hashes_t>& frame_hashes() { return m_frame_hashes; }
 
 	void data_end();
 
 	bool capturing() const { return m_capture_file != nullptr; }
 	bool playing() const { return m_playing; }
+	uint32_t current_frame() const { return m_current_frame; }
+	bool streaming() const { return m_streaming; }
 	uint32_t commands_left() const { return m_commands_left; }
+	uint32_t revision() const { return m_revision; }
 
 	size_t size();
 	size_t block_directory_size() const;
@@ -76,7 +217,33 @@ public:
 	size_t blocks_size();
 	size_t cmdlist_size() const;
 	size_t metas_size() const;
-	static size_t header_size();
+	size_t keyframes_size() const;
+	size_t frame_ranges_size() const;
+	size_t frame_hashes_size() const;
+	static size_t header_size(uint32_t revision = CAP_REVISION);
+	static uint32_t revision(pin64_data_t* data);
+	static uint64_t read_id(pin64_data_t* data, uint32_t revision);
+	static bool is_v2(pin64_data_t* data);
+	static size_t v2_header_size(uint32_t revision);
+
+	// finds the data block id a load_tlut, load_block or load_tile command
+	// block refers to
+	static bool data_ref(pin64_block_t* command, uint32_t revision, uint64_t& id);
+	static bool uses_data(uint8_t opcode);
+
+	// hashes the region of memory the VI displays, and the matching depth
+	// buffer and hidden bits, for each of the requested kinds; the others
+	// are left zero
+	static void hash_frame(pin64_frame_hashes_t& hashes, uint32_t kinds, const uint8_t* rdram, const uint8_t* hidden_bits, size_t size,
+		uint32_t zb_address, uint32_t vi_control, uint32_t vi_origin, uint32_t vi_vstart, uint32_t vi_yscale, uint32_t vi_width);
+
+	// appends a command block's words to the arena; words is left unset, as
+	// the arena may still move, and offset is where they start
+	static bool decode_command(pin64_block_t* block, pin64_command_t& command, std::vector<uint64_t>& arena, size_t& offset);
+
+	// shared with pin64_pack_t, whose blocks are loaded the same way
+	static bool unpack_blocks(std::vector<pin64_block_t>& blocks, uint32_t revision);
+	static void assemble_blocks(std::vector<pin64_block_t>& blocks, pin64_block_map_t& map);
 
 	static const uint8_t CAP_ID[8];
 	static const uint8_t BDR_ID[8];
@@ -84,38 +251,173 @@ public:
 	static const uint8_t BLK_ID[8];
 	static const uint8_t CMD_ID[8];
 	static const uint8_t MET_ID[8];
+	static const uint8_t KEY_ID[8];
+	static const uint8_t PAK_ID[8];
+	static const uint8_t MAN_ID[8];
+	static const uint8_t CP2_ID[8];
+	static const uint8_t FRR_ID[8];
+	static const uint8_t FHS_ID[8];
+
+	// revision 0 captures predate the revision field and identify blocks by
+	// CRC32; revision 1 uses 64-bit content hashes; revision 2 adds
+	// per-block compression; revision 3 adds chunked data blocks; revision 4
+	// adds the optional keyframe section; revision 5 lays blocks out in
+	// first-use order and adds the optional frame range section; revision 6
+	// adds the optional frame hash section
+	static const uint32_t CAP_REVISION = 6;
+	static const size_t LEGACY_HEADER_SIZE = 32;
+
+	// the version-2 layout is little-endian with 64-bit offsets: a header,
+	// the block directory, delta-coded frame, command and meta index lists,
+	// keyframes, then the block payloads, each aligned for direct use from
+	// the mapping; its revision field keeps the meaning it has above, and
+	// from revision 5 the header ends with the start of the frame ranges,
+	// followed from revision 6 by the start of the frame hashes
+	static const size_t V2_HEADER_SIZE = 72;
+	static const size_t V2_DIRECTORY_ENTRY_SIZE = 32;
+	static const size_t V2_ALIGNMENT = 64;
+
+	static const uint32_t KEYFRAME_INTERVAL = 300;
+	static const uint32_t MAX_COMMAND_LENGTH = 0x800;
+	static const size_t BATCH_SIZE = 0x100000;
+	static const size_t STREAM_BUDGET = 0x10000000;
+	static const uint32_t STREAM_AHEAD = 8;
+
+	static const uint32_t FRAME_HASH_COLOR = 1;
+	static const uint32_t FRAME_HASH_DEPTH = 2;
+	static const uint32_t FRAME_HASH_HIDDEN = 4;
+	static const uint32_t FRAME_HASH_ALL = 7;
+	static const uint32_t NO_DIVERGENCE = ~0U;
 
 private:
-	void add_meta(uint32_t vi_control, uint32_t vi_origin, uint32_t vi_hstart, uint32_t vi_xscale, uint32_t vi_vstart, uint32_t vi_yscale, uint32_t vi_width);
+	void add_frame(uint32_t vi_control, uint32_t vi_origin, uint32_t vi_hstart, uint32_t vi_xscale, uint32_t vi_vstart, uint32_t vi_yscale, uint32_t vi_width);
+	void next_batch();
+	void submit_batch();
+	void recycle_batch(pin64_batch_t* batch);
+	void ingest(pin64_batch_t* batch, FILE* file);
+	void trace_frame();
 
 	void update_blocks();
 	void update_command();
+	bool update_stream();
+	void next_frame();
+	void check_frame();
+	void run_frame();
+	void add_keyframe();
 
+	pin64_block_t* find_block(uint64_t id);
 	bool insert_block(pin64_block_t* block);
+	pin64_block_t* chunk_block(pin64_block_t* block);
 	void finish_command();
 
 	void init_capture_index();
+	void flush_blocks(FILE* file);
+	void compress_blocks(std::vector<pin64_block_t*>& blocks);
+	bool build_command_arena();
+	bool load_manifest(pin64_data_t* data, const char* name);
+	bool load_v2(pin64_data_t* data, const char* name, bool streaming);
 
-	void finalize();
+	bool restore_keyframe(const pin64_keyframe_t& keyframe);
+	bool run_to(uint32_t frame, uint32_t command);
+	void restart(uint32_t frame);
+	void close_stream();
+	bool slice_range(int index, int out_index, uint32_t first_frame, uint32_t end_frame, uint32_t command_start, uint32_t command_end);
 
+	void hash_frames(std::vector<uint64_t>& hashes);
+	void collect_blocks();
+	bool replace_capture(int index);
+	bool replace_capture(const char* name);
+
+	bool write_capture(FILE* file, bool verify_in_memory);
+	static bool verify_file(int index);
+	static bool verify_file(const char* name);
+
+	// batches that the writer thread has finished with; declared ahead of
+	// m_writer so that its final tasks can still return them
+	std::mutex m_batch_mutex;
+	std::vector<pin64_batch_t*> m_free_batches;
+
+	// owned by m_writer once a capture starts; non-null while capturing
 	FILE *m_capture_file;
+	pin64_write_queue_t m_writer;
 	uint32_t m_capture_index;
 	uint32_t m_current_frame;
 	uint32_t m_capture_frames;
 
+	// capturing: the capturing thread only appends to m_batch; the blocks,
+	// command list and metas are built in m_recording by the writer thread
+	pin64_t* m_recording;
+	pin64_batch_t* m_batch;
+	bool m_data_open;
+
+	bool m_trace_enabled;
+	FILE* m_trace_file;
+	pin64_data_t m_trace_buffer;
+
+	// capturing: the kinds of frame hash to record, and the VI registers of
+	// the frame being captured, which say what it displays
+	uint32_t m_hash_kinds;
+	uint32_t m_frame_vi[7];
+
 	uint32_t m_commands_left;
 	uint32_t m_command_index;
 
 	pin64_block_t* m_current_data;
 	pin64_block_t* m_current_command;
 	pin64_block_t* m_current_meta;
-	std::map<uint32_t, pin64_block_t*> m_blocks;
+	const pin64_command_t* m_native_command;
+	pin64_block_map_t m_blocks;
+	size_t m_blocks_size;
+
+	// streaming captures: unique blocks are appended to the file as frames
+	// complete and then released; m_blocks keeps them as dedup index entries
+	bool m_streaming;
+	size_t m_stream_offset;
+	std::vector<uint32_t> m_stream_directory;
+	std::vector<pin64_block_t*> m_pending_blocks;
+
+	// loaded captures: read-only mapping plus non-owning block views into it
+	pin64_mapping_t m_mapping;
+	std::vector<pin64_block_t> m_mapped_blocks;
+
+	// blocks added to a loaded capture, which unlike the mapped blocks are
+	// owned by pointer
+	std::vector<pin64_block_t*> m_added_blocks;
+
+	// loaded manifests: every block comes from the shared pack
+	std::shared_ptr<pin64_pack_t> m_pack;
 
-	std::vector<uint32_t> m_commands;
+	std::vector<uint64_t> m_commands;
 	std::vector<uint32_t> m_frames;
-	std::vector<uint32_t> m_metas;
+	std::vector<uint64_t> m_metas;
+	std::vector<pin64_keyframe_t> m_keyframes;
+	std::vector<pin64_frame_range_t> m_frame_ranges;
+
+	// empty, or one entry per frame
+	std::vector<pin64_frame_hashes_t> m_frame_hashes;
+
+	// loaded captures: one pre-decoded entry per command in stream order;
+	// identical command blocks share their words in the arena
+	std::vector<uint64_t> m_command_arena;
+	std::vector<pin64_command_t> m_native_commands;
+
+	uint32_t m_revision;
+	pin64_player_t* m_player;
 
 	bool m_playing;
+	bool m_validate;
+	uint32_t m_divergent_frame;
+
+	// player state when play() started, restored by rewind(); owned
+	bool m_rewindable;
+	std::vector<pin64_block_t*> m_rewind_state;
+
+	// streaming playback: m_mapped_blocks keep their stored form, and each
+	// frame's blocks and commands come from the stream instead
+	pin64_stream_t* m_stream;
+	pin64_stream_frame_t* m_stream_frame;
+	size_t m_stream_budget;
+	uint32_t m_stream_ahead;
 
 	pin64_dummy_data_t m_dummy_data;
 };
@@ -14,10 +14,9 @@ void pin64_printer_t::print(pin64_t* capture) {
 	printf("Cmdlist Size:     %9x bytes\n", (uint32_t)capture->cmdlist_size()); fflush(stdout);
 	printf("Metas Size:       %9x bytes\n", (uint32_t)capture->metas_size()); fflush(stdout);
 
-	std::vector<uint32_t>& commands = capture->commands();
-	std::map<uint32_t, pin64_block_t*>& blocks = capture->blocks();
+	std::vector<uint64_t>& commands = capture->commands();
+	pin64_block_map_t& blocks = capture->blocks();
 	std::vector<uint32_t>& frames = capture->frames();
-	std::vector<uint32_t>& metas = capture->metas();
 
 	printf("Command-List Count: %d\n", (uint32_t)frames.size()); fflush(stdout);
 	for (size_t i = 0; i < frames.size(); i++) {
@@ -25,7 +24,7 @@ void pin64_printer_t::print(pin64_t* capture) {
 
 		const size_t next_start = ((i == (frames.size() - 1)) ? commands.size() : frames[i + 1]);
 		for (uint32_t cmd = frames[i]; cmd < next_start; cmd++) {
-			print_command(frames[i], cmd, blocks, commands);
+			print_command(frames[i], cmd, blocks, commands, capture->revision());
 		}
 
 		if (i == (frames.size() - 1)) {
@@ -35,7 +34,7 @@ void pin64_printer_t::print(pin64_t* capture) {
 
 	printf("\nData Block Count: %d\n", (uint32_t)blocks.size()); fflush(stdout);
 	int i = 0;
-	for (std::pair<uint32_t, pin64_block_t*> block_pair : blocks) {
+	for (pin64_block_map_t::entry_t& block_pair : blocks) {
 		printf("    Block %d:\n", i); fflush(stdout);
 
 		print_data((block_pair.second));
@@ -49,7 +48,7 @@ void pin64_printer_t::print(pin64_t* capture) {
 void pin64_printer_t::print_data(pin64_block_t* block) {
 	pin64_data_t* data = block->data();
 
-	printf("            CRC32: %08x\n", (uint32_t)block->crc32()); fflush(stdout);
+	printf("            ID: %08x%08x\n", (uint32_t)(block->hash() >> 32), (uint32_t)block->hash()); fflush(stdout);
 	printf("            Data Size: %08x\n", (uint32_t)data->size()); fflush(stdout);
 	printf("            Data: "); fflush(stdout);
 
@@ -74,13 +73,13 @@ void pin64_printer_t::print_data(pin64_block_t* block) {
 	printf("\n"); fflush(stdout);
 }
 
-void pin64_printer_t::print_command(uint32_t cmd_start, uint32_t cmd, std::map<uint32_t, pin64_block_t*>& blocks, std::vector<uint32_t>& commands) {
+void pin64_printer_t::print_command(uint32_t cmd_start, uint32_t cmd, pin64_block_map_t& blocks, std::vector<uint64_t>& commands, uint32_t revision) {
 	pin64_block_t* block = blocks[commands[cmd]];
 	pin64_data_t* data = block->data();
 
 	printf("        Command %d:\n", cmd - cmd_start); fflush(stdout);
 	const uint32_t cmd_size(data->get32());
-	printf("        CRC32: %08x\n", (uint32_t)commands[cmd]); fflush(stdout);
+	printf("        ID: %08x%08x\n", (uint32_t)(commands[cmd] >> 32), (uint32_t)commands[cmd]); fflush(stdout);
 	printf("            Packet Data Size: %d words\n", cmd_size); fflush(stdout);
 	printf("            Packet Data: "); fflush(stdout);
 
@@ -101,7 +100,8 @@ void pin64_printer_t::print_command(uint32_t cmd_start, uint32_t cmd, std::map<u
 	printf("            Data Block Present: %s\n", load_command ? "Yes" : "No"); fflush(stdout);
 
 	if (load_command) {
-		printf("            Data Block CRC32: %08x\n", data->get32()); fflush(stdout);
+		const uint64_t data_id = pin64_t::read_id(data, revision);
+		printf("            Data Block ID: %08x%08x\n", (uint32_t)(data_id >> 32), (uint32_t)data_id); fflush(stdout);
 	}
 
 	data->reset();
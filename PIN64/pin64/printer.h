@@ -6,8 +6,8 @@
 #define PIN64_PRINTER_H
 
 #include <cstdint>
-#include <map>
 #include <vector>
+#include "block.h"
 
 class pin64_t;
 class pin64_block_t;
@@ -16,7 +16,7 @@ class pin64_printer_t {
 public:
 	static void print(pin64_t* capture);
 	static void print_data(pin64_block_t* block);
-	static void print_command(uint32_t cmd_start, uint32_t cmd, std::map<uint32_t, pin64_block_t*>& blocks, std::vector<uint32_t>& commands);
+	static void print_command(uint32_t cmd_start, uint32_t cmd, pin64_block_map_t& blocks, std::vector<uint64_t>& commands, uint32_t revision);
 };
 
 #endif // PIN64_PRINTER_H
@@ -0,0 +1,283 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#include "stream.h"
+
+pin64_stream_t::pin64_stream_t(std::vector<pin64_block_t>& stored, pin64_block_map_t& map, uint32_t revision,
+	const std::vector<uint64_t>& commands, const std::vector<uint32_t>& frames, const std::vector<uint64_t>& metas)
+	: m_stored(stored)
+	, m_map(map)
+	, m_revision(revision)
+	, m_commands(commands)
+	, m_frames(frames)
+	, m_metas(metas)
+	, m_entries(stored.size())
+	, m_resident(0)
+	, m_budget(0)
+	, m_next_frame(0)
+	, m_ahead(0)
+	, m_exit(false) {
+}
+
+pin64_stream_t::~pin64_stream_t() {
+	stop();
+
+	for (entry_t& entry : m_entries)
+		delete entry.block;
+	for (pin64_stream_frame_t* frame : m_free_frames)
+		delete frame;
+}
+
+void pin64_stream_t::start(uint32_t frame, size_t budget, uint32_t ahead) {
+	stop();
+
+	m_budget = budget;
+	m_ahead = (ahead > 0) ? ahead : 1;
+	m_next_frame = frame;
+	m_exit = false;
+	m_thread = std::thread(&pin64_stream_t::worker, this);
+}
+
+void pin64_stream_t::stop() {
+	if (m_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+		}
+		m_wake.notify_one();
+		m_thread.join();
+	}
+
+	while (!m_ready.empty()) {
+		release(m_ready.front());
+		m_ready.pop_front();
+	}
+}
+
+pin64_stream_frame_t* pin64_stream_t::acquire() {
+	pin64_stream_frame_t* frame;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this] { return !m_ready.empty(); });
+		frame = m_ready.front();
+		m_ready.pop_front();
+	}
+
+	m_wake.notify_one();
+	return frame;
+}
+
+void pin64_stream_t::release(pin64_stream_frame_t* frame) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (uint32_t index : frame->pins)
+		unpin(index);
+	frame->pins.clear();
+
+	evict();
+	m_free_frames.push_back(frame);
+}
+
+bool pin64_stream_t::pin_blocks(const std::vector<uint64_t>& ids, std::vector<pin64_block_t*>& blocks, std::vector<uint32_t>& pins) {
+	for (uint64_t id : ids) {
+		pin64_block_t* block;
+		if (!fetch(id, pins, block) || !block)
+			return false;
+		blocks.push_back(block);
+	}
+
+	return true;
+}
+
+void pin64_stream_t::unpin_blocks(std::vector<uint32_t>& pins) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (uint32_t index : pins)
+		unpin(index);
+	pins.clear();
+
+	evict();
+}
+
+size_t pin64_stream_t::resident_size() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_resident;
+}
+
+void pin64_stream_t::worker() {
+	for (;;) {
+		pin64_stream_frame_t* frame;
+		uint32_t index;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [this] { return m_exit || (m_next_frame < m_frames.size() && m_ready.size() < m_ahead); });
+			if (m_exit)
+				return;
+
+			index = m_next_frame;
+			if (m_free_frames.empty()) {
+				frame = new pin64_stream_frame_t();
+			} else {
+				frame = m_free_frames.back();
+				m_free_frames.pop_back();
+			}
+		}
+
+		frame->valid = build(frame, index);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_ready.push_back(frame);
+
+			// nothing past a frame that failed to stream is played
+			m_next_frame = frame->valid ? (index + 1) : (uint32_t)m_frames.size();
+		}
+		m_done.notify_one();
+	}
+}
+
+bool pin64_stream_t::build(pin64_stream_frame_t* frame, uint32_t index) {
+	frame->frame = index;
+	frame->meta = nullptr;
+	frame->commands.clear();
+	frame->arena.clear();
+
+	if (!fetch(m_metas[index], frame->pins, frame->meta) || !frame->meta)
+		return false;
+
+	const size_t first = m_frames[index];
+	const size_t end = (index == m_frames.size() - 1) ? m_commands.size() : m_frames[index + 1];
+
+	// as in the whole-capture arena, each unique command in the frame is
+	// decoded once and the rest share its words
+	m_decoded.clear();
+	m_offsets.resize(end - first);
+	frame->commands.resize(end - first);
+	for (size_t i = 0; i < end - first; i++) {
+		const uint64_t id = m_commands[first + i];
+		uint32_t* existing = m_decoded.find(id);
+		if (existing) {
+			frame->commands[i] = frame->commands[*existing];
+			m_offsets[i] = m_offsets[*existing];
+			continue;
+		}
+
+		pin64_block_t* block;
+		if (!fetch(id, frame->pins, block) || !block)
+			return false;
+
+		pin64_command_t& command = frame->commands[i];
+		if (!pin64_t::decode_command(block, command, frame->arena, m_offsets[i]))
+			return false;
+
+		if (pin64_t::uses_data(command.opcode)) {
+			uint64_t data_id;
+			if (!pin64_t::data_ref(block, m_revision, data_id) || !fetch(data_id, frame->pins, command.data))
+				return false;
+		}
+
+		m_decoded.insert(id, (uint32_t)i);
+	}
+
+	for (size_t i = 0; i < frame->commands.size(); i++)
+		frame->commands[i].words = frame->arena.data() + m_offsets[i];
+
+	return true;
+}
+
+// pins the block with the given id, making it resident first if needed;
+// an unknown id yields no block, as it does for a fully loaded capture
+bool pin64_stream_t::fetch(uint64_t id, std::vector<uint32_t>& pins, pin64_block_t*& block) {
+	block = nullptr;
+
+	pin64_block_t** stored = m_map.find(id);
+	if (!stored)
+		return true;
+
+	const uint32_t index = (uint32_t)(*stored - m_stored.data());
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		entry_t& entry = m_entries[index];
+		if (entry.block) {
+			if (entry.pins++ == 0)
+				m_lru.erase(entry.lru);
+			pins.push_back(index);
+			block = entry.block;
+			return true;
+		}
+	}
+
+	// only this thread makes blocks resident, so the block can be unpacked
+	// without holding the lock
+	pin64_block_t* unpacked = unpack(index);
+	if (!unpacked)
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	entry_t& entry = m_entries[index];
+	entry.block = unpacked;
+	entry.pins = 1;
+	m_resident += unpacked->data_size();
+	pins.push_back(index);
+
+	evict();
+	block = unpacked;
+	return true;
+}
+
+pin64_block_t* pin64_stream_t::unpack(uint32_t index) {
+	pin64_block_t& stored = m_stored[index];
+	pin64_block_t* block = new pin64_block_t(stored.stored_bytes(), stored.stored_size(), stored.hash(), stored.flags());
+
+	// hashing the contents also pulls raw blocks in from the mapping, so
+	// playback doesn't fault on them later
+	if (!block->decompress() || !block->verify(m_revision)) {
+		delete block;
+		return nullptr;
+	}
+
+	if (block->chunked()) {
+		// chunks are only needed until the block has been assembled
+		pin64_data_t* list = block->data();
+		std::vector<pin64_block_t*> chunks(list->size() / 8);
+		std::vector<uint32_t> chunk_pins;
+		bool valid = true;
+		for (pin64_block_t*& chunk : chunks) {
+			if (!fetch(list->get64(), chunk_pins, chunk) || !chunk) {
+				valid = false;
+				break;
+			}
+		}
+
+		if (valid)
+			block->assemble(chunks);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (uint32_t chunk_index : chunk_pins)
+			unpin(chunk_index);
+
+		if (!valid) {
+			delete block;
+			return nullptr;
+		}
+	}
+
+	return block;
+}
+
+// callers hold m_mutex
+void pin64_stream_t::unpin(uint32_t index) {
+	entry_t& entry = m_entries[index];
+	if (--entry.pins == 0)
+		entry.lru = m_lru.insert(m_lru.end(), index);
+}
+
+// callers hold m_mutex; pinned blocks are never evicted, so the frames in
+// flight may hold more than the budget
+void pin64_stream_t::evict() {
+	while (m_resident > m_budget && !m_lru.empty()) {
+		entry_t& entry = m_entries[m_lru.front()];
+		m_lru.pop_front();
+
+		m_resident -= entry.block->data_size();
+		delete entry.block;
+		entry.block = nullptr;
+	}
+}
@@ -0,0 +1,106 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#pragma once
+
+#ifndef PIN64_STREAM_H
+#define PIN64_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "pin64.h"
+
+// everything one frame of playback needs, made resident ahead of time: the
+// frame's meta, its pre-decoded commands, and the blocks they point at,
+// which stay pinned until the frame is released
+struct pin64_stream_frame_t {
+	uint32_t frame;
+	bool valid;
+	pin64_block_t* meta;
+	std::vector<pin64_command_t> commands;
+	std::vector<uint64_t> arena;
+	std::vector<uint32_t> pins;
+};
+
+// streaming playback: blocks stay in their stored form in the mapped
+// capture until a frame needs them; a background thread unpacks the blocks
+// of the next few frames, and blocks no frame has pinned are evicted least
+// recently used first once the resident total exceeds the budget
+class pin64_stream_t {
+public:
+	// the stored blocks and lists belong to the capture, which outlives the stream
+	pin64_stream_t(std::vector<pin64_block_t>& stored, pin64_block_map_t& map, uint32_t revision,
+		const std::vector<uint64_t>& commands, const std::vector<uint32_t>& frames, const std::vector<uint64_t>& metas);
+	~pin64_stream_t();
+
+	void start(uint32_t frame, size_t budget, uint32_t ahead);
+	void stop();
+
+	// frames are handed out in order; each one must be released before the
+	// blocks it pins can be evicted
+	pin64_stream_frame_t* acquire();
+	void release(pin64_stream_frame_t* frame);
+
+	// makes blocks resident outside of any frame, such as the keyframe that
+	// playback starts from; only while the stream is stopped
+	bool pin_blocks(const std::vector<uint64_t>& ids, std::vector<pin64_block_t*>& blocks, std::vector<uint32_t>& pins);
+	void unpin_blocks(std::vector<uint32_t>& pins);
+
+	size_t resident_size();
+
+private:
+	pin64_stream_t(const pin64_stream_t&) = delete;
+	pin64_stream_t& operator=(const pin64_stream_t&) = delete;
+
+	struct entry_t {
+		entry_t() : block(nullptr), pins(0) { }
+
+		// unpacked copy of the stored block while it is resident
+		pin64_block_t* block;
+		uint32_t pins;
+		std::list<uint32_t>::iterator lru;
+	};
+
+	void worker();
+	bool build(pin64_stream_frame_t* frame, uint32_t index);
+	bool fetch(uint64_t id, std::vector<uint32_t>& pins, pin64_block_t*& block);
+	pin64_block_t* unpack(uint32_t index);
+	void unpin(uint32_t index);
+	void evict();
+
+	std::vector<pin64_block_t>& m_stored;
+	pin64_block_map_t& m_map;
+	const uint32_t m_revision;
+	const std::vector<uint64_t>& m_commands;
+	const std::vector<uint32_t>& m_frames;
+	const std::vector<uint64_t>& m_metas;
+
+	// guarded by m_mutex; blocks are only made resident by the worker, but
+	// may be evicted by whichever thread unpins them last
+	std::vector<entry_t> m_entries;
+	std::list<uint32_t> m_lru;
+	size_t m_resident;
+	size_t m_budget;
+
+	std::deque<pin64_stream_frame_t*> m_ready;
+	std::vector<pin64_stream_frame_t*> m_free_frames;
+	uint32_t m_next_frame;
+	uint32_t m_ahead;
+
+	// only touched by the worker
+	pin64_hash_table_t<uint32_t> m_decoded;
+	std::vector<size_t> m_offsets;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	bool m_exit;
+};
+
+#endif // PIN64_STREAM_H
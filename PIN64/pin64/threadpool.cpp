@@ -0,0 +1,84 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#include "threadpool.h"
+
+pin64_thread_pool_t::pin64_thread_pool_t(uint32_t threads)
+	: m_generation(0)
+	, m_exit(false) {
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+
+	for (uint32_t i = 1; i < threads; i++)
+		m_threads.emplace_back(&pin64_thread_pool_t::worker, this);
+}
+
+pin64_thread_pool_t::~pin64_thread_pool_t() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_exit = true;
+	}
+	m_wake.notify_all();
+
+	for (std::thread& thread : m_threads)
+		thread.join();
+}
+
+pin64_thread_pool_t& pin64_thread_pool_t::shared() {
+	static pin64_thread_pool_t s_pool;
+	return s_pool;
+}
+
+void pin64_thread_pool_t::run(job_t* job) {
+	for (size_t i = job->next++; i < job->count; i = job->next++)
+		(*job->func)(i);
+}
+
+void pin64_thread_pool_t::parallel_for(size_t count, const std::function<void(size_t)>& func) {
+	if (count == 0)
+		return;
+
+	if (count == 1 || m_threads.empty()) {
+		for (size_t i = 0; i < count; i++)
+			func(i);
+		return;
+	}
+
+	std::lock_guard<std::mutex> job_lock(m_job_mutex);
+
+	std::shared_ptr<job_t> job = std::make_shared<job_t>(&func, count);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = job;
+		m_generation++;
+	}
+	m_wake.notify_all();
+
+	run(job.get());
+
+	// workers that joined late find the counter exhausted and never touch func
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [&job] { return job->active == 0; });
+	m_job.reset();
+}
+
+void pin64_thread_pool_t::worker() {
+	uint64_t seen = 0;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_wake.wait(lock, [this, &seen] { return m_exit || (m_job && m_generation != seen); });
+		if (m_exit)
+			return;
+
+		seen = m_generation;
+		std::shared_ptr<job_t> job = m_job;
+		job->active++;
+
+		lock.unlock();
+		run(job.get());
+		lock.lock();
+
+		if (--job->active == 0)
+			m_done.notify_all();
+	}
+}
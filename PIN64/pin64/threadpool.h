@@ -0,0 +1,54 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#pragma once
+
+#ifndef PIN64_THREADPOOL_H
+#define PIN64_THREADPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed set of worker threads for data-parallel loops over blocks; the
+// calling thread takes part in every loop, and loops are not reentrant
+class pin64_thread_pool_t {
+public:
+	explicit pin64_thread_pool_t(uint32_t threads = 0);
+	~pin64_thread_pool_t();
+
+	void parallel_for(size_t count, const std::function<void(size_t)>& func);
+
+	uint32_t thread_count() const { return (uint32_t)m_threads.size() + 1; }
+
+	static pin64_thread_pool_t& shared();
+
+private:
+	struct job_t {
+		job_t(const std::function<void(size_t)>* f, size_t c) : func(f), count(c), next(0), active(0) { }
+
+		const std::function<void(size_t)>* func;
+		size_t count;
+		std::atomic<size_t> next;
+		uint32_t active;
+	};
+
+	void worker();
+	static void run(job_t* job);
+
+	std::vector<std::thread> m_threads;
+	std::mutex m_job_mutex;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	std::shared_ptr<job_t> m_job;
+	uint64_t m_generation;
+	bool m_exit;
+};
+
+#endif // PIN64_THREADPOOL_H
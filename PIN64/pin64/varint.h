@@ -0,0 +1,97 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#pragma once
+
+#ifndef PIN64_VARINT_H
+#define PIN64_VARINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "data.h"
+
+// version-2 index lists (frame starts, command and meta block indices)
+// store each entry as the zigzag-coded difference from the one before it,
+// written as an LEB128 varint
+
+inline uint64_t pin64_zigzag(int64_t value) {
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t pin64_unzigzag(uint64_t value) {
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+inline void pin64_put_varint(pin64_data_t* out, uint64_t value) {
+	uint8_t bytes[10];
+	size_t size = 0;
+	while (value >= 0x80) {
+		bytes[size++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	bytes[size++] = (uint8_t)value;
+	out->put(bytes, size);
+}
+
+// returns false on a truncated or overlong varint
+inline bool pin64_get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+	value = 0;
+	for (uint32_t shift = 0; shift < 64 && p < end; shift += 7) {
+		const uint8_t byte = *p++;
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+// writes id, entry count, encoded size, then the encoded entries
+inline void pin64_put_index_list(pin64_data_t* out, const uint8_t* id, const std::vector<uint32_t>& list) {
+	pin64_data_t encoded;
+	encoded.reserve(list.size() * 2);
+
+	int64_t previous = 0;
+	for (uint32_t value : list) {
+		pin64_put_varint(&encoded, pin64_zigzag((int64_t)value - previous));
+		previous = value;
+	}
+
+	out->put(id, 8);
+	out->put_le64(list.size());
+	out->put_le64(encoded.size());
+	if (encoded.size() > 0)
+		out->put(encoded.bytes(), encoded.size());
+}
+
+// reads a list written by pin64_put_index_list at the given offset; every
+// length is checked against the end of the file
+inline bool pin64_get_index_list(pin64_data_t* data, uint64_t offset, const uint8_t* id, std::vector<uint32_t>& list) {
+	if (offset > data->size() || data->size() - offset < 24 || memcmp(data->bytes() + offset, id, 8) != 0)
+		return false;
+
+	const uint64_t count = data->get_le64((size_t)offset + 8);
+	const uint64_t size = data->get_le64((size_t)offset + 16);
+	if (size > data->size() - offset - 24 || count > size)
+		return false;
+
+	const uint8_t* p = data->bytes() + offset + 24;
+	const uint8_t* end = p + size;
+
+	list.resize((size_t)count);
+	int64_t previous = 0;
+	for (uint32_t& value : list) {
+		uint64_t delta;
+		if (!pin64_get_varint(p, end, delta))
+			return false;
+
+		previous += pin64_unzigzag(delta);
+		if (previous < 0 || previous > 0xffffffffLL)
+			return false;
+		value = (uint32_t)previous;
+	}
+
+	return p == end;
+}
+
+#endif // PIN64_VARINT_H
@@ -3,29 +3,27 @@
 #include "verifier.h"
 #include "pin64.h"
 #include "block.h"
+#include "threadpool.h"
+#include "varint.h"
 
-bool pin64_verifier_t::verify(pin64_data_t* data) {
+#include <atomic>
+
+bool pin64_verifier_t::verify(pin64_data_t* data, bool check_contents) {
 	if (!data) return false;
+	if (pin64_t::is_v2(data)) return verify_v2(data, check_contents);
 	if (!verify_headers(data)) return false;
 	if (!verify_data_directory(data)) return false;
 
-	std::map<uint32_t, pin64_block_t*> blocks;
-	if (!verify_blocks(blocks, data)) {
-		for (std::pair<uint32_t, pin64_block_t*> block_pair : blocks) delete block_pair.second;
-		return false;
-	}
-	if (!verify_cmdlist_directory(blocks, data)) {
-		for (std::pair<uint32_t, pin64_block_t*> block_pair : blocks) delete block_pair.second;
-		return false;
-	}
-	if (!verify_cmdlist(blocks, data)) {
-		for (std::pair<uint32_t, pin64_block_t*> block_pair : blocks) delete block_pair.second;
-		return false;
-	}
-	if (!verify_metas(blocks, data)) {
-		for (std::pair<uint32_t, pin64_block_t*> block_pair : blocks) delete block_pair.second;
-		return false;
-	}
+	const uint32_t revision = pin64_t::revision(data);
+
+	id_table_t blocks;
+	if (!verify_blocks(blocks, data, revision, check_contents)) return false;
+	if (!verify_cmdlist_directory(blocks, data)) return false;
+	if (!verify_cmdlist(blocks, data, revision)) return false;
+	if (!verify_metas(blocks, data, revision)) return false;
+	if (!verify_keyframes(blocks, data, revision)) return false;
+	if (!verify_frame_ranges(data, revision)) return false;
+	if (!verify_frame_hashes(data, revision)) return false;
 
 	return true;
 }
@@ -33,13 +31,18 @@ bool pin64_verifier_t::verify(pin64_data_t* data) {
 bool pin64_verifier_t::verify_headers(pin64_data_t* data) {
 	data->reset();
 
+	if (data->size() < pin64_t::LEGACY_HEADER_SIZE) return false;
 	if (!verify_preamble(data, 0, pin64_t::CAP_ID, 8)) return false;
 
 	const uint32_t total_size = data->get32();
 	if (data->size() != total_size) return false;
 
-	const uint32_t header_size = data->get32();
-	if (header_size != (uint32_t)pin64_t::header_size()) return false;
+	// the block directory directly follows the header in captures written
+	// in one go, and trails the block data in streamed captures
+	const uint32_t revision = pin64_t::revision(data);
+	if (revision > pin64_t::CAP_REVISION) return false;
+	const uint32_t header_size = (uint32_t)pin64_t::header_size(revision);
+	if (data->get32(12) < header_size || data->get32(20) < header_size) return false;
 
 	if (!verify_preamble(data, data->get32(12), pin64_t::BDR_ID, 8)) return false;
 	if (!verify_preamble(data, data->get32(16), pin64_t::CDR_ID, 8)) return false;
@@ -83,12 +86,18 @@ bool pin64_verifier_t::verify_data_directory(pin64_data_t* data) {
 	return true;
 }
 
-bool pin64_verifier_t::verify_blocks(std::map<uint32_t, pin64_block_t*>& blocks, pin64_data_t* data) {
+bool pin64_verifier_t::verify_blocks(id_table_t& blocks, pin64_data_t* data, uint32_t revision, bool check_contents) {
 	const uint32_t cmdlist_start = data->get32(24);
 	const uint32_t block_dir_start = data->get32(12);
 	const uint32_t block_dir_data_start = block_dir_start + 12;
 	const uint32_t block_count = data->get32(block_dir_start + 8); // skip header
+	const size_t block_header_size = pin64_block_t::header_size(revision);
+
+	std::vector<block_ref_t> refs;
+	if (check_contents)
+		refs.reserve(block_count);
 
+	blocks.reserve(block_count);
 	for (uint32_t i = 0; i < block_count; i++) {
 		uint32_t block_offset = data->get32(block_dir_data_start + i * 4);
 		if (!verify_preamble(data, block_offset, pin64_block_t::BLOCK_ID, 4)) return false;
@@ -97,24 +106,69 @@ bool pin64_verifier_t::verify_blocks(std::map<uint32_t, pin64_block_t*>& blocks,
 		const size_t calculated_dir_size = next_offset - block_offset;
 
 		data->offset(block_offset + 4); // skip header
-		const uint32_t block_crc = data->get32();
+		const uint64_t block_id = pin64_t::read_id(data, revision);
+		const uint32_t block_flags = (revision > 0) ? data->get32() : 0;
 
 		const size_t block_size = data->get32();
-		if ((block_size + 12) != calculated_dir_size) return false;
+		if ((block_size + block_header_size) != calculated_dir_size) return false;
 
-		pin64_block_t *block = new pin64_block_t(data, block_size);
-		if (block->crc32() != block_crc) {
-			delete block;
-			return false;
-		}
+		if ((block_flags & pin64_block_t::FLAG_CHUNKED) && revision < 3) return false;
+		if ((block_flags & pin64_block_t::FLAG_COMPRESSED) && revision < 2) return false;
+
+		if (!blocks.insert(block_id, block_offset)) return false;
+
+		if (check_contents)
+			refs.push_back({ data->curr(), block_size, block_id, block_flags });
+	}
+
+	if (check_contents && !verify_contents(refs, revision)) return false;
+
+	return verify_chunks(blocks, data, revision);
+}
+
+bool pin64_verifier_t::verify_contents(const std::vector<block_ref_t>& refs, uint32_t revision) {
+	// hash every payload in place, in parallel; compressed payloads are
+	// identified by their raw contents
+	std::atomic<bool> failed(false);
+	pin64_thread_pool_t::shared().parallel_for(refs.size(), [&refs, &failed, revision](size_t i) {
+		if (failed)
+			return;
+
+		pin64_block_t block(refs[i].payload, refs[i].size, refs[i].id, refs[i].flags);
+		if (!block.decompress() || !block.verify(revision))
+			failed = true;
+	});
+
+	return !failed;
+}
 
-		blocks[block_crc] = block;
+bool pin64_verifier_t::verify_chunks(id_table_t& blocks, pin64_data_t* data, uint32_t revision) {
+	if (revision < 3)
+		return true;
+
+	// every chunk must exist, and must hold plain data rather than another list
+	for (id_table_t::entry_t& block_pair : blocks) {
+		const uint32_t flags = data->get32(block_pair.second + 12);
+		if (!(flags & pin64_block_t::FLAG_CHUNKED))
+			continue;
+
+		if (flags & pin64_block_t::FLAG_COMPRESSED) return false;
+
+		const uint32_t list_size = data->get32(block_pair.second + 16);
+		if (list_size % 8) return false;
+
+		data->offset(block_pair.second + pin64_block_t::header_size(revision));
+		for (uint32_t i = 0; i < list_size / 8; i++) {
+			const uint32_t* chunk_offset = blocks.find(data->get64());
+			if (!chunk_offset) return false;
+			if (data->get32(*chunk_offset + 12) & pin64_block_t::FLAG_CHUNKED) return false;
+		}
 	}
 
 	return true;
 }
 
-bool pin64_verifier_t::verify_cmdlist_directory(std::map<uint32_t, pin64_block_t*>& blocks, pin64_data_t* data) {
+bool pin64_verifier_t::verify_cmdlist_directory(id_table_t& blocks, pin64_data_t* data) {
 	const uint32_t cmd_count = data->get32(data->get32(24) + 8);
 
 	const uint32_t cmd_dir_start = data->get32(16);
@@ -130,26 +184,270 @@ bool pin64_verifier_t::verify_cmdlist_directory(std::map<uint32_t, pin64_block_t
 	return true;
 }
 
-bool pin64_verifier_t::verify_cmdlist(std::map<uint32_t, pin64_block_t*>& blocks, pin64_data_t* data) {
+bool pin64_verifier_t::verify_cmdlist(id_table_t& blocks, pin64_data_t* data, uint32_t revision) {
 	const uint32_t cmd_count = data->get32(data->get32(24) + 8); // skip over header
 
 	data->offset(data->get32(24) + 12); // skip over header + count
 	for (uint32_t i = 0; i < cmd_count; i++) {
-		uint32_t crc = data->get32();
-		if (blocks.find(crc) == blocks.end()) return false;
+		if (!blocks.contains(pin64_t::read_id(data, revision))) return false;
 	}
 
 	return true;
 }
 
-bool pin64_verifier_t::verify_metas(std::map<uint32_t, pin64_block_t*>& blocks, pin64_data_t* data) {
+bool pin64_verifier_t::verify_metas(id_table_t& blocks, pin64_data_t* data, uint32_t revision) {
 	const uint32_t meta_count = data->get32(data->get32(28) + 8); // skip over header
 
 	data->offset(data->get32(28) + 12); // skip over header + count
 	for (uint32_t i = 0; i < meta_count; i++) {
-		uint32_t crc = data->get32();
-		if (blocks.find(crc) == blocks.end()) return false;
+		if (!blocks.contains(pin64_t::read_id(data, revision))) return false;
+	}
+
+	return true;
+}
+
+bool pin64_verifier_t::verify_keyframes(id_table_t& blocks, pin64_data_t* data, uint32_t revision) {
+	const uint32_t keyframes_start = (revision >= 4) ? data->get32(36) : 0;
+	if (keyframes_start == 0)
+		return true;
+
+	if (keyframes_start < data->get32(28) || keyframes_start + 12 > data->size()) return false;
+	if (!verify_preamble(data, keyframes_start, pin64_t::KEY_ID, 8)) return false;
+
+	const uint32_t frame_count = data->get32(data->get32(16) + 8);
+	const uint32_t keyframe_count = data->get32();
+
+	// keyframes are sorted by frame so that seeking can search them
+	uint32_t next_frame = 0;
+	for (uint32_t i = 0; i < keyframe_count; i++) {
+		if (data->remaining() < 8) return false;
+		const uint32_t frame = data->get32();
+		if (frame < next_frame || frame >= frame_count) return false;
+		next_frame = frame + 1;
+
+		const uint32_t block_count = data->get32();
+		if (data->remaining() / 8 < block_count) return false;
+		for (uint32_t j = 0; j < block_count; j++) {
+			if (!blocks.contains(data->get64())) return false;
+		}
+	}
+
+	// frame ranges and frame hashes, when present, are the only sections
+	// after the keyframes
+	const uint32_t frame_ranges_start = (revision >= 5) ? data->get32(40) : 0;
+	const uint32_t frame_hashes_start = (revision >= 6) ? data->get32(44) : 0;
+	return data->offset() == (frame_ranges_start ? frame_ranges_start : frame_hashes_start ? frame_hashes_start : data->size());
+}
+
+bool pin64_verifier_t::verify_frame_ranges(pin64_data_t* data, uint32_t revision) {
+	const uint32_t frame_ranges_start = (revision >= 5) ? data->get32(40) : 0;
+	if (frame_ranges_start == 0)
+		return true;
+
+	if (frame_ranges_start < data->get32(28) || frame_ranges_start + 12 > data->size()) return false;
+	if (!verify_preamble(data, frame_ranges_start, pin64_t::FRR_ID, 8)) return false;
+
+	// only the frame hashes may follow the ranges
+	const uint32_t frame_hashes_start = (revision >= 6) ? data->get32(44) : 0;
+	const uint64_t frame_ranges_end = frame_hashes_start ? frame_hashes_start : data->size();
+
+	const uint32_t frame_count = data->get32(data->get32(16) + 8);
+	const uint32_t range_count = data->get32();
+	if (range_count != frame_count || (uint64_t)data->offset() + (uint64_t)range_count * 8 != frame_ranges_end) return false;
+
+	// every range lies inside the block data
+	const uint32_t blocks_start = data->get32(20) + 8;
+	const uint32_t blocks_end = data->get32(24);
+	for (uint32_t i = 0; i < range_count; i++) {
+		const uint32_t start = data->get32();
+		const uint32_t end = data->get32();
+		if (start > end || start < blocks_start || end > blocks_end) return false;
+	}
+
+	return true;
+}
+
+bool pin64_verifier_t::verify_frame_hashes(pin64_data_t* data, uint32_t revision) {
+	const uint32_t frame_hashes_start = (revision >= 6) ? data->get32(44) : 0;
+	if (frame_hashes_start == 0)
+		return true;
+
+	if (frame_hashes_start < data->get32(28) || frame_hashes_start + 12 > data->size()) return false;
+	if (!verify_preamble(data, frame_hashes_start, pin64_t::FHS_ID, 8)) return false;
+
+	const uint32_t frame_count = data->get32(data->get32(16) + 8);
+	const uint32_t hash_count = data->get32();
+	return hash_count == frame_count && data->remaining() == (size_t)hash_count * 24;
+}
+
+bool pin64_verifier_t::verify_v2(pin64_data_t* data, bool check_contents) {
+	const size_t size = data->size();
+	if (size < pin64_t::V2_HEADER_SIZE) return false;
+	if (data->get_le64(16) != size) return false;
+
+	const uint32_t revision = data->get_le32(8);
+	if (revision == 0 || revision > pin64_t::CAP_REVISION) return false;
+	const size_t header_size = pin64_t::v2_header_size(revision);
+	if (size < header_size) return false;
+
+	// every section lies inside the file, and the block payloads come last
+	const uint64_t blocks_start = data->get_le64(40);
+	const uint64_t keyframes_start = data->get_le64(64);
+	const uint64_t frame_ranges_start = (revision >= 5) ? data->get_le64(72) : 0;
+	const uint64_t frame_hashes_start = (revision >= 6) ? data->get_le64(80) : 0;
+	if (blocks_start < header_size || blocks_start > size - 8) return false;
+	if (memcmp(data->bytes() + blocks_start, pin64_t::BLK_ID, 8) != 0) return false;
+	if (keyframes_start != 0 && (keyframes_start < header_size || keyframes_start > blocks_start)) return false;
+	if (frame_ranges_start != 0 && (frame_ranges_start < header_size || frame_ranges_start > blocks_start)) return false;
+	if (frame_hashes_start != 0 && (frame_hashes_start < header_size || frame_hashes_start > blocks_start)) return false;
+	for (size_t field = 24; field <= 56; field += 8) {
+		const uint64_t start = data->get_le64(field);
+		if (field != 40 && (start < header_size || start > blocks_start)) return false;
+	}
+
+	if (!verify_v2_blocks(data, revision, check_contents)) return false;
+	if (!verify_v2_lists(data, revision)) return false;
+	if (!verify_v2_frame_ranges(data, revision)) return false;
+	return verify_v2_frame_hashes(data, revision);
+}
+
+bool pin64_verifier_t::verify_v2_blocks(pin64_data_t* data, uint32_t revision, bool check_contents) {
+	const size_t size = data->size();
+	const uint64_t block_dir_start = data->get_le64(24);
+	const uint64_t blocks_start = data->get_le64(40);
+	if (blocks_start - block_dir_start < 16) return false;
+	if (memcmp(data->bytes() + block_dir_start, pin64_t::BDR_ID, 8) != 0) return false;
+
+	const uint64_t block_count = data->get_le64((size_t)block_dir_start + 8);
+	if (block_count > (blocks_start - block_dir_start - 16) / pin64_t::V2_DIRECTORY_ENTRY_SIZE) return false;
+
+	id_table_t blocks;
+	std::vector<block_ref_t> refs((size_t)block_count);
+	blocks.reserve((size_t)block_count);
+	for (size_t i = 0; i < refs.size(); i++) {
+		const size_t entry = (size_t)block_dir_start + 16 + i * pin64_t::V2_DIRECTORY_ENTRY_SIZE;
+		const uint64_t payload = data->get_le64(entry + 16);
+		const uint64_t payload_size = data->get_le64(entry + 24);
+		if (payload < blocks_start + 8 || payload > size || payload_size > size - payload) return false;
+		if (payload % pin64_t::V2_ALIGNMENT) return false;
+
+		refs[i] = { data->bytes() + payload, (size_t)payload_size, data->get_le64(entry), data->get_le32(entry + 8) };
+		if (!blocks.insert(refs[i].id, (uint32_t)i)) return false;
+	}
+
+	if (check_contents && !verify_contents(refs, revision)) return false;
+
+	// every chunk must exist, and must hold plain data rather than another list
+	for (const block_ref_t& ref : refs) {
+		if (!(ref.flags & pin64_block_t::FLAG_CHUNKED))
+			continue;
+
+		if ((ref.flags & pin64_block_t::FLAG_COMPRESSED) || (ref.size % 8)) return false;
+
+		pin64_data_t list;
+		list.view(ref.payload, ref.size);
+		for (size_t i = 0; i < ref.size / 8; i++) {
+			const uint32_t* chunk = blocks.find(list.get64());
+			if (!chunk || (refs[*chunk].flags & pin64_block_t::FLAG_CHUNKED)) return false;
+		}
+	}
+
+	return true;
+}
+
+bool pin64_verifier_t::verify_v2_lists(pin64_data_t* data, uint32_t revision) {
+	const uint64_t block_count = data->get_le64((size_t)data->get_le64(24) + 8);
+
+	std::vector<uint32_t> frames;
+	std::vector<uint32_t> commands;
+	std::vector<uint32_t> metas;
+	if (!pin64_get_index_list(data, data->get_le64(32), pin64_t::CDR_ID, frames)) return false;
+	if (!pin64_get_index_list(data, data->get_le64(48), pin64_t::CMD_ID, commands)) return false;
+	if (!pin64_get_index_list(data, data->get_le64(56), pin64_t::MET_ID, metas)) return false;
+
+	for (size_t i = 0; i < frames.size(); i++) {
+		if (frames[i] >= commands.size() || (i > 0 && frames[i] < frames[i - 1])) return false;
+	}
+
+	for (uint32_t index : commands) {
+		if (index >= block_count) return false;
+	}
+
+	for (uint32_t index : metas) {
+		if (index >= block_count) return false;
+	}
+
+	const uint64_t keyframes_start = data->get_le64(64);
+	if (keyframes_start == 0)
+		return true;
+
+	// the keyframes end where the next section after them starts
+	uint64_t keyframes_end = data->get_le64(40);
+	const uint64_t frame_ranges_start = (revision >= 5) ? data->get_le64(72) : 0;
+	const uint64_t frame_hashes_start = (revision >= 6) ? data->get_le64(80) : 0;
+	if (frame_ranges_start > keyframes_start && frame_ranges_start < keyframes_end)
+		keyframes_end = frame_ranges_start;
+	if (frame_hashes_start > keyframes_start && frame_hashes_start < keyframes_end)
+		keyframes_end = frame_hashes_start;
+	if (keyframes_end - keyframes_start < 16) return false;
+	if (memcmp(data->bytes() + keyframes_start, pin64_t::KEY_ID, 8) != 0) return false;
+
+	// keyframes are sorted by frame so that seeking can search them
+	const uint64_t keyframe_count = data->get_le64((size_t)keyframes_start + 8);
+	uint64_t offset = keyframes_start + 16;
+	uint32_t next_frame = 0;
+	for (uint64_t i = 0; i < keyframe_count; i++) {
+		if (keyframes_end - offset < 8) return false;
+		const uint32_t frame = data->get_le32((size_t)offset);
+		const uint32_t count = data->get_le32((size_t)offset + 4);
+		if (frame < next_frame || frame >= frames.size()) return false;
+		next_frame = frame + 1;
+		offset += 8;
+
+		if ((keyframes_end - offset) / 4 < count) return false;
+		for (uint32_t j = 0; j < count; j++, offset += 4) {
+			if (data->get_le32((size_t)offset) >= block_count) return false;
+		}
 	}
 
 	return true;
 }
+
+bool pin64_verifier_t::verify_v2_frame_ranges(pin64_data_t* data, uint32_t revision) {
+	const uint64_t frame_ranges_start = (revision >= 5) ? data->get_le64(72) : 0;
+	if (frame_ranges_start == 0)
+		return true;
+
+	const uint64_t blocks_start = data->get_le64(40);
+	if (blocks_start - frame_ranges_start < 16) return false;
+	if (memcmp(data->bytes() + frame_ranges_start, pin64_t::FRR_ID, 8) != 0) return false;
+
+	const uint64_t frames_start = data->get_le64(32);
+	const uint64_t frame_count = data->get_le64((size_t)frames_start + 8);
+	const uint64_t range_count = data->get_le64((size_t)frame_ranges_start + 8);
+	if (range_count != frame_count || range_count > (blocks_start - frame_ranges_start - 16) / 16) return false;
+
+	// every range lies inside the block payloads
+	const uint64_t size = data->size();
+	for (uint64_t i = 0; i < range_count; i++) {
+		const uint64_t start = data->get_le64((size_t)(frame_ranges_start + 16 + i * 16));
+		const uint64_t end = data->get_le64((size_t)(frame_ranges_start + 24 + i * 16));
+		if (start > end || start < blocks_start + 8 || end > size) return false;
+	}
+
+	return true;
+}
+
+bool pin64_verifier_t::verify_v2_frame_hashes(pin64_data_t* data, uint32_t revision) {
+	const uint64_t frame_hashes_start = (revision >= 6) ? data->get_le64(80) : 0;
+	if (frame_hashes_start == 0)
+		return true;
+
+	const uint64_t blocks_start = data->get_le64(40);
+	if (blocks_start - frame_hashes_start < 16) return false;
+	if (memcmp(data->bytes() + frame_hashes_start, pin64_t::FHS_ID, 8) != 0) return false;
+
+	const uint64_t frame_count = data->get_le64((size_t)data->get_le64(32) + 8);
+	const uint64_t hash_count = data->get_le64((size_t)frame_hashes_start + 8);
+	return hash_count == frame_count && hash_count <= (blocks_start - frame_hashes_start - 16) / 24;
+}
@@ -5,8 +5,10 @@
 #ifndef PIN64_VERIFIER_H
 #define PIN64_VERIFIER_H
 
+#include <cstddef>
 #include <cstdint>
-#include <map>
+#include <vector>
+#include "hash.h"
 
 class pin64_t;
 class pin64_block_t;
@@ -14,16 +16,39 @@ class pin64_data_t;
 
 class pin64_verifier_t {
 public:
-	static bool verify(pin64_data_t* data);
+	// the loader checks block contents itself as it unpacks them, so it can
+	// skip that part of the verification
+	static bool verify(pin64_data_t* data, bool check_contents = true);
 
 private:
+	// block id -> block offset, or directory index in the version-2 layout
+	typedef pin64_hash_table_t<uint32_t> id_table_t;
+
+	struct block_ref_t {
+		const uint8_t* payload;
+		size_t size;
+		uint64_t id;
+		uint32_t flags;
+	};
+
 	static bool verify_headers(pin64_data_t* data);
 	static bool verify_preamble(pin64_data_t* data, const uint32_t offset, const uint8_t* compare, const size_t size);
 	static bool verify_data_directory(pin64_data_t* data);
-	static bool verify_blocks(std::map<uint32_t, pin64_block_t*>& blocks, pin64_data_t* data);
-	static bool verify_cmdlist_directory(std::map<uint32_t, pin64_block_t*>& blocks, pin64_data_t* data);
-	static bool verify_cmdlist(std::map<uint32_t, pin64_block_t*>& blocks, pin64_data_t* data);
-	static bool verify_metas(std::map<uint32_t, pin64_block_t*>& blocks, pin64_data_t* data);
+	static bool verify_blocks(id_table_t& blocks, pin64_data_t* data, uint32_t revision, bool check_contents);
+	static bool verify_contents(const std::vector<block_ref_t>& refs, uint32_t revision);
+	static bool verify_chunks(id_table_t& blocks, pin64_data_t* data, uint32_t revision);
+	static bool verify_cmdlist_directory(id_table_t& blocks, pin64_data_t* data);
+	static bool verify_cmdlist(id_table_t& blocks, pin64_data_t* data, uint32_t revision);
+	static bool verify_metas(id_table_t& blocks, pin64_data_t* data, uint32_t revision);
+	static bool verify_keyframes(id_table_t& blocks, pin64_data_t* data, uint32_t revision);
+	static bool verify_frame_ranges(pin64_data_t* data, uint32_t revision);
+	static bool verify_frame_hashes(pin64_data_t* data, uint32_t revision);
+
+	static bool verify_v2(pin64_data_t* data, bool check_contents);
+	static bool verify_v2_blocks(pin64_data_t* data, uint32_t revision, bool check_contents);
+	static bool verify_v2_lists(pin64_data_t* data, uint32_t revision);
+	static bool verify_v2_frame_ranges(pin64_data_t* data, uint32_t revision);
+	static bool verify_v2_frame_hashes(pin64_data_t* data, uint32_t revision);
 };
 
-#endif // PIN64_VERIFIER_H
\ No newline at end of file
+#endif // PIN64_VERIFIER_H
@@ -0,0 +1,145 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#include "writequeue.h"
+#include "data.h"
+#include "writer.h"
+
+pin64_write_queue_t::pin64_write_queue_t()
+	: m_head(0)
+	, m_tail(0)
+	, m_sleeping(false)
+	, m_file(nullptr)
+	, m_position(0)
+	, m_completed(0)
+	, m_exit(false) {
+}
+
+pin64_write_queue_t::~pin64_write_queue_t() {
+	if (!m_thread.joinable())
+		return;
+
+	sync();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_exit = true;
+	}
+	m_wake.notify_one();
+	m_thread.join();
+}
+
+void pin64_write_queue_t::open(FILE* file) {
+	item_t* item = new item_t();
+	item->type = ITEM_OPEN;
+	item->file = file;
+	push(item);
+}
+
+void pin64_write_queue_t::write(pin64_data_t* buffer, size_t offset) {
+	item_t* item = new item_t();
+	item->type = ITEM_WRITE;
+	item->buffer = buffer;
+	item->offset = offset;
+	push(item);
+}
+
+void pin64_write_queue_t::run(const std::function<void(FILE*)>& task) {
+	item_t* item = new item_t();
+	item->type = ITEM_TASK;
+	item->task = task;
+	push(item);
+}
+
+void pin64_write_queue_t::close() {
+	item_t* item = new item_t();
+	item->type = ITEM_CLOSE;
+	push(item);
+}
+
+void pin64_write_queue_t::sync() {
+	const size_t tail = m_tail.load();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_idle.wait(lock, [this, tail] { return m_completed >= tail; });
+}
+
+void pin64_write_queue_t::push(item_t* item) {
+	// the worker is only started once something is written, so captures
+	// that are never recorded don't carry a thread
+	if (!m_thread.joinable())
+		m_thread = std::thread(&pin64_write_queue_t::worker, this);
+
+	const size_t tail = m_tail.load(std::memory_order_relaxed);
+	if (tail - m_head.load(std::memory_order_acquire) == CAPACITY) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_idle.wait(lock, [this, tail] { return tail - m_head.load(std::memory_order_acquire) < CAPACITY; });
+	}
+
+	m_ring[tail % CAPACITY] = item;
+	m_tail.store(tail + 1);
+
+	// only take the lock when the worker may be waiting for work
+	if (m_sleeping.load()) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_wake.notify_one();
+	}
+}
+
+void pin64_write_queue_t::worker() {
+	for (;;) {
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load()) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_sleeping.store(true);
+			m_wake.wait(lock, [this, head] { return m_exit || head != m_tail.load(); });
+			m_sleeping.store(false);
+			if (head == m_tail.load())
+				return;
+			continue;
+		}
+
+		item_t* item = m_ring[head % CAPACITY];
+		m_head.store(head + 1, std::memory_order_release);
+
+		execute(item);
+		delete item;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_completed = head + 1;
+		}
+		m_idle.notify_all();
+	}
+}
+
+void pin64_write_queue_t::execute(item_t* item) {
+	switch (item->type) {
+	case ITEM_OPEN:
+		m_file = item->file;
+		m_position = 0;
+		break;
+
+	case ITEM_WRITE:
+		if (m_file) {
+			if (item->offset != m_position)
+				pin64_writer_t::seek(m_file, item->offset);
+			fwrite(item->buffer->bytes(), 1, item->buffer->size(), m_file);
+			m_position = item->offset + item->buffer->size();
+		}
+		delete item->buffer;
+		break;
+
+	case ITEM_TASK:
+		item->task(m_file);
+		if (m_file)
+			m_position = (size_t)pin64_writer_t::tell(m_file);
+		break;
+
+	case ITEM_CLOSE:
+		if (m_file)
+			fclose(m_file);
+		m_file = nullptr;
+		m_position = 0;
+		break;
+	}
+}
@@ -0,0 +1,75 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+#pragma once
+
+#ifndef PIN64_WRITEQUEUE_H
+#define PIN64_WRITEQUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class pin64_data_t;
+
+// background writer that owns a capture file; the capturing thread hands
+// over pre-serialized buffers and tasks through a single-producer,
+// single-consumer ring and only waits if the ring is full or on sync()
+class pin64_write_queue_t {
+public:
+	pin64_write_queue_t();
+	~pin64_write_queue_t();
+
+	// items run in order; buffers are owned by the queue once written
+	void open(FILE* file);
+	void write(pin64_data_t* buffer, size_t offset);
+	void run(const std::function<void(FILE*)>& task);
+	void close();
+
+	// waits until every queued item has run; must not be called from a task
+	void sync();
+
+	static const size_t CAPACITY = 256;
+
+private:
+	enum item_type_t {
+		ITEM_OPEN,
+		ITEM_WRITE,
+		ITEM_TASK,
+		ITEM_CLOSE
+	};
+
+	struct item_t {
+		item_type_t type;
+		FILE* file;
+		pin64_data_t* buffer;
+		size_t offset;
+		std::function<void(FILE*)> task;
+	};
+
+	void push(item_t* item);
+	void worker();
+	void execute(item_t* item);
+
+	item_t* m_ring[CAPACITY];
+	std::atomic<size_t> m_head;
+	std::atomic<size_t> m_tail;
+	std::atomic<bool> m_sleeping;
+
+	// only touched by the worker
+	FILE* m_file;
+	size_t m_position;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_idle;
+	size_t m_completed;
+	bool m_exit;
+};
+
+#endif // PIN64_WRITEQUEUE_H
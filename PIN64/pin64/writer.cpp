@@ -3,22 +3,55 @@
 #include "writer.h"
 #include "pin64.h"
 #include "block.h"
+#include "data.h"
+#include "threadpool.h"
+#include "varint.h"
+
+#include <cstring>
+
+static inline void store_le32(uint8_t* p, uint32_t data) {
+	p[0] = (uint8_t)data;
+	p[1] = (uint8_t)(data >> 8);
+	p[2] = (uint8_t)(data >> 16);
+	p[3] = (uint8_t)(data >> 24);
+}
+
+static inline void store_le64(uint8_t* p, uint64_t data) {
+	store_le32(p, (uint32_t)data);
+	store_le32(p + 4, (uint32_t)(data >> 32));
+}
+
+static inline uint64_t align_v2(uint64_t offset) {
+	return (offset + pin64_t::V2_ALIGNMENT - 1) & ~(uint64_t)(pin64_t::V2_ALIGNMENT - 1);
+}
+
+bool pin64_writer_t::seek(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+	return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+uint64_t pin64_writer_t::tell(FILE* file) {
+#ifdef _WIN32
+	return (uint64_t)_ftelli64(file);
+#else
+	return (uint64_t)ftello(file);
+#endif
+}
 
 void pin64_writer_t::write(FILE* file, uint32_t data) {
 	if (!file)
 		return;
 
-	uint8_t temp(data >> 24);
-	fwrite(&temp, 1, 1, file);
-
-	temp = (uint8_t)(data >> 16);
-	fwrite(&temp, 1, 1, file);
-
-	temp = (uint8_t)(data >> 8);
-	fwrite(&temp, 1, 1, file);
+	const uint8_t temp[4] = { (uint8_t)(data >> 24), (uint8_t)(data >> 16), (uint8_t)(data >> 8), (uint8_t)data };
+	fwrite(temp, 1, 4, file);
+}
 
-	temp = (uint8_t)data;
-	fwrite(&temp, 1, 1, file);
+void pin64_writer_t::write(FILE* file, uint64_t data) {
+	write(file, (uint32_t)(data >> 32));
+	write(file, (uint32_t)data);
 }
 
 void pin64_writer_t::write(FILE* file, const uint8_t* data, uint32_t size) {
@@ -28,77 +61,452 @@ void pin64_writer_t::write(FILE* file, const uint8_t* data, uint32_t size) {
 	fwrite(data, 1, size, file);
 }
 
+void pin64_writer_t::write(pin64_data_t* image, uint32_t data) {
+	if (!image)
+		return;
+
+	image->put32(data);
+}
+
+void pin64_writer_t::write(pin64_data_t* image, uint64_t data) {
+	if (!image)
+		return;
+
+	image->put64(data);
+}
+
+void pin64_writer_t::write(pin64_data_t* image, const uint8_t* data, uint32_t size) {
+	if (!image)
+		return;
+
+	image->put(data, size);
+}
+
 void pin64_writer_t::write(FILE* file, pin64_block_t* block) {
-	write(file, pin64_block_t::BLOCK_ID, 4);
-	write(file, block->crc32());
+	write_block(file, block);
+}
 
-	const uint32_t block_size = (uint32_t)block->data()->size();
-	write(file, block_size);
+void pin64_writer_t::write(pin64_data_t* image, pin64_block_t* block) {
+	write_block(image, block);
+}
+
+template <typename T>
+void pin64_writer_t::write_block(T* out, pin64_block_t* block) {
+	write(out, pin64_block_t::BLOCK_ID, 4);
+	write(out, block->hash());
+	write(out, block->flags());
+
+	const uint32_t block_size = (uint32_t)block->stored_size();
+	write(out, block_size);
 
 	if (block_size > 0)
-		write(file, block->data()->bytes(), block_size);
+		write(out, block->stored_bytes(), block_size);
 }
 
-void pin64_writer_t::write_data_directory(FILE* file, pin64_t* capture) {
-	write(file, pin64_t::BDR_ID, 8);
+template <typename T>
+void pin64_writer_t::write_header(T* out, uint32_t size_total, uint32_t block_dir_start, uint32_t cmdlist_dir_start, uint32_t blocks_start, uint32_t cmdlist_start, uint32_t metas_start, uint32_t keyframes_start, uint32_t frame_ranges_start, uint32_t frame_hashes_start) {
+	write(out, pin64_t::CAP_ID, 8);
+	write(out, size_total);
+	write(out, block_dir_start);
+	write(out, cmdlist_dir_start);
+	write(out, blocks_start);
+	write(out, cmdlist_start);
+	write(out, metas_start);
+	write(out, pin64_t::CAP_REVISION);
+	write(out, keyframes_start);
+	write(out, frame_ranges_start);
+	write(out, frame_hashes_start);
+}
 
-	std::map<uint32_t, pin64_block_t*>& blocks = capture->blocks();
-	write(file, (uint32_t)blocks.size());
+template <typename T>
+void pin64_writer_t::write_data_directory(T* out, const std::vector<uint32_t>& offsets) {
+	write(out, pin64_t::BDR_ID, 8);
+	write(out, (uint32_t)offsets.size());
 
-	uint32_t offset = static_cast<uint32_t>(capture->header_size() + capture->block_directory_size() + capture->cmdlist_directory_size() + 8);
-	for (std::pair<uint32_t, pin64_block_t*> block_pair : blocks) {
-		write(file, offset);
-		offset += static_cast<uint32_t>((block_pair.second)->size());
-	}
+	for (uint32_t offset : offsets)
+		write(out, offset);
 }
 
-void pin64_writer_t::write_cmdlist_directory(FILE* file, pin64_t* capture) {
-	write(file, pin64_t::CDR_ID, 8);
+template <typename T>
+void pin64_writer_t::write_cmdlist_directory(T* out, pin64_t* capture) {
+	write(out, pin64_t::CDR_ID, 8);
 
 	std::vector<uint32_t>& frames = capture->frames();
-	write(file, (uint32_t)frames.size());
+	write(out, (uint32_t)frames.size());
 
 	for (uint32_t frame : frames)
-		write(file, frame);
+		write(out, frame);
+}
+
+template <typename T>
+void pin64_writer_t::write_id_list(T* out, const uint8_t* id, const std::vector<uint64_t>& list) {
+	write(out, id, 8);
+	write(out, (uint32_t)list.size());
+	for (uint64_t block_id : list)
+		write(out, block_id);
+}
+
+template <typename T>
+void pin64_writer_t::write_keyframes(T* out, pin64_t* capture) {
+	std::vector<pin64_keyframe_t>& keyframes = capture->keyframes();
+	if (keyframes.empty())
+		return;
+
+	write(out, pin64_t::KEY_ID, 8);
+	write(out, (uint32_t)keyframes.size());
+	for (pin64_keyframe_t& keyframe : keyframes) {
+		write(out, keyframe.frame);
+		write(out, (uint32_t)keyframe.blocks.size());
+		for (uint64_t block_id : keyframe.blocks)
+			write(out, block_id);
+	}
+}
+
+template <typename T>
+void pin64_writer_t::write_frame_ranges(T* out, pin64_t* capture) {
+	std::vector<pin64_frame_range_t>& ranges = capture->frame_ranges();
+	if (ranges.empty())
+		return;
+
+	write(out, pin64_t::FRR_ID, 8);
+	write(out, (uint32_t)ranges.size());
+	for (pin64_frame_range_t& range : ranges) {
+		write(out, (uint32_t)range.start);
+		write(out, (uint32_t)range.end);
+	}
+}
+
+template <typename T>
+void pin64_writer_t::write_frame_hashes(T* out, pin64_t* capture) {
+	std::vector<pin64_frame_hashes_t>& frame_hashes = capture->frame_hashes();
+	if (frame_hashes.empty())
+		return;
+
+	write(out, pin64_t::FHS_ID, 8);
+	write(out, (uint32_t)frame_hashes.size());
+	for (pin64_frame_hashes_t& hashes : frame_hashes) {
+		write(out, hashes.color);
+		write(out, hashes.depth);
+		write(out, hashes.hidden);
+	}
+}
+
+void pin64_writer_t::place_block(pin64_t* capture, pin64_hash_table_t<uint8_t>& placed, std::vector<pin64_block_t*>& blocks, uint64_t id) {
+	pin64_block_t** block = capture->blocks().find(id);
+	if (!block || !placed.insert(id, 1))
+		return;
+
+	blocks.push_back(*block);
+
+	// a chunked block's chunks follow its list; chunk lists are stored raw
+	if ((*block)->chunked()) {
+		pin64_data_t list;
+		list.view((*block)->stored_bytes(), (*block)->stored_size());
+		for (size_t i = 0; i < list.size() / 8; i++)
+			place_block(capture, placed, blocks, list.get64());
+	}
+}
+
+void pin64_writer_t::order_blocks(pin64_t* capture, std::vector<pin64_block_t*>& blocks, std::vector<size_t>& frame_ends) {
+	pin64_hash_table_t<uint8_t> placed;
+	placed.reserve(capture->blocks().size());
+	blocks.clear();
+	blocks.reserve(capture->blocks().size());
+
+	std::vector<uint32_t>& frames = capture->frames();
+	std::vector<uint64_t>& commands = capture->commands();
+	std::vector<uint64_t>& metas = capture->metas();
+	std::vector<pin64_keyframe_t>& keyframes = capture->keyframes();
+
+	// keyframe state is grouped with the frame it restores
+	size_t keyframe = 0;
+	frame_ends.resize(frames.size());
+	for (size_t i = 0; i < frames.size(); i++) {
+		for (; keyframe < keyframes.size() && keyframes[keyframe].frame <= i; keyframe++) {
+			for (uint64_t block_id : keyframes[keyframe].blocks)
+				place_block(capture, placed, blocks, block_id);
+		}
+
+		if (i < metas.size())
+			place_block(capture, placed, blocks, metas[i]);
+
+		const size_t next_start = (i == frames.size() - 1) ? commands.size() : frames[i + 1];
+		for (size_t cmd = frames[i]; cmd < next_start; cmd++) {
+			place_block(capture, placed, blocks, commands[cmd]);
+
+			pin64_block_t** command = capture->blocks().find(commands[cmd]);
+			uint64_t data_id;
+			if (command && pin64_t::data_ref(*command, capture->revision(), data_id))
+				place_block(capture, placed, blocks, data_id);
+		}
+
+		frame_ends[i] = blocks.size();
+	}
+
+	// anything nothing refers to goes last, outside every frame's range
+	for (pin64_block_map_t::entry_t& block_pair : capture->blocks())
+		place_block(capture, placed, blocks, block_pair.first);
+}
+
+void pin64_writer_t::set_frame_ranges(pin64_t* capture, const std::vector<size_t>& frame_ends, const std::vector<uint64_t>& offsets, uint64_t blocks_end) {
+	std::vector<pin64_frame_range_t>& ranges = capture->frame_ranges();
+	ranges.resize(frame_ends.size());
+
+	size_t first = 0;
+	for (size_t i = 0; i < frame_ends.size(); i++) {
+		ranges[i].start = (first < offsets.size()) ? offsets[first] : blocks_end;
+		ranges[i].end = (frame_ends[i] < offsets.size()) ? offsets[frame_ends[i]] : blocks_end;
+		first = frame_ends[i];
+	}
 }
 
 void pin64_writer_t::write(FILE* file, pin64_t* capture) {
 	if (!file || !capture)
 		return;
 
-	const uint32_t size_total = static_cast<uint32_t>(capture->size());
+	write_capture(file, capture);
+}
+
+void pin64_writer_t::write(pin64_data_t* image, pin64_t* capture) {
+	if (!image || !capture)
+		return;
+
+	image->reserve(capture->size());
+	write_capture(image, capture);
+}
+
+template <typename T>
+void pin64_writer_t::write_capture(T* out, pin64_t* capture) {
+	std::vector<pin64_block_t*> blocks;
+	std::vector<size_t> frame_ends;
+	order_blocks(capture, blocks, frame_ends);
+
 	const uint32_t size_header = static_cast<uint32_t>(capture->header_size());
 	const uint32_t size_block_dir = static_cast<uint32_t>(capture->block_directory_size());
 	const uint32_t size_cmdlist_dir = static_cast<uint32_t>(capture->cmdlist_directory_size());
 	const uint32_t size_blocks = static_cast<uint32_t>(capture->blocks_size());
 	const uint32_t size_cmdlist = static_cast<uint32_t>(capture->cmdlist_size());
+	const uint32_t size_metas = static_cast<uint32_t>(capture->metas_size());
+	const uint32_t blocks_start = size_header + size_block_dir + size_cmdlist_dir;
+	const uint32_t metas_start = blocks_start + size_blocks + size_cmdlist;
 
-	write(file, pin64_t::CAP_ID, 8);
-	write(file, size_total);
-	write(file, size_header);
-	write(file, size_header + size_block_dir);
-	write(file, size_header + size_block_dir + size_cmdlist_dir);
-	write(file, size_header + size_block_dir + size_cmdlist_dir + size_blocks);
-	write(file, size_header + size_block_dir + size_cmdlist_dir + size_blocks + size_cmdlist);
+	std::vector<uint64_t> offsets(blocks.size());
+	uint64_t offset = blocks_start + 8;
+	for (size_t i = 0; i < blocks.size(); i++) {
+		offsets[i] = offset;
+		offset += blocks[i]->size();
+	}
+	set_frame_ranges(capture, frame_ends, offsets, offset);
 
-	write_data_directory(file, capture);
-	write_cmdlist_directory(file, capture);
+	const uint32_t size_total = static_cast<uint32_t>(capture->size());
+	const uint32_t keyframes_start = capture->keyframes().empty() ? 0 : metas_start + size_metas;
+	const uint32_t frame_ranges_start = capture->frame_ranges().empty() ? 0 : metas_start + size_metas + static_cast<uint32_t>(capture->keyframes_size());
+	const uint32_t frame_hashes_start = capture->frame_hashes().empty() ? 0 : size_total - static_cast<uint32_t>(capture->frame_hashes_size());
 
-	write(file, pin64_t::BLK_ID, 8);
-	for (std::pair<uint32_t, pin64_block_t*> block_pair : capture->blocks())
-		write(file, block_pair.second);
+	write_header(out, size_total,
+		size_header,
+		size_header + size_block_dir,
+		blocks_start,
+		blocks_start + size_blocks,
+		metas_start,
+		keyframes_start,
+		frame_ranges_start,
+		frame_hashes_start);
 
-	std::vector<uint32_t>& commands = capture->commands();
-	write(file, pin64_t::CMD_ID, 8);
-	write(file, (uint32_t)commands.size());
-	for (uint32_t crc : commands)
-		write(file, crc);
+	write(out, pin64_t::BDR_ID, 8);
+	write(out, (uint32_t)blocks.size());
+	for (uint64_t block_offset : offsets)
+		write(out, (uint32_t)block_offset);
 
-	std::vector<uint32_t>& metas = capture->commands();
-	write(file, pin64_t::MET_ID, 8);
-	write(file, (uint32_t)metas.size());
-	for (uint32_t crc : metas)
-		write(file, crc);
+	write_cmdlist_directory(out, capture);
+
+	write(out, pin64_t::BLK_ID, 8);
+	for (pin64_block_t* block : blocks)
+		write(out, block);
+
+	write_id_list(out, pin64_t::CMD_ID, capture->commands());
+	write_id_list(out, pin64_t::MET_ID, capture->metas());
+	write_keyframes(out, capture);
+	write_frame_ranges(out, capture);
+	write_frame_hashes(out, capture);
 }
 
+void pin64_writer_t::write_stream_header(pin64_data_t* image) {
+	if (!image)
+		return;
 
+	write_header(image, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	write(image, pin64_t::BLK_ID, 8);
+}
+
+void pin64_writer_t::write_stream_trailer(pin64_data_t* trailer, pin64_data_t* header, pin64_t* capture) {
+	if (!trailer || !header || !capture)
+		return;
+
+	// the block list is contiguous from the end of the header, so the
+	// command list can follow it directly; the directories go after that
+	const uint32_t size_header = static_cast<uint32_t>(capture->header_size());
+	const uint32_t blocks_start = size_header;
+	const uint32_t cmdlist_start = blocks_start + static_cast<uint32_t>(capture->blocks_size());
+	const uint32_t block_dir_start = cmdlist_start + static_cast<uint32_t>(capture->cmdlist_size());
+	const uint32_t cmdlist_dir_start = block_dir_start + static_cast<uint32_t>(capture->block_directory_size());
+	const uint32_t metas_start = cmdlist_dir_start + static_cast<uint32_t>(capture->cmdlist_directory_size());
+	const uint32_t frame_ranges_start = metas_start + static_cast<uint32_t>(capture->metas_size());
+	const uint32_t frame_hashes_start = frame_ranges_start + static_cast<uint32_t>(capture->frame_ranges_size());
+	const uint32_t size_total = frame_hashes_start + static_cast<uint32_t>(capture->frame_hashes_size());
+
+	// streamed blocks were appended frame by frame, so they are already in
+	// first-use order and the frame ranges were recorded as they went out
+	write_id_list(trailer, pin64_t::CMD_ID, capture->commands());
+	write_data_directory(trailer, capture->stream_directory());
+	write_cmdlist_directory(trailer, capture);
+	write_id_list(trailer, pin64_t::MET_ID, capture->metas());
+	write_frame_ranges(trailer, capture);
+	write_frame_hashes(trailer, capture);
+
+	write_header(header, size_total, block_dir_start, cmdlist_dir_start, blocks_start, cmdlist_start, metas_start, 0,
+		capture->frame_ranges().empty() ? 0 : frame_ranges_start,
+		capture->frame_hashes().empty() ? 0 : frame_hashes_start);
+}
+
+void pin64_writer_t::write_manifest(FILE* file, pin64_t* capture, const char* pack_name) {
+	if (!file || !capture || !pack_name)
+		return;
+
+	const uint32_t name_size = (uint32_t)strlen(pack_name);
+	write(file, pin64_t::MAN_ID, 8);
+	write(file, pin64_t::CAP_REVISION);
+	write(file, name_size);
+	write(file, (const uint8_t*)pack_name, name_size);
+
+	write_cmdlist_directory(file, capture);
+	write_id_list(file, pin64_t::CMD_ID, capture->commands());
+	write_id_list(file, pin64_t::MET_ID, capture->metas());
+	write_keyframes(file, capture);
+	write_frame_hashes(file, capture);
+}
+
+void pin64_writer_t::write_v2(pin64_data_t* image, pin64_t* capture) {
+	if (!image || !capture)
+		return;
+
+	std::vector<pin64_block_t*> blocks;
+	std::vector<size_t> frame_ends;
+	order_blocks(capture, blocks, frame_ends);
+
+	pin64_hash_table_t<uint32_t> indices;
+	indices.reserve(blocks.size());
+	for (size_t i = 0; i < blocks.size(); i++)
+		indices.insert(blocks[i]->hash(), (uint32_t)i);
+
+	// the index lists are small, so they are encoded up front
+	std::vector<uint32_t> list;
+	pin64_data_t lists;
+
+	const uint64_t frames_offset = lists.size();
+	pin64_put_index_list(&lists, pin64_t::CDR_ID, capture->frames());
+
+	const uint64_t commands_offset = lists.size();
+	list.clear();
+	for (uint64_t block_id : capture->commands())
+		list.push_back(*indices.find(block_id));
+	pin64_put_index_list(&lists, pin64_t::CMD_ID, list);
+
+	const uint64_t metas_offset = lists.size();
+	list.clear();
+	for (uint64_t block_id : capture->metas())
+		list.push_back(*indices.find(block_id));
+	pin64_put_index_list(&lists, pin64_t::MET_ID, list);
+
+	const uint64_t keyframes_offset = lists.size();
+	std::vector<pin64_keyframe_t>& keyframes = capture->keyframes();
+	if (!keyframes.empty()) {
+		lists.put(pin64_t::KEY_ID, 8);
+		lists.put_le64(keyframes.size());
+		for (pin64_keyframe_t& keyframe : keyframes) {
+			lists.put_le32(keyframe.frame);
+			lists.put_le32((uint32_t)keyframe.blocks.size());
+			for (uint64_t block_id : keyframe.blocks)
+				lists.put_le32(*indices.find(block_id));
+		}
+	}
+
+	// frame ranges, then frame hashes, follow the keyframes; their sizes are
+	// fixed, so the block offsets can be computed before the ranges are
+	// filled in
+	const uint64_t frame_ranges_offset = lists.size();
+	const uint64_t frame_ranges_size = frame_ends.empty() ? 0 : 16 + frame_ends.size() * 16;
+	std::vector<pin64_frame_hashes_t>& frame_hashes = capture->frame_hashes();
+	const uint64_t frame_hashes_offset = lists.size() + frame_ranges_size;
+	const uint64_t frame_hashes_size = frame_hashes.empty() ? 0 : 16 + frame_hashes.size() * 24;
+
+	const uint64_t block_dir_start = pin64_t::v2_header_size(pin64_t::CAP_REVISION);
+	const uint64_t lists_start = block_dir_start + 16 + blocks.size() * pin64_t::V2_DIRECTORY_ENTRY_SIZE;
+	const uint64_t blocks_start = align_v2(lists_start + lists.size() + frame_ranges_size + frame_hashes_size);
+
+	std::vector<uint64_t> payloads(blocks.size());
+	uint64_t offset = blocks_start + 8;
+	for (size_t i = 0; i < blocks.size(); i++) {
+		offset = align_v2(offset);
+		payloads[i] = offset;
+		offset += blocks[i]->stored_size();
+	}
+	const uint64_t size_total = offset;
+	set_frame_ranges(capture, frame_ends, payloads, size_total);
+
+	std::vector<pin64_frame_range_t>& ranges = capture->frame_ranges();
+	if (!ranges.empty()) {
+		lists.put(pin64_t::FRR_ID, 8);
+		lists.put_le64(ranges.size());
+		for (pin64_frame_range_t& range : ranges) {
+			lists.put_le64(range.start);
+			lists.put_le64(range.end);
+		}
+	}
+
+	if (!frame_hashes.empty()) {
+		lists.put(pin64_t::FHS_ID, 8);
+		lists.put_le64(frame_hashes.size());
+		for (pin64_frame_hashes_t& hashes : frame_hashes) {
+			lists.put_le64(hashes.color);
+			lists.put_le64(hashes.depth);
+			lists.put_le64(hashes.hidden);
+		}
+	}
+
+	// padding stays zeroed
+	image->clear();
+	uint8_t* out = image->resize((size_t)size_total);
+
+	memcpy(out, pin64_t::CP2_ID, 8);
+	store_le32(out + 8, pin64_t::CAP_REVISION);
+	store_le32(out + 12, 0);
+	store_le64(out + 16, size_total);
+	store_le64(out + 24, block_dir_start);
+	store_le64(out + 32, lists_start + frames_offset);
+	store_le64(out + 40, blocks_start);
+	store_le64(out + 48, lists_start + commands_offset);
+	store_le64(out + 56, lists_start + metas_offset);
+	store_le64(out + 64, keyframes.empty() ? 0 : lists_start + keyframes_offset);
+	store_le64(out + 72, ranges.empty() ? 0 : lists_start + frame_ranges_offset);
+	store_le64(out + 80, frame_hashes.empty() ? 0 : lists_start + frame_hashes_offset);
+
+	memcpy(out + block_dir_start, pin64_t::BDR_ID, 8);
+	store_le64(out + block_dir_start + 8, blocks.size());
+	if (lists.size() > 0)
+		memcpy(out + lists_start, lists.bytes(), lists.size());
+	memcpy(out + blocks_start, pin64_t::BLK_ID, 8);
+
+	pin64_thread_pool_t::shared().parallel_for(blocks.size(), [&blocks, &payloads, out, block_dir_start](size_t i) {
+		pin64_block_t* block = blocks[i];
+		uint8_t* entry = out + block_dir_start + 16 + i * pin64_t::V2_DIRECTORY_ENTRY_SIZE;
+		store_le64(entry, block->hash());
+		store_le32(entry + 8, block->flags());
+		store_le32(entry + 12, 0);
+		store_le64(entry + 16, payloads[i]);
+		store_le64(entry + 24, block->stored_size());
+
+		if (block->stored_size() > 0)
+			memcpy(out + payloads[i], block->stored_bytes(), block->stored_size());
+	});
+}
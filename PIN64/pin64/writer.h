@@ -7,20 +7,63 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <vector>
+#include "hash.h"
 
 class pin64_t;
 class pin64_block_t;
+class pin64_data_t;
 
+// captures can be written either to a file or to an in-memory image
 class pin64_writer_t {
 public:
 	static void write(FILE* file, pin64_t* capture);
 	static void write(FILE* file, pin64_block_t* capture);
 	static void write(FILE* file, uint32_t data);
+	static void write(FILE* file, uint64_t data);
 	static void write(FILE* file, const uint8_t* data, uint32_t size);
 
+	// file positions are 64-bit, so that captures past 2 GiB don't wrap
+	// where long is 32 bits
+	static bool seek(FILE* file, uint64_t offset);
+	static uint64_t tell(FILE* file);
+
+	static void write(pin64_data_t* image, pin64_t* capture);
+	static void write(pin64_data_t* image, pin64_block_t* capture);
+	static void write(pin64_data_t* image, uint32_t data);
+	static void write(pin64_data_t* image, uint64_t data);
+	static void write(pin64_data_t* image, const uint8_t* data, uint32_t size);
+
+	// streaming captures: header placeholder up front, blocks appended as
+	// they are flushed, then the directories and the final header that
+	// replaces the placeholder
+	static void write_stream_header(pin64_data_t* image);
+	static void write_stream_trailer(pin64_data_t* trailer, pin64_data_t* header, pin64_t* capture);
+
+	// manifests keep a capture's frame, command, meta, keyframe and frame
+	// hash lists and name the pack that holds its blocks
+	static void write_manifest(FILE* file, pin64_t* capture, const char* pack_name);
+
+	// version-2 layout; the image is sized up front and block payloads are
+	// copied into it in parallel
+	static void write_v2(pin64_data_t* image, pin64_t* capture);
+
 private:
-	static void write_data_directory(FILE* file, pin64_t* capture);
-	static void write_cmdlist_directory(FILE* file, pin64_t* capture);
+	template <typename T> static void write_capture(T* out, pin64_t* capture);
+	template <typename T> static void write_block(T* out, pin64_block_t* block);
+	template <typename T> static void write_header(T* out, uint32_t size_total, uint32_t block_dir_start, uint32_t cmdlist_dir_start, uint32_t blocks_start, uint32_t cmdlist_start, uint32_t metas_start, uint32_t keyframes_start, uint32_t frame_ranges_start, uint32_t frame_hashes_start);
+	template <typename T> static void write_data_directory(T* out, const std::vector<uint32_t>& offsets);
+	template <typename T> static void write_cmdlist_directory(T* out, pin64_t* capture);
+	template <typename T> static void write_id_list(T* out, const uint8_t* id, const std::vector<uint64_t>& list);
+	template <typename T> static void write_keyframes(T* out, pin64_t* capture);
+	template <typename T> static void write_frame_ranges(T* out, pin64_t* capture);
+	template <typename T> static void write_frame_hashes(T* out, pin64_t* capture);
+
+	// blocks are laid out in the order playback first uses them, grouped
+	// by frame; frame_ends holds the end of each frame's group in blocks
+	static void order_blocks(pin64_t* capture, std::vector<pin64_block_t*>& blocks, std::vector<size_t>& frame_ends);
+	static void place_block(pin64_t* capture, pin64_hash_table_t<uint8_t>& placed, std::vector<pin64_block_t*>& blocks, uint64_t id);
+	static void set_frame_ranges(pin64_t* capture, const std::vector<size_t>& frame_ends, const std::vector<uint64_t>& offsets, uint64_t blocks_end);
 };
 
 #endif // PIN64_WRITER_H
\ No newline at end of file
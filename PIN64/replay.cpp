@@ -0,0 +1,468 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+// headless replay of captures through the renderer, timed for benchmarking
+// renderer changes; built on its own, without SDL, by the Makefile
+
+#include "pin64/pin64.h"
+#include "video/n64.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+static const size_t RDRAM_SIZE = 8 * 1024 * 1024;
+
+// without an interval, each job gets this many ranges on average, so that a
+// job that finishes early takes over work that would otherwise be left to
+// the slowest one
+static const uint32_t RANGES_PER_JOB = 4;
+
+struct replay_options_t {
+	uint32_t first_frame;
+	uint32_t frame_count; // 0 plays to the end
+	uint32_t warmup;
+	uint32_t repeat;
+	uint32_t threads;
+	uint32_t jobs; // 0 replays serially, without checkpoints
+	uint32_t checkpoint_interval; // 0 derives it from the number of jobs
+	bool streaming;
+};
+
+struct replay_result_t {
+	std::string path;
+	std::string error;
+	uint32_t first_frame;
+	uint32_t frames;
+	uint64_t commands;
+	std::vector<double> seconds;
+
+	// parallel replay only: the sequential pass that took the checkpoints,
+	// and the distinct blocks they hold
+	uint32_t checkpoint_interval;
+	uint32_t checkpoints;
+	double checkpoint_seconds;
+	size_t checkpoint_bytes;
+};
+
+// renderer state at the start of a frame; pages that didn't change since
+// the previous checkpoint are shared with it rather than copied
+struct replay_checkpoint_t {
+	uint32_t frame;
+	uint32_t end_frame;
+	std::vector<pin64_block_t*> blocks;
+	uint64_t end_hash; // rdram and hidden bits at end_frame
+};
+
+// plays whole frames until the capture reaches end_frame or stops; returns
+// the number of commands executed
+static uint64_t run_frames(pin64_t& capture, n64_rdp& rdp, uint32_t end_frame) {
+	running_machine machine;
+	uint64_t commands = 0;
+	while (capture.playing() && capture.current_frame() < end_frame) {
+		commands += rdp.process_command_list();
+		capture.mark_frame(machine);
+	}
+	return commands;
+}
+
+static bool replay_capture(const char* path, const replay_options_t& options, replay_result_t& result) {
+	result.path = path;
+	result.first_frame = options.first_frame;
+	result.frames = 0;
+	result.commands = 0;
+	result.checkpoint_interval = 0;
+	result.checkpoints = 0;
+	result.checkpoint_seconds = 0.0;
+	result.checkpoint_bytes = 0;
+
+	// the renderer is attached before play() so that every pass can rewind
+	// to the same starting state
+	pin64_t capture;
+	std::unique_ptr<uint32_t[]> rdram(new uint32_t[RDRAM_SIZE / 4]());
+	std::unique_ptr<n64_rdp> rdp(new n64_rdp(rdram.get()));
+	rdp->init_internal_state(&capture);
+	rdp->set_threads(options.threads);
+
+	capture.play(path, options.streaming);
+	if (!capture.playing()) {
+		result.error = "unable to load capture";
+		return false;
+	}
+
+	const uint32_t frame_count = (uint32_t)capture.frames().size();
+	if (options.first_frame >= frame_count) {
+		result.error = "first frame is past the end of the capture";
+		return false;
+	}
+
+	const uint32_t end_frame = (options.frame_count == 0 || options.frame_count > frame_count - options.first_frame) ? frame_count : options.first_frame + options.frame_count;
+	result.frames = end_frame - options.first_frame;
+
+	for (uint32_t pass = 0; pass < options.warmup + options.repeat; pass++) {
+		if (pass > 0) {
+			capture.stop();
+			if (!capture.rewind()) {
+				result.error = "unable to rewind capture";
+				return false;
+			}
+		}
+
+		// frames ahead of the range aren't timed; keyframes let a capture
+		// skip most of them
+		if (options.first_frame > 0 && !capture.seek(options.first_frame))
+			run_frames(capture, *rdp, options.first_frame);
+
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		const uint64_t commands = run_frames(capture, *rdp, end_frame);
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		// playback only stops early if a frame couldn't be read
+		if (capture.current_frame() < end_frame) {
+			result.error = "playback stopped at frame " + std::to_string(capture.current_frame());
+			return false;
+		}
+
+		if (pass >= options.warmup) {
+			result.commands = commands;
+			result.seconds.push_back(elapsed.count());
+		}
+	}
+
+	return true;
+}
+
+// plays the range serially, saving a checkpoint at the start of every
+// interval, and the hash of the memory each range leaves behind
+static bool take_checkpoints(pin64_t& capture, n64_rdp& rdp, uint32_t end_frame, uint32_t interval,
+	std::vector<replay_checkpoint_t>& checkpoints, std::vector<std::unique_ptr<pin64_block_t>>& pool, replay_result_t& result) {
+	std::unordered_map<uint32_t, pin64_block_t*> pages;
+
+	while (capture.playing() && capture.current_frame() < end_frame) {
+		replay_checkpoint_t checkpoint;
+		checkpoint.frame = capture.current_frame();
+		checkpoint.end_frame = std::min(end_frame, checkpoint.frame + interval);
+
+		std::vector<pin64_block_t*> blocks;
+		rdp.save_keyframe(blocks);
+		for (size_t i = 0; i < blocks.size(); i++) {
+			pin64_data_t* data = blocks[i]->data();
+
+			// the first block holds the registers and TMEM, and always changes
+			if (i > 0) {
+				const uint32_t tag = data->get32(0);
+				std::unordered_map<uint32_t, pin64_block_t*>::iterator it = pages.find(tag);
+				if (it != pages.end() && it->second->data()->size() == data->size() && memcmp(it->second->data()->bytes(), data->bytes(), data->size()) == 0) {
+					checkpoint.blocks.push_back(it->second);
+					delete blocks[i];
+					continue;
+				}
+				pages[tag] = blocks[i];
+			}
+
+			result.checkpoint_bytes += data->size();
+			pool.emplace_back(blocks[i]);
+			checkpoint.blocks.push_back(blocks[i]);
+		}
+
+		run_frames(capture, rdp, checkpoint.end_frame);
+		if (capture.current_frame() < checkpoint.end_frame) {
+			result.error = "playback stopped at frame " + std::to_string(capture.current_frame());
+			return false;
+		}
+
+		checkpoint.end_hash = rdp.frame_hash();
+		checkpoints.push_back(checkpoint);
+	}
+
+	return true;
+}
+
+// each job has its own capture and renderer, and takes the next range not
+// yet played until none are left; ranges are restored from their checkpoint
+// and cued to its frame, so nothing before them is replayed
+struct replay_job_t {
+	pin64_t capture;
+	std::unique_ptr<uint32_t[]> rdram;
+	std::unique_ptr<n64_rdp> rdp;
+	uint64_t commands;
+	std::string error;
+};
+
+static void run_job(replay_job_t& job, std::vector<replay_checkpoint_t>& checkpoints, std::atomic<size_t>& next) {
+	for (size_t index = next++; index < checkpoints.size() && job.error.empty(); index = next++) {
+		replay_checkpoint_t& checkpoint = checkpoints[index];
+
+		job.capture.stop();
+		if (!job.rdp->load_keyframe(checkpoint.blocks) || !job.capture.cue(checkpoint.frame)) {
+			job.error = "unable to restore the checkpoint at frame " + std::to_string(checkpoint.frame);
+			break;
+		}
+
+		job.commands += run_frames(job.capture, *job.rdp, checkpoint.end_frame);
+		if (job.capture.current_frame() < checkpoint.end_frame)
+			job.error = "playback stopped at frame " + std::to_string(job.capture.current_frame());
+		else if (job.rdp->frame_hash() != checkpoint.end_hash)
+			job.error = "frames " + std::to_string(checkpoint.frame) + " to " + std::to_string(checkpoint.end_frame - 1) + " render differently in parallel";
+	}
+}
+
+static bool replay_capture_parallel(const char* path, const replay_options_t& options, replay_result_t& result) {
+	result.path = path;
+	result.first_frame = options.first_frame;
+	result.frames = 0;
+	result.commands = 0;
+	result.checkpoint_interval = 0;
+	result.checkpoints = 0;
+	result.checkpoint_seconds = 0.0;
+	result.checkpoint_bytes = 0;
+
+	// checkpoints are only held in memory; the capture itself is never written
+	pin64_t capture;
+	std::unique_ptr<uint32_t[]> rdram(new uint32_t[RDRAM_SIZE / 4]());
+	std::unique_ptr<n64_rdp> rdp(new n64_rdp(rdram.get()));
+	rdp->init_internal_state(&capture);
+	rdp->set_threads(options.threads);
+
+	capture.play(path, options.streaming);
+	if (!capture.playing()) {
+		result.error = "unable to load capture";
+		return false;
+	}
+
+	const uint32_t frame_count = (uint32_t)capture.frames().size();
+	if (options.first_frame >= frame_count) {
+		result.error = "first frame is past the end of the capture";
+		return false;
+	}
+
+	const uint32_t end_frame = (options.frame_count == 0 || options.frame_count > frame_count - options.first_frame) ? frame_count : options.first_frame + options.frame_count;
+	result.frames = end_frame - options.first_frame;
+
+	const uint32_t ranges = options.jobs * RANGES_PER_JOB;
+	result.checkpoint_interval = options.checkpoint_interval ? options.checkpoint_interval : std::max(1u, (result.frames + ranges - 1) / ranges);
+
+	if (options.first_frame > 0 && !capture.seek(options.first_frame))
+		run_frames(capture, *rdp, options.first_frame);
+
+	std::vector<replay_checkpoint_t> checkpoints;
+	std::vector<std::unique_ptr<pin64_block_t>> pool;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const bool taken = take_checkpoints(capture, *rdp, end_frame, result.checkpoint_interval, checkpoints, pool, result);
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	if (!taken)
+		return false;
+
+	result.checkpoints = (uint32_t)checkpoints.size();
+	result.checkpoint_seconds = elapsed.count();
+
+	// jobs are set up ahead of the timed passes, as loading a capture is
+	// not part of replaying it
+	std::vector<std::unique_ptr<replay_job_t>> jobs;
+	for (uint32_t i = 0; i < options.jobs; i++) {
+		std::unique_ptr<replay_job_t> job(new replay_job_t());
+		job->rdram.reset(new uint32_t[RDRAM_SIZE / 4]());
+		job->rdp.reset(new n64_rdp(job->rdram.get()));
+		job->rdp->init_internal_state(&job->capture);
+		job->rdp->set_threads(options.threads);
+
+		job->capture.play(path, options.streaming);
+		if (!job->capture.playing()) {
+			result.error = "unable to load capture";
+			return false;
+		}
+		jobs.push_back(std::move(job));
+	}
+
+	for (uint32_t pass = 0; pass < options.warmup + options.repeat; pass++) {
+		std::atomic<size_t> next(0);
+		std::vector<std::thread> threads;
+
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (std::unique_ptr<replay_job_t>& job : jobs) {
+			job->commands = 0;
+			threads.emplace_back(run_job, std::ref(*job), std::ref(checkpoints), std::ref(next));
+		}
+		for (std::thread& thread : threads)
+			thread.join();
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		uint64_t commands = 0;
+		for (std::unique_ptr<replay_job_t>& job : jobs) {
+			if (!job->error.empty()) {
+				result.error = job->error;
+				return false;
+			}
+			commands += job->commands;
+		}
+
+		if (pass >= options.warmup) {
+			result.commands = commands;
+			result.seconds.push_back(elapsed.count());
+		}
+	}
+
+	return true;
+}
+
+static void write_json_string(FILE* out, const std::string& value) {
+	fputc('"', out);
+	for (char c : value) {
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if ((unsigned char)c < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char)c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void write_json(FILE* out, const replay_options_t& options, const std::vector<replay_result_t>& results) {
+	fprintf(out, "{\n  \"warmup\": %u,\n  \"repeat\": %u,\n  \"threads\": %u,\n  \"jobs\": %u,\n", options.warmup, options.repeat, options.threads, options.jobs);
+	fprintf(out, "  \"streaming\": %s,\n  \"captures\": [", options.streaming ? "true" : "false");
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const replay_result_t& result = results[i];
+		fprintf(out, "%s\n    {\n      \"path\": ", (i > 0) ? "," : "");
+		write_json_string(out, result.path);
+
+		if (!result.error.empty()) {
+			fprintf(out, ",\n      \"error\": ");
+			write_json_string(out, result.error);
+			fprintf(out, "\n    }");
+			continue;
+		}
+
+		// rates are taken from the median pass, which is the least affected
+		// by the occasional slow one
+		std::vector<double> sorted = result.seconds;
+		std::sort(sorted.begin(), sorted.end());
+		const size_t count = sorted.size();
+		const double median = (count % 2) ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) * 0.5;
+		double total = 0.0;
+		for (double seconds : sorted)
+			total += seconds;
+
+		fprintf(out, ",\n      \"first_frame\": %u,\n      \"frames\": %u,\n      \"commands\": %llu,\n      \"seconds\": [",
+			result.first_frame, result.frames, (unsigned long long)result.commands);
+		for (size_t j = 0; j < count; j++)
+			fprintf(out, "%s%.6f", (j > 0) ? ", " : "", result.seconds[j]);
+		fprintf(out, "],\n");
+		if (options.jobs > 0) {
+			fprintf(out, "      \"checkpoint_interval\": %u,\n      \"checkpoints\": %u,\n      \"checkpoint_seconds\": %.6f,\n      \"checkpoint_bytes\": %llu,\n",
+				result.checkpoint_interval, result.checkpoints, result.checkpoint_seconds, (unsigned long long)result.checkpoint_bytes);
+		}
+		fprintf(out, "      \"min_seconds\": %.6f,\n      \"median_seconds\": %.6f,\n      \"mean_seconds\": %.6f,\n", sorted[0], median, total / count);
+		fprintf(out, "      \"frames_per_second\": %.3f,\n      \"commands_per_second\": %.1f\n    }",
+			(median > 0.0) ? result.frames / median : 0.0, (median > 0.0) ? result.commands / median : 0.0);
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+}
+
+static void usage() {
+	fprintf(stderr, "usage: pin64-replay [--first <frame>] [--frames <n>] [--warmup <n>] [--repeat <n>] [--threads <n>]\n");
+	fprintf(stderr, "                    [--jobs <n>] [--checkpoint <frames>] [--stream] [--output <file>] <capture>...\n");
+}
+
+int main(int argc, char** argv) {
+	replay_options_t options = { 0, 0, 1, 3, 1, 0, 0, false };
+	const char* output = nullptr;
+	std::vector<const char*> paths;
+
+	for (int i = 1; i < argc; i++) {
+		const std::string option = argv[i];
+		if (option.compare(0, 2, "--") != 0) {
+			paths.push_back(argv[i]);
+			continue;
+		}
+
+		if (option == "--stream") {
+			options.streaming = true;
+			continue;
+		}
+
+		const char* value = (i + 1 < argc) ? argv[++i] : nullptr;
+		if (!value) {
+			fprintf(stderr, "Missing value for %s.\n", option.c_str());
+			return 1;
+		}
+
+		if (option == "--first") {
+			options.first_frame = (uint32_t)strtoul(value, nullptr, 0);
+		} else if (option == "--frames") {
+			options.frame_count = (uint32_t)strtoul(value, nullptr, 0);
+		} else if (option == "--warmup") {
+			options.warmup = (uint32_t)strtoul(value, nullptr, 0);
+		} else if (option == "--repeat") {
+			options.repeat = (uint32_t)strtoul(value, nullptr, 0);
+			if (options.repeat == 0) {
+				fprintf(stderr, "At least one timed pass is needed.\n");
+				return 1;
+			}
+		} else if (option == "--threads") {
+			options.threads = (uint32_t)strtoul(value, nullptr, 0);
+			if (options.threads == 0) {
+				fprintf(stderr, "At least one thread is needed.\n");
+				return 1;
+			}
+		} else if (option == "--jobs") {
+			options.jobs = (uint32_t)strtoul(value, nullptr, 0);
+		} else if (option == "--checkpoint") {
+			options.checkpoint_interval = (uint32_t)strtoul(value, nullptr, 0);
+			if (options.checkpoint_interval == 0) {
+				fprintf(stderr, "Checkpoints need an interval of at least one frame.\n");
+				return 1;
+			}
+		} else if (option == "--output") {
+			output = value;
+		} else {
+			fprintf(stderr, "Unknown option %s.\n", option.c_str());
+			return 1;
+		}
+	}
+
+	if (paths.empty()) {
+		usage();
+		return 1;
+	}
+
+	// the renderer and capture code report problems on stdout, so they are
+	// sent to stderr to keep the results parseable
+	FILE* out = nullptr;
+	if (output) {
+		out = fopen(output, "w");
+		if (!out) {
+			fprintf(stderr, "Unable to open file %s for writing.\n", output);
+			return 1;
+		}
+	} else {
+		fflush(stdout);
+		out = fdopen(dup(STDOUT_FILENO), "w");
+	}
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+
+	std::vector<replay_result_t> results(paths.size());
+	bool ok = true;
+	for (size_t i = 0; i < paths.size(); i++) {
+		const bool replayed = (options.jobs > 0) ? replay_capture_parallel(paths[i], options, results[i]) : replay_capture(paths[i], options, results[i]);
+		if (!replayed) {
+			fprintf(stderr, "%s: %s.\n", paths[i], results[i].error.c_str());
+			ok = false;
+		}
+	}
+
+	write_json(out, options, results);
+	fclose(out);
+
+	return ok ? 0 : 1;
+}
@@ -28,9 +28,11 @@ TODO:
 #include "n64.h"
 #include "rdpblend.h"
 #include "rdptpipe.h"
+#include "rdpbands.h"
 #include "../Logger.h"
 
 #include <algorithm>
+#include <cmath>
 
 #define LOG_RDP_EXECUTION       0
 
@@ -759,7 +761,7 @@ void n64_rdp::get_dither_values(int32_t x, int32_t y, int32_t* cdith, int32_t* a
 		break;
 	case 2:
 		*cdith = s_magic_matrix[dithindex];
-		*adith = rand() & 7;
+		*adith = noise() & 7;
 		break;
 	case 3:
 		*cdith = s_magic_matrix[dithindex];
@@ -774,26 +776,26 @@ void n64_rdp::get_dither_values(int32_t x, int32_t y, int32_t* cdith, int32_t* a
 		break;
 	case 6:
 		*cdith = s_bayer_matrix[dithindex];
-		*adith = rand() & 7;
+		*adith = noise() & 7;
 		break;
 	case 7:
 		*cdith = s_bayer_matrix[dithindex];
 		*adith = 0;
 		break;
 	case 8:
-		*cdith = rand() & 7;
+		*cdith = noise() & 7;
 		*adith = s_magic_matrix[dithindex];
 		break;
 	case 9:
-		*cdith = rand() & 7;
+		*cdith = noise() & 7;
 		*adith = (~s_magic_matrix[dithindex]) & 7;
 		break;
 	case 10:
-		*cdith = rand() & 7;
+		*cdith = noise() & 7;
 		*adith = (*cdith + 17) & 7;
 		break;
 	case 11:
-		*cdith = rand() & 7;
+		*cdith = noise() & 7;
 		*adith = 0;
 		break;
 	case 12:
@@ -806,7 +808,7 @@ void n64_rdp::get_dither_values(int32_t x, int32_t y, int32_t* cdith, int32_t* a
 		break;
 	case 14:
 		*cdith = 0;
-		*adith = rand() & 7;
+		*adith = noise() & 7;
 		break;
 	case 15:
 		*adith = *cdith = 0;
@@ -1924,7 +1926,8 @@ void n64_rdp::draw_triangle(bool shade, bool texture, bool zbuffer, bool rect) {
 		}
 
 		if (spix == 3) {
-			if (spanidx >= m_scissor.m_yh && spanidx < m_scissor.m_yl) {
+			if (spanidx >= m_scissor.m_yh && spanidx < m_scissor.m_yl && band_owns(spanidx) && m_spans_drawn++ < m_span_limit && m_spans_drawn > m_span_first) {
+				begin_span(spanidx);
 				switch (m_other_modes.cycle_type) {
 				case CYCLE_TYPE_1:
 					span_draw_1cycle(spanidx, flip, tilenum);
@@ -2185,16 +2188,33 @@ void n64_rdp::cmd_load_tlut(uint64_t w1) {
 	n64_tile_t* tile = m_tiles;
 
 	const int32_t tilenum = (w1 >> 24) & 0x7;
-	const int32_t sl = tile[tilenum].sl = int32_t(w1 >> 44) & 0xfff;
+	tile[tilenum].sl = int32_t(w1 >> 44) & 0xfff;
 	const int32_t tl = tile[tilenum].tl = int32_t(w1 >> 32) & 0xfff;
-	const int32_t sh = tile[tilenum].sh = int32_t(w1 >> 12) & 0xfff;
+	tile[tilenum].sh = int32_t(w1 >> 12) & 0xfff;
 	const int32_t th = tile[tilenum].th = int32_t(w1 >> 0) & 0xfff;
 
 	if (tl != th) {
 		printf("Load tlut: tl=%d, th=%d\n", tl, th);
 	}
 
-	m_capture->data_begin();
+	if (m_capture)
+		m_capture->data_begin();
+	load_tmem(w1, &n64_rdp::load_tlut_data);
+	if (m_capture)
+		m_capture->data_end();
+	data_block()->reset();
+
+	m_tiles[tilenum].sth = rgbaint_t(m_tiles[tilenum].sh, m_tiles[tilenum].sh, m_tiles[tilenum].th, m_tiles[tilenum].th);
+	m_tiles[tilenum].stl = rgbaint_t(m_tiles[tilenum].sl, m_tiles[tilenum].sl, m_tiles[tilenum].tl, m_tiles[tilenum].tl);
+}
+
+void n64_rdp::load_tlut_data(uint64_t w1, uint8_t* tmem) {
+	n64_tile_t* tile = m_tiles;
+
+	const int32_t tilenum = (w1 >> 24) & 0x7;
+	const int32_t sl = tile[tilenum].sl;
+	const int32_t tl = tile[tilenum].tl;
+	const int32_t sh = tile[tilenum].sh;
 
 	const int32_t count = ((sh >> 2) - (sl >> 2) + 1) << 2;
 
@@ -2206,11 +2226,11 @@ void n64_rdp::cmd_load_tlut(uint64_t w1) {
 		}
 		int32_t srcstart = (m_misc_state.m_ti_address + (tl >> 2) * (m_misc_state.m_ti_width << 1) + (sl >> 1)) >> 1;
 		int32_t dststart = tile[tilenum].tmem << 2;
-		uint16_t* dst = get_tmem16();
+		uint16_t* dst = (uint16_t*)tmem;
 
 		for (int32_t i = 0; i < count; i += 4) {
 			if (dststart < 2048) {
-				dst[dststart] = m_capture->data_block()->get16();
+				dst[dststart] = data_block()->get16();
 				dst[dststart + 1] = dst[dststart];
 				dst[dststart + 2] = dst[dststart];
 				dst[dststart + 3] = dst[dststart];
@@ -2224,12 +2244,6 @@ void n64_rdp::cmd_load_tlut(uint64_t w1) {
 		printf("RDP: load_tlut: size = %d\n", m_misc_state.m_ti_size);
 		break;
 	}
-
-	m_capture->data_end();
-	m_capture->data_block()->reset();
-
-	m_tiles[tilenum].sth = rgbaint_t(m_tiles[tilenum].sh, m_tiles[tilenum].sh, m_tiles[tilenum].th, m_tiles[tilenum].th);
-	m_tiles[tilenum].stl = rgbaint_t(m_tiles[tilenum].sl, m_tiles[tilenum].sl, m_tiles[tilenum].tl, m_tiles[tilenum].tl);
 }
 
 void n64_rdp::cmd_set_tile_size(uint64_t w1) {
@@ -2251,17 +2265,37 @@ void n64_rdp::cmd_load_block(uint64_t w1) {
 	n64_tile_t* tile = m_tiles;
 
 	const int32_t tilenum = int32_t(w1 >> 24) & 0x7;
-	uint16_t* tc = get_tmem16();
 
-	int32_t sl = tile[tilenum].sl = int32_t(w1 >> 44) & 0xfff;
-	int32_t tl = tile[tilenum].tl = int32_t(w1 >> 32) & 0xfff;
-	int32_t sh = tile[tilenum].sh = int32_t(w1 >> 12) & 0xfff;
-	const int32_t dxt = int32_t(w1 >> 0) & 0xfff;
+	const int32_t sl = tile[tilenum].sl = int32_t(w1 >> 44) & 0xfff;
+	tile[tilenum].tl = int32_t(w1 >> 32) & 0xfff;
+	const int32_t sh = tile[tilenum].sh = int32_t(w1 >> 12) & 0xfff;
 
 	if (sh < sl) {
 		printf("load_block: sh < sl\n");
 	}
 
+	if (m_capture)
+		m_capture->data_begin();
+	load_tmem(w1, &n64_rdp::load_block_data);
+	if (m_capture)
+		m_capture->data_end();
+	data_block()->reset();
+
+	m_tiles[tilenum].sth = rgbaint_t(m_tiles[tilenum].sh, m_tiles[tilenum].sh, m_tiles[tilenum].th, m_tiles[tilenum].th);
+	m_tiles[tilenum].stl = rgbaint_t(m_tiles[tilenum].sl, m_tiles[tilenum].sl, m_tiles[tilenum].tl, m_tiles[tilenum].tl);
+}
+
+void n64_rdp::load_block_data(uint64_t w1, uint8_t* tmem) {
+	n64_tile_t* tile = m_tiles;
+
+	const int32_t tilenum = int32_t(w1 >> 24) & 0x7;
+	uint16_t* tc = (uint16_t*)tmem;
+
+	const int32_t sl = tile[tilenum].sl;
+	const int32_t tl = tile[tilenum].tl;
+	const int32_t sh = tile[tilenum].sh;
+	const int32_t dxt = int32_t(w1 >> 0) & 0xfff;
+
 	int32_t width = (sh - sl) + 1;
 
 	width = (width << m_misc_state.m_ti_size) >> 1;
@@ -2277,8 +2311,6 @@ void n64_rdp::cmd_load_block(uint64_t w1) {
 
 	const uint32_t src = (m_misc_state.m_ti_address >> 1) + (tl * tiwinwords) + slinwords;
 
-	m_capture->data_begin();
-
 	if (dxt != 0) {
 		int32_t j = 0;
 		int32_t t = 0;
@@ -2295,10 +2327,10 @@ void n64_rdp::cmd_load_block(uint64_t w1) {
 				int32_t ptr = tb + (i << 2);
 				int32_t srcptr = src + (i << 2);
 
-				tc[(ptr ^ t) & 0x7ff] = m_capture->data_block()->get16();
-				tc[((ptr + 1) ^ t) & 0x7ff] = m_capture->data_block()->get16();
-				tc[((ptr + 2) ^ t) & 0x7ff] = m_capture->data_block()->get16();
-				tc[((ptr + 3) ^ t) & 0x7ff] = m_capture->data_block()->get16();
+				tc[(ptr ^ t) & 0x7ff] = data_block()->get16();
+				tc[((ptr + 1) ^ t) & 0x7ff] = data_block()->get16();
+				tc[((ptr + 2) ^ t) & 0x7ff] = data_block()->get16();
+				tc[((ptr + 3) ^ t) & 0x7ff] = data_block()->get16();
 
 				j += dxt;
 			}
@@ -2313,14 +2345,14 @@ void n64_rdp::cmd_load_block(uint64_t w1) {
 				int32_t ptr = ((tb + (i << 1)) ^ t) & 0x3ff;
 				int32_t srcptr = src + (i << 2);
 
-				int32_t first = m_capture->data_block()->get16();
-				int32_t sec = m_capture->data_block()->get16();
+				int32_t first = data_block()->get16();
+				int32_t sec = data_block()->get16();
 				tc[ptr] = ((first >> 8) << 8) | (sec >> 8);
 				tc[ptr | 0x400] = ((first & 0xff) << 8) | (sec & 0xff);
 
 				ptr = ((tb + (i << 1) + 1) ^ t) & 0x3ff;
-				first = m_capture->data_block()->get16();
-				sec = m_capture->data_block()->get16();
+				first = data_block()->get16();
+				sec = data_block()->get16();
 				tc[ptr] = ((first >> 8) << 8) | (sec >> 8);
 				tc[ptr | 0x400] = ((first & 0xff) << 8) | (sec & 0xff);
 
@@ -2335,12 +2367,12 @@ void n64_rdp::cmd_load_block(uint64_t w1) {
 
 				int32_t ptr = ((tb + (i << 1)) ^ t) & 0x3ff;
 				int32_t srcptr = src + (i << 2);
-				tc[ptr] = m_capture->data_block()->get16();
-				tc[ptr | 0x400] = m_capture->data_block()->get16();
+				tc[ptr] = data_block()->get16();
+				tc[ptr | 0x400] = data_block()->get16();
 
 				ptr = ((tb + (i << 1) + 1) ^ t) & 0x3ff;
-				tc[ptr] = m_capture->data_block()->get16();
-				tc[ptr | 0x400] = m_capture->data_block()->get16();
+				tc[ptr] = data_block()->get16();
+				tc[ptr | 0x400] = data_block()->get16();
 
 				j += dxt;
 			}
@@ -2351,23 +2383,23 @@ void n64_rdp::cmd_load_block(uint64_t w1) {
 			for (int32_t i = 0; i < width; i++) {
 				int32_t ptr = tb + (i << 2);
 				int32_t srcptr = src + (i << 2);
-				tc[(ptr ^ WORD_ADDR_XOR) & 0x7ff] = m_capture->data_block()->get16();
-				tc[((ptr + 1) ^ WORD_ADDR_XOR) & 0x7ff] = m_capture->data_block()->get16();
-				tc[((ptr + 2) ^ WORD_ADDR_XOR) & 0x7ff] = m_capture->data_block()->get16();
-				tc[((ptr + 3) ^ WORD_ADDR_XOR) & 0x7ff] = m_capture->data_block()->get16();
+				tc[(ptr ^ WORD_ADDR_XOR) & 0x7ff] = data_block()->get16();
+				tc[((ptr + 1) ^ WORD_ADDR_XOR) & 0x7ff] = data_block()->get16();
+				tc[((ptr + 2) ^ WORD_ADDR_XOR) & 0x7ff] = data_block()->get16();
+				tc[((ptr + 3) ^ WORD_ADDR_XOR) & 0x7ff] = data_block()->get16();
 			}
 		} else if (tile[tilenum].format == FORMAT_YUV) {
 			for (int32_t i = 0; i < width; i++) {
 				int32_t ptr = ((tb + (i << 1)) ^ WORD_ADDR_XOR) & 0x3ff;
 				int32_t srcptr = src + (i << 2);
-				int32_t first = m_capture->data_block()->get16();
-				int32_t sec = m_capture->data_block()->get16();
+				int32_t first = data_block()->get16();
+				int32_t sec = data_block()->get16();
 				tc[ptr] = ((first >> 8) << 8) | (sec >> 8);//UV pair
 				tc[ptr | 0x400] = ((first & 0xff) << 8) | (sec & 0xff);
 
 				ptr = ((tb + (i << 1) + 1) ^ WORD_ADDR_XOR) & 0x3ff;
-				first = m_capture->data_block()->get16();
-				sec = m_capture->data_block()->get16();
+				first = data_block()->get16();
+				sec = data_block()->get16();
 				tc[ptr] = ((first >> 8) << 8) | (sec >> 8);
 				tc[ptr | 0x400] = ((first & 0xff) << 8) | (sec & 0xff);
 			}
@@ -2375,22 +2407,16 @@ void n64_rdp::cmd_load_block(uint64_t w1) {
 			for (int32_t i = 0; i < width; i++) {
 				int32_t ptr = ((tb + (i << 1)) ^ WORD_ADDR_XOR) & 0x3ff;
 				int32_t srcptr = src + (i << 2);
-				tc[ptr] = m_capture->data_block()->get16();
-				tc[ptr | 0x400] = m_capture->data_block()->get16();
+				tc[ptr] = data_block()->get16();
+				tc[ptr | 0x400] = data_block()->get16();
 
 				ptr = ((tb + (i << 1) + 1) ^ WORD_ADDR_XOR) & 0x3ff;
-				tc[ptr] = m_capture->data_block()->get16();
-				tc[ptr | 0x400] = m_capture->data_block()->get16();
+				tc[ptr] = data_block()->get16();
+				tc[ptr | 0x400] = data_block()->get16();
 			}
 		}
 		tile[tilenum].th = tl;
 	}
-
-	m_capture->data_end();
-	m_capture->data_block()->reset();
-
-	m_tiles[tilenum].sth = rgbaint_t(m_tiles[tilenum].sh, m_tiles[tilenum].sh, m_tiles[tilenum].th, m_tiles[tilenum].th);
-	m_tiles[tilenum].stl = rgbaint_t(m_tiles[tilenum].sl, m_tiles[tilenum].sl, m_tiles[tilenum].tl, m_tiles[tilenum].tl);
 }
 
 void n64_rdp::cmd_load_tile(uint64_t w1) {
@@ -2403,6 +2429,21 @@ void n64_rdp::cmd_load_tile(uint64_t w1) {
 	tile[tilenum].sh = int32_t(w1 >> 12) & 0xfff;
 	tile[tilenum].th = int32_t(w1 >> 0) & 0xfff;
 
+	if (m_capture)
+		m_capture->data_begin();
+	load_tmem(w1, &n64_rdp::load_tile_data);
+	if (m_capture)
+		m_capture->data_end();
+	data_block()->reset();
+
+	m_tiles[tilenum].sth = rgbaint_t(m_tiles[tilenum].sh, m_tiles[tilenum].sh, m_tiles[tilenum].th, m_tiles[tilenum].th);
+	m_tiles[tilenum].stl = rgbaint_t(m_tiles[tilenum].sl, m_tiles[tilenum].sl, m_tiles[tilenum].tl, m_tiles[tilenum].tl);
+}
+
+void n64_rdp::load_tile_data(uint64_t w1, uint8_t* tmem) {
+	n64_tile_t* tile = m_tiles;
+	const int32_t tilenum = int32_t(w1 >> 24) & 0x7;
+
 	const int32_t sl = tile[tilenum].sl >> 2;
 	const int32_t tl = tile[tilenum].tl >> 2;
 	const int32_t sh = tile[tilenum].sh >> 2;
@@ -2423,14 +2464,12 @@ void n64_rdp::cmd_load_tile(uint64_t w1) {
 	topad = 0; // ????
 	*/
 
-	m_capture->data_begin();
-
 	switch (m_misc_state.m_ti_size) {
 	case PIXEL_SIZE_8BIT:
 	{
 		const uint32_t src = m_misc_state.m_ti_address;
 		const int32_t tb = tile[tilenum].tmem << 3;
-		uint8_t* tc = get_tmem8();
+		uint8_t* tc = tmem;
 
 		for (int32_t j = 0; j < height; j++) {
 			const int32_t tline = tb + ((tile[tilenum].line << 3) * j);
@@ -2438,7 +2477,7 @@ void n64_rdp::cmd_load_tile(uint64_t w1) {
 			const int32_t xorval8 = ((j & 1) ? BYTE_XOR_DWORD_SWAP : BYTE_ADDR_XOR);
 
 			for (int32_t i = 0; i < width; i++) {
-				const uint8_t data = m_capture->data_block()->get8();
+				const uint8_t data = data_block()->get8();
 				tc[((tline + i) ^ xorval8) & 0xfff] = data;
 			}
 		}
@@ -2447,7 +2486,7 @@ void n64_rdp::cmd_load_tile(uint64_t w1) {
 	case PIXEL_SIZE_16BIT:
 	{
 		const uint32_t src = m_misc_state.m_ti_address >> 1;
-		uint16_t* tc = get_tmem16();
+		uint16_t* tc = (uint16_t*)tmem;
 
 		if (tile[tilenum].format != FORMAT_YUV) {
 			for (int32_t j = 0; j < height; j++) {
@@ -2458,7 +2497,7 @@ void n64_rdp::cmd_load_tile(uint64_t w1) {
 
 				for (int32_t i = 0; i < width; i++) {
 					const uint32_t taddr = (tline + i) ^ xorval16;
-					const uint16_t data = m_capture->data_block()->get16();
+					const uint16_t data = data_block()->get16();
 					tc[taddr & 0x7ff] = data;
 				}
 			}
@@ -2471,9 +2510,9 @@ void n64_rdp::cmd_load_tile(uint64_t w1) {
 
 				for (int32_t i = 0; i < width; i++) {
 					uint32_t taddr = ((tline + i) ^ xorval8) & 0x7ff;
-					uint16_t yuvword = m_capture->data_block()->get16();
-					get_tmem8()[taddr] = yuvword >> 8;
-					get_tmem8()[taddr | 0x800] = yuvword & 0xff;
+					uint16_t yuvword = data_block()->get16();
+					tmem[taddr] = yuvword >> 8;
+					tmem[taddr | 0x800] = yuvword & 0xff;
 				}
 			}
 		}
@@ -2483,7 +2522,7 @@ void n64_rdp::cmd_load_tile(uint64_t w1) {
 	{
 		const uint32_t src = m_misc_state.m_ti_address >> 2;
 		const int32_t tb = (tile[tilenum].tmem << 2);
-		uint16_t* tc16 = get_tmem16();
+		uint16_t* tc16 = (uint16_t*)tmem;
 
 		for (int32_t j = 0; j < height; j++) {
 			const int32_t tline = tb + ((tile[tilenum].line << 2) * j);
@@ -2491,7 +2530,7 @@ void n64_rdp::cmd_load_tile(uint64_t w1) {
 			const int32_t s = ((j + tl) * m_misc_state.m_ti_width) + sl;
 			const int32_t xorval32cur = (j & 1) ? WORD_XOR_DWORD_SWAP : WORD_ADDR_XOR;
 			for (int32_t i = 0; i < width; i++) {
-				uint32_t c = m_capture->data_block()->get32();
+				uint32_t c = data_block()->get32();
 				uint32_t ptr = ((tline + i) ^ xorval32cur) & 0x3ff;
 				tc16[ptr] = c >> 16;
 				tc16[ptr | 0x400] = c & 0xffff;
@@ -2503,12 +2542,84 @@ void n64_rdp::cmd_load_tile(uint64_t w1) {
 	default:
 		printf("RDP: load_tile: size = %d\n", m_misc_state.m_ti_size);
 	}
+}
 
-	m_capture->data_end();
-	m_capture->data_block()->reset();
+void n64_rdp::load_tmem(uint64_t w1, tmem_loader_t loader) {
+	// a load only depends on its data block, the command word and the tile
+	// and texture image parameters, so during playback the TMEM bytes it
+	// writes are built once and then copied in directly
+	const pin64_command_t* command = (m_capture == nullptr || m_capture->playing()) ? m_command : nullptr;
+	if (command == nullptr || command->data == nullptr) {
+		(this->*loader)(w1, m_tmem.get());
+		return;
+	}
 
-	m_tiles[tilenum].sth = rgbaint_t(m_tiles[tilenum].sh, m_tiles[tilenum].sh, m_tiles[tilenum].th, m_tiles[tilenum].th);
-	m_tiles[tilenum].stl = rgbaint_t(m_tiles[tilenum].sl, m_tiles[tilenum].sl, m_tiles[tilenum].tl, m_tiles[tilenum].tl);
+	const int32_t tilenum = int32_t(w1 >> 24) & 0x7;
+	const n64_tile_t& tile = m_tiles[tilenum];
+
+	n64_tmem_key_t key;
+	key.block = command->data->hash();
+	key.command = w1;
+	key.tile = ((uint64_t)(uint32_t)tile.tmem << 32) | ((uint64_t)(uint32_t)tile.line << 16) | (uint32_t)(tile.format << 8) | (uint32_t)(tile.size << 4) | m_misc_state.m_ti_size;
+
+	const uint64_t hash = pin64_hash64((const uint8_t*)&key, sizeof(key));
+
+	n64_tmem_image_t* image = nullptr;
+	uint32_t* index = m_tmem_image_index.find(hash);
+	if (index != nullptr) {
+		image = &m_tmem_images[*index];
+		if (memcmp(&image->key, &key, sizeof(key)) != 0) {
+			(this->*loader)(w1, m_tmem.get());
+			return;
+		}
+	} else {
+		if (m_tmem_images.size() >= TMEM_IMAGE_LIMIT) {
+			m_tmem_images.clear();
+			m_tmem_image_index.clear();
+		}
+		image = build_tmem_image(w1, loader, key);
+		m_tmem_image_index.insert(hash, (uint32_t)(m_tmem_images.size() - 1));
+	}
+
+	uint8_t* tmem = m_tmem.get();
+	for (const n64_tmem_span_t& span : image->spans)
+		memcpy(tmem + span.offset, &image->bytes[span.source], span.size);
+
+	m_tiles[tilenum].th = image->th;
+}
+
+n64_tmem_image_t* n64_rdp::build_tmem_image(uint64_t w1, tmem_loader_t loader, const n64_tmem_key_t& key) {
+	// run the load over two blank TMEMs with different fill values; a byte
+	// was written by the load wherever the two agree
+	std::vector<uint8_t> low(0x1000, 0x00);
+	std::vector<uint8_t> high(0x1000, 0xff);
+
+	(this->*loader)(w1, low.data());
+	data_block()->reset();
+	(this->*loader)(w1, high.data());
+
+	m_tmem_images.emplace_back();
+	n64_tmem_image_t& image = m_tmem_images.back();
+	image.key = key;
+	image.th = m_tiles[int32_t(w1 >> 24) & 0x7].th;
+
+	for (uint32_t i = 0; i < 0x1000; ) {
+		if (low[i] != high[i]) {
+			i++;
+			continue;
+		}
+
+		n64_tmem_span_t span;
+		span.offset = (uint16_t)i;
+		span.source = (uint32_t)image.bytes.size();
+		while (i < 0x1000 && low[i] == high[i])
+			image.bytes.push_back(low[i++]);
+		span.size = (uint16_t)(i - span.offset);
+
+		image.spans.push_back(span);
+	}
+
+	return &image;
 }
 
 void n64_rdp::cmd_set_tile(uint64_t w1) {
@@ -2667,12 +2778,225 @@ void n64_rdp::cmd_noop(uint64_t w1) {
 }
 
 
-void n64_rdp::process_command_list() {
+uint32_t n64_rdp::process_command_list() {
+	if (!m_workers.empty() && m_capture->playing())
+		return process_command_list_threaded();
+
+	uint32_t count = 0;
 	while (commands_available()) {
-		process_command();
+		step_command();
 		m_capture->next_command();
+		count++;
 	};
 	reset();
+	return count;
+}
+
+uint32_t n64_rdp::process_command_list_threaded() {
+	uint32_t count = 0;
+
+	// a command the debugger stopped partway through is finished first
+	if (m_step_spans > 0 && commands_available()) {
+		step_command();
+		m_capture->next_command();
+		count++;
+	}
+
+	// workers pick up from this renderer's state, which keyframes and single
+	// commands may have changed since the last list
+	for (std::unique_ptr<n64_band_worker_t>& worker : m_workers)
+		copy_state(worker->rdp());
+
+	m_band_count = threads();
+
+	while (commands_available()) {
+		const pin64_command_t* command = m_capture->native_command();
+
+		int32_t first = 0;
+		int32_t last = 0;
+		if (!draw_bands(command, first, last)) {
+			// a new color or depth image may overlap memory that other bands
+			// are still drawing to
+			if (command->opcode == 0x3e || command->opcode == 0x3f) {
+				for (std::unique_ptr<n64_band_worker_t>& worker : m_workers)
+					worker->sync();
+			}
+
+			for (std::unique_ptr<n64_band_worker_t>& worker : m_workers)
+				worker->push(command);
+			process_command();
+		} else if (m_scissor.m_xl > (int32_t)m_misc_state.m_fb_width) {
+			// spans wider than the color image run into the memory of the next
+			// scanline, so these are drawn whole once every band has caught up
+			for (std::unique_ptr<n64_band_worker_t>& worker : m_workers)
+				worker->sync();
+
+			m_band_count = 1;
+			process_command();
+			m_band_count = threads();
+		} else if (first <= last) {
+			// draws only go to the bands they cover; they leave no state behind
+			// that a later command depends on
+			const uint32_t rows = (uint32_t)((last >> BAND_SHIFT) - (first >> BAND_SHIFT)) + 1;
+			const uint32_t first_band = (uint32_t)(first >> BAND_SHIFT) % m_band_count;
+			for (uint32_t band = 0; band < m_band_count; band++) {
+				if (rows < m_band_count && (band + m_band_count - first_band) % m_band_count >= rows)
+					continue;
+
+				if (band == 0)
+					process_command();
+				else
+					m_workers[band - 1]->push(command);
+			}
+		}
+
+		m_capture->next_command();
+		count++;
+	}
+
+	for (std::unique_ptr<n64_band_worker_t>& worker : m_workers)
+		worker->sync();
+
+	m_band_count = 1;
+	reset();
+	return count;
+}
+
+// finds the scanlines a triangle or rectangle can draw to, before scissoring
+bool n64_rdp::draw_bands(const pin64_command_t* command, int32_t& first, int32_t& last) const {
+	if (command->length == 0)
+		return false;
+
+	const uint64_t w1 = command->words[0];
+	int32_t yh = 0;
+	int32_t yl = 0;
+
+	switch (command->opcode) {
+	case 0x08: case 0x09: case 0x0a: case 0x0b:
+	case 0x0c: case 0x0d: case 0x0e: case 0x0f:
+		yh = int32_t(w1 >> 0) & 0x3fff;
+		yl = int32_t(w1 >> 32) & 0x3fff;
+		if (yh & 0x2000) yh |= 0xffffc000;
+		if (yl & 0x2000) yl |= 0xffffc000;
+		break;
+
+	case 0x24: // tex_rect
+	case 0x25: // tex_rect_flip
+	case 0x36: // fill_rect
+		yh = int32_t(w1 >> 0) & 0xfff;
+		yl = int32_t(w1 >> 32) & 0xfff;
+		break;
+
+	default:
+		return false;
+	}
+
+	// nothing is drawn above the first scanline
+	first = std::max(yh >> 2, 0);
+	last = yl >> 2;
+	return true;
+}
+
+// the pixel pipeline carries values from one pixel to the next, and noise
+// continues its sequence; both start over on every scanline, so a band draws
+// the same pixels as a renderer that drew every scanline before it
+void n64_rdp::begin_span(int32_t scanline) {
+	m_noise = (uint32_t)scanline * 0x9e3779b9;
+
+	m_memory_color.set(0, 0, 0, 0);
+	m_pixel_color.set(0, 0, 0, 0);
+	m_inv_pixel_color.set(0, 0, 0, 0);
+	m_blended_pixel_color.set(0, 0, 0, 0);
+	m_combined_color.set(0, 0, 0, 0);
+	m_combined_alpha.set(0, 0, 0, 0);
+	m_texel0_color.set(0, 0, 0, 0);
+	m_texel0_alpha.set(0, 0, 0, 0);
+	m_texel1_color.set(0, 0, 0, 0);
+	m_texel1_alpha.set(0, 0, 0, 0);
+	m_next_texel_color.set(0, 0, 0, 0);
+	m_next_texel_alpha.set(0, 0, 0, 0);
+	m_shade_color.set(0, 0, 0, 0);
+	m_shade_alpha.set(0, 0, 0, 0);
+	m_noise_color.set(0, 0, 0, 0);
+	m_lod_fraction.set(0, 0, 0, 0);
+
+	m_current_pix_cvg = 0;
+	m_current_mem_cvg = 0;
+	m_current_cvg_bit = 0;
+}
+
+pin64_data_t* n64_rdp::data_block() {
+	if (m_capture)
+		return m_capture->data_block();
+
+	return (m_command && m_command->data) ? &m_command_data : &m_no_data;
+}
+
+void n64_rdp::set_threads(uint32_t count) {
+	m_workers.clear();
+	for (uint32_t band = 1; band < count; band++)
+		m_workers.push_back(std::make_unique<n64_band_worker_t>(*this, band, count));
+}
+
+void n64_rdp::init_band_worker(const n64_rdp& owner, uint32_t band, uint32_t band_count) {
+	m_band = band;
+	m_band_count = band_count;
+
+	m_tmem = std::make_unique<uint8_t[]>(0x1000);
+	memset(m_tmem.get(), 0, 0x1000);
+
+	memcpy(m_norm_point_rom, owner.m_norm_point_rom, sizeof(m_norm_point_rom));
+	memcpy(m_norm_slope_rom, owner.m_norm_slope_rom, sizeof(m_norm_slope_rom));
+
+	reset_tiles();
+}
+
+void n64_rdp::draw_step_spans(uint32_t first, uint32_t limit) {
+	m_span_first = first;
+	m_span_limit = limit;
+	process_command();
+	m_span_first = 0;
+	m_span_limit = ~0U;
+}
+
+void n64_rdp::step_command() {
+	// a command stopped partway through only draws the scanlines it has left,
+	// as no scanline depends on the ones drawn before it
+	if (m_step_spans > 0 && m_step_command == m_capture->native_command()) {
+		const uint32_t first = m_step_spans;
+		m_step_spans = 0;
+		draw_step_spans(first, ~0U);
+		return;
+	}
+	m_step_spans = 0;
+	process_command();
+}
+
+bool n64_rdp::step_scanline() {
+	const pin64_command_t* command = m_capture->native_command();
+	if (m_step_spans > 0 && m_step_command != command)
+		m_step_spans = 0;
+
+	if (m_step_spans == 0) {
+		const uint8_t opcode = command->opcode;
+		const bool draws = (opcode >= 0x08 && opcode <= 0x0f) || opcode == 0x24 || opcode == 0x25 || opcode == 0x36;
+		if (!draws) {
+			process_command();
+			return true;
+		}
+
+		m_step_command = command;
+	}
+
+	// only the next scanline is drawn; the ones before it are already in memory
+	draw_step_spans(m_step_spans, m_step_spans + 1);
+	m_step_spans++;
+
+	if (m_spans_drawn > m_step_spans)
+		return false;
+
+	m_step_spans = 0;
+	return true;
 }
 
 void n64_rdp::reset() {
@@ -2683,17 +3007,27 @@ void n64_rdp::reset() {
 }
 
 void n64_rdp::process_command() {
-	pin64_data_t* data = m_capture->command()->data();
-	const uint32_t length = data->get32(0);
+	process_command(m_capture->native_command());
+}
 
-	m_cmd_ptr = 0;
-	// load command data
-	for (uint32_t i = 0; i < length; i++) {
-		uint64_t val = data->get64(4 + i * 8);
-		m_cmd_data[m_cmd_ptr++] = val;
-	}
+void n64_rdp::process_command(const pin64_command_t* command) {
+	m_command = command;
+	if (m_capture == nullptr && command->data != nullptr)
+		m_command_data.view(command->data->data()->bytes(), command->data->data()->size());
+
+	const uint32_t length = command->length;
 
-	uint32_t cmd = (m_cmd_data[0] >> 56) & 0x3f;
+	// load command data, already decoded to host order at load time; triangles
+	// without shade, texture or depth words still read them, so the words past
+	// the command are cleared rather than left over from an earlier one
+	const uint32_t max_length = 22;
+	memcpy(m_cmd_data, command->words, length * sizeof(uint64_t));
+	if (length < max_length)
+		memset(m_cmd_data + length, 0, (max_length - length) * sizeof(uint64_t));
+	m_cmd_ptr = length;
+	m_spans_drawn = 0;
+
+	uint32_t cmd = command->opcode;
 	uint32_t cmd_length = length * 8;
 
 	// check if more data is needed
@@ -2708,7 +3042,8 @@ void n64_rdp::process_command() {
 		//fatalerror("rdp_process_list: not enough rdp command data: cur = %d, ptr = %d, expected = %d\n", m_cmd_cur, m_cmd_ptr, s_rdp_command_length[cmd]);
 	}
 
-	m_capture->command(&m_cmd_data[m_cmd_cur], s_rdp_command_length[cmd] / 8);
+	if (m_capture)
+		m_capture->command(&m_cmd_data[m_cmd_cur], s_rdp_command_length[cmd] / 8);
 
 	if (LOG_RDP_EXECUTION) {
 		char string[4000];
@@ -2773,16 +3108,350 @@ void n64_rdp::process_command() {
 
 /*****************************************************************************/
 
-n64_rdp::n64_rdp(uint32_t* rdram) {
+// keyframe state is one block of register state and TMEM, followed by one
+// block for each RDRAM or hidden-bit page that differs from the power-on
+// (zeroed) contents; pages are tagged with their region and offset, so
+// pages that don't change between keyframes share a block
+
+class n64_state_writer_t {
+public:
+	n64_state_writer_t(pin64_data_t* data) : m_data(data) { }
+
+	void item(int32_t& value) { m_data->put32((uint32_t)value); }
+	void item(uint32_t& value) { m_data->put32(value); }
+	void item(uint16_t& value) { m_data->put16(value); }
+	void item(uint8_t& value) { m_data->put8(value); }
+	void item(bool& value) { m_data->put8(value ? 1 : 0); }
+	void item(rgbaint_t& value) {
+		m_data->put32((uint32_t)value.get_a32());
+		m_data->put32((uint32_t)value.get_r32());
+		m_data->put32((uint32_t)value.get_g32());
+		m_data->put32((uint32_t)value.get_b32());
+	}
+
+private:
+	pin64_data_t* m_data;
+};
+
+class n64_state_reader_t {
+public:
+	n64_state_reader_t(pin64_data_t* data) : m_data(data) { }
+
+	void item(int32_t& value) { value = (int32_t)m_data->get32(); }
+	void item(uint32_t& value) { value = m_data->get32(); }
+	void item(uint16_t& value) { value = m_data->get16(); }
+	void item(uint8_t& value) { value = m_data->get8(); }
+	void item(bool& value) { value = m_data->get8() != 0; }
+	void item(rgbaint_t& value) {
+		const int32_t a = (int32_t)m_data->get32();
+		const int32_t r = (int32_t)m_data->get32();
+		const int32_t g = (int32_t)m_data->get32();
+		const int32_t b = (int32_t)m_data->get32();
+		value.set(a, r, g, b);
+	}
+
+private:
+	pin64_data_t* m_data;
+};
+
+class n64_state_clearer_t {
+public:
+	template <typename T> void item(T& value) { value = 0; }
+	void item(rgbaint_t& value) { value.set(0, 0, 0, 0); }
+};
+
+template <typename T>
+void n64_rdp::keyframe_items(T& state) {
+	state.item(m_misc_state.m_fb_format);
+	state.item(m_misc_state.m_fb_size);
+	state.item(m_misc_state.m_fb_width);
+	state.item(m_misc_state.m_fb_height);
+	state.item(m_misc_state.m_fb_address);
+	state.item(m_misc_state.m_zb_address);
+	state.item(m_misc_state.m_ti_format);
+	state.item(m_misc_state.m_ti_size);
+	state.item(m_misc_state.m_ti_width);
+	state.item(m_misc_state.m_ti_address);
+	state.item(m_misc_state.m_max_level);
+	state.item(m_misc_state.m_min_level);
+	state.item(m_misc_state.m_primitive_z);
+	state.item(m_misc_state.m_primitive_dz);
+
+	state.item(m_other_modes.cycle_type);
+	state.item(m_other_modes.persp_tex_en);
+	state.item(m_other_modes.detail_tex_en);
+	state.item(m_other_modes.sharpen_tex_en);
+	state.item(m_other_modes.tex_lod_en);
+	state.item(m_other_modes.en_tlut);
+	state.item(m_other_modes.tlut_type);
+	state.item(m_other_modes.sample_type);
+	state.item(m_other_modes.mid_texel);
+	state.item(m_other_modes.bi_lerp0);
+	state.item(m_other_modes.bi_lerp1);
+	state.item(m_other_modes.convert_one);
+	state.item(m_other_modes.key_en);
+	state.item(m_other_modes.rgb_dither_sel);
+	state.item(m_other_modes.alpha_dither_sel);
+	state.item(m_other_modes.blend_m1a_0);
+	state.item(m_other_modes.blend_m1a_1);
+	state.item(m_other_modes.blend_m1b_0);
+	state.item(m_other_modes.blend_m1b_1);
+	state.item(m_other_modes.blend_m2a_0);
+	state.item(m_other_modes.blend_m2a_1);
+	state.item(m_other_modes.blend_m2b_0);
+	state.item(m_other_modes.blend_m2b_1);
+	state.item(m_other_modes.tex_edge);
+	state.item(m_other_modes.force_blend);
+	state.item(m_other_modes.blend_shift);
+	state.item(m_other_modes.alpha_cvg_select);
+	state.item(m_other_modes.cvg_times_alpha);
+	state.item(m_other_modes.z_mode);
+	state.item(m_other_modes.cvg_dest);
+	state.item(m_other_modes.color_on_cvg);
+	state.item(m_other_modes.image_read_en);
+	state.item(m_other_modes.z_update_en);
+	state.item(m_other_modes.z_compare_en);
+	state.item(m_other_modes.antialias_en);
+	state.item(m_other_modes.z_source_sel);
+	state.item(m_other_modes.dither_alpha_en);
+	state.item(m_other_modes.alpha_compare_en);
+	state.item(m_other_modes.alpha_dither_mode);
+
+	state.item(m_combine.sub_a_rgb0);
+	state.item(m_combine.sub_b_rgb0);
+	state.item(m_combine.mul_rgb0);
+	state.item(m_combine.add_rgb0);
+	state.item(m_combine.sub_a_a0);
+	state.item(m_combine.sub_b_a0);
+	state.item(m_combine.mul_a0);
+	state.item(m_combine.add_a0);
+	state.item(m_combine.sub_a_rgb1);
+	state.item(m_combine.sub_b_rgb1);
+	state.item(m_combine.mul_rgb1);
+	state.item(m_combine.add_rgb1);
+	state.item(m_combine.sub_a_a1);
+	state.item(m_combine.sub_b_a1);
+	state.item(m_combine.mul_a1);
+	state.item(m_combine.add_a1);
+
+	state.item(m_blend_color);
+	state.item(m_prim_color);
+	state.item(m_prim_alpha);
+	state.item(m_env_color);
+	state.item(m_env_alpha);
+	state.item(m_fog_color);
+	state.item(m_key_scale);
+	state.item(m_prim_lod_fraction);
+	state.item(m_k023);
+	state.item(m_k1);
+	state.item(m_k4);
+	state.item(m_k5);
+	state.item(m_fill_color);
+
+	state.item(m_scissor.m_xl);
+	state.item(m_scissor.m_yl);
+	state.item(m_scissor.m_xh);
+	state.item(m_scissor.m_yh);
+
+	for (n64_tile_t& tile : m_tiles) {
+		state.item(tile.format);
+		state.item(tile.size);
+		state.item(tile.line);
+		state.item(tile.tmem);
+		state.item(tile.palette);
+		state.item(tile.ct);
+		state.item(tile.mt);
+		state.item(tile.cs);
+		state.item(tile.ms);
+		state.item(tile.mask_t);
+		state.item(tile.shift_t);
+		state.item(tile.mask_s);
+		state.item(tile.shift_s);
+		state.item(tile.lshift_s);
+		state.item(tile.rshift_s);
+		state.item(tile.lshift_t);
+		state.item(tile.rshift_t);
+		state.item(tile.wrapped_mask_s);
+		state.item(tile.wrapped_mask_t);
+		state.item(tile.clamp_s);
+		state.item(tile.clamp_t);
+		state.item(tile.mm);
+		state.item(tile.invmm);
+		state.item(tile.wrapped_mask);
+		state.item(tile.mask);
+		state.item(tile.invmask);
+		state.item(tile.lshift);
+		state.item(tile.rshift);
+		state.item(tile.sth);
+		state.item(tile.stl);
+		state.item(tile.clamp_st);
+		state.item(tile.sl);
+		state.item(tile.tl);
+		state.item(tile.sh);
+		state.item(tile.th);
+	}
+}
+
+// everything a keyframe holds starts out zeroed, so that keyframes taken
+// before the capture has set it don't depend on what memory held
+void n64_rdp::clear_registers() {
+	memset(&m_other_modes, 0, sizeof(m_other_modes));
+	memset(&m_combine, 0, sizeof(m_combine));
+	memset(&m_scissor, 0, sizeof(m_scissor));
+
+	n64_state_clearer_t clearer;
+	keyframe_items(clearer);
+}
+
+void n64_rdp::reset_tiles() {
+	for (int32_t i = 0; i < 8; i++) {
+		m_tiles[i] = n64_tile_t();
+		m_tiles[i].num = i;
+		m_tiles[i].invmm = rgbaint_t(~0, ~0, ~0, ~0);
+		m_tiles[i].invmask = rgbaint_t(~0, ~0, ~0, ~0);
+	}
+}
+
+void n64_rdp::clear_state() {
+	clear_registers();
+	reset_tiles();
+	memset(m_cmd_data, 0, sizeof(m_cmd_data));
+
+	memset(m_tmem.get(), 0, 0x1000);
+	memset(m_rdram, 0, MEM8_LIMIT + 1);
+	memset(m_hidden_bits, 0, MEM8_LIMIT + 1);
+
+	reset();
+}
+
+void n64_rdp::save_keyframe(std::vector<pin64_block_t*>& blocks) {
+	pin64_block_t* state = new pin64_block_t();
+	pin64_data_t* data = state->data();
+
+	data->put32(KEYFRAME_VERSION);
+	n64_state_writer_t writer(data);
+	keyframe_items(writer);
+	data->put(m_tmem.get(), 0x1000);
+	blocks.push_back(state);
+
+	save_keyframe_pages(blocks, KEYFRAME_REGION_RDRAM, (uint8_t*)m_rdram);
+	save_keyframe_pages(blocks, KEYFRAME_REGION_HIDDEN, m_hidden_bits);
+}
+
+void n64_rdp::save_keyframe_pages(std::vector<pin64_block_t*>& blocks, uint32_t region, uint8_t* base) {
+	static const uint8_t s_zero_page[KEYFRAME_PAGE_SIZE] = { 0 };
+
+	for (uint32_t offset = 0; offset <= MEM8_LIMIT; offset += KEYFRAME_PAGE_SIZE) {
+		if (memcmp(base + offset, s_zero_page, KEYFRAME_PAGE_SIZE) == 0)
+			continue;
+
+		pin64_block_t* page = new pin64_block_t();
+		page->data()->put32((region << 28) | offset);
+		page->data()->put(base + offset, KEYFRAME_PAGE_SIZE);
+		blocks.push_back(page);
+	}
+}
+
+bool n64_rdp::load_keyframe(std::vector<pin64_block_t*>& blocks) {
+	if (blocks.empty())
+		return false;
+
+	pin64_data_t* data = blocks[0]->data();
+	data->reset();
+	if (data->size() < 4 || data->get32() != KEYFRAME_VERSION)
+		return false;
+
+	n64_state_reader_t reader(data);
+	keyframe_items(reader);
+
+	if (data->remaining() != 0x1000)
+		return false;
+	memcpy(m_tmem.get(), data->curr(), 0x1000);
+	data->reset();
+
+	memset(m_rdram, 0, MEM8_LIMIT + 1);
+	memset(m_hidden_bits, 0, MEM8_LIMIT + 1);
+
+	for (size_t i = 1; i < blocks.size(); i++) {
+		pin64_data_t* page = blocks[i]->data();
+		if (page->size() != 4 + KEYFRAME_PAGE_SIZE)
+			return false;
+
+		// pages may be shared by players restoring at the same time, so the
+		// big-endian tag is read without moving the page's cursor
+		const uint8_t* bytes = page->bytes();
+		const uint32_t tag = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+		const uint32_t region = tag >> 28;
+		const uint32_t offset = tag & 0x0fffffff;
+		if (region > KEYFRAME_REGION_HIDDEN || offset > MEM8_LIMIT + 1 - KEYFRAME_PAGE_SIZE)
+			return false;
+
+		uint8_t* base = (region == KEYFRAME_REGION_RDRAM) ? (uint8_t*)m_rdram : m_hidden_bits;
+		memcpy(base + offset, bytes + 4, KEYFRAME_PAGE_SIZE);
+	}
+
+	reset();
+
+	return true;
+}
+
+// the same state a keyframe holds, which is everything a later command can
+// depend on besides memory
+void n64_rdp::copy_state(n64_rdp& other) {
+	pin64_data_t state;
+	n64_state_writer_t writer(&state);
+	keyframe_items(writer);
+
+	state.reset();
+	n64_state_reader_t reader(&state);
+	other.keyframe_items(reader);
+
+	memcpy(other.m_tmem.get(), m_tmem.get(), 0x1000);
+}
+
+uint64_t n64_rdp::frame_hash() {
+	const uint64_t rdram_hash = pin64_hash64((const uint8_t*)m_rdram, MEM8_LIMIT + 1);
+	return pin64_hash64(m_hidden_bits, MEM8_LIMIT + 1, rdram_hash);
+}
+
+void n64_rdp::frame_hashes(pin64_frame_hashes_t& hashes) {
+	pin64_t::hash_frame(hashes, pin64_t::FRAME_HASH_ALL, (const uint8_t*)m_rdram, m_hidden_bits, MEM8_LIMIT + 1, m_misc_state.m_zb_address,
+		m_capture->vi_control(), m_capture->vi_origin(), m_capture->vi_vstart(), m_capture->vi_yscale(), m_capture->vi_width());
+}
+
+/*****************************************************************************/
+
+n64_rdp::~n64_rdp() {
+}
+
+n64_rdp::n64_rdp(uint32_t* rdram, uint8_t* hidden_bits) {
 	ignore = false;
 	dolog = false;
 
 	m_vi_blank = false;
 	m_rdram = rdram;
 
+	m_hidden_bits = hidden_bits;
+	if (m_hidden_bits == nullptr) {
+		m_hidden_bits_storage = std::make_unique<uint8_t[]>(MEM8_LIMIT + 1);
+		m_hidden_bits = m_hidden_bits_storage.get();
+	}
+
+	m_band = 0;
+	m_band_count = 1;
+	m_command = nullptr;
+	m_capture = nullptr;
+
 	m_aux_buf_ptr = 0;
 	m_aux_buf = nullptr;
 
+	m_spans_drawn = 0;
+	m_span_first = 0;
+	m_span_limit = ~0U;
+	m_step_command = nullptr;
+	m_step_spans = 0;
+	m_noise = 0;
+
 	m_pending_mode_block = false;
 
 	m_cmd_ptr = 0;
@@ -2803,6 +3472,8 @@ n64_rdp::n64_rdp(uint32_t* rdram) {
 	m_prim_lod_fraction.set(0, 0, 0, 0);
 	z_build_com_table();
 
+	clear_registers();
+
 	memset(m_temp_rect_data, 0, sizeof(uint32_t) * 0x1000);
 
 	for (int32_t i = 0; i < 0x4000; i++) {
@@ -3141,7 +3812,7 @@ void n64_rdp::span_draw_1cycle(int32_t scanline, bool flip, int32_t tilenum) {
 			uint32_t t0a = m_texel0_color.get_a();
 			m_texel0_alpha.set(t0a, t0a, t0a, t0a);
 
-			const uint8_t noise = rand() << 3; // Not accurate
+			const uint8_t noise = this->noise() << 3; // Not accurate
 			m_noise_color.set(0, noise, noise, noise);
 
 			rgbaint_t rgbsub_a(*m_color_inputs.combiner_rgbsub_a[1]);
@@ -3339,7 +4010,7 @@ void n64_rdp::span_draw_2cycle(int32_t scanline, bool flip, int32_t tilenum) {
 			m_texel1_alpha.set(t1a, t1a, t1a, t1a);
 			m_next_texel_alpha.set(tna, tna, tna, tna);
 
-			const uint8_t noise = rand() << 3; // Not accurate
+			const uint8_t noise = this->noise() << 3; // Not accurate
 			m_noise_color.set(0, noise, noise, noise);
 
 			rgbaint_t rgbsub_a(*m_color_inputs.combiner_rgbsub_a[0]);
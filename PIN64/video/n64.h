@@ -5,10 +5,12 @@
 
 #include "../emu.h"
 #include <memory>
+#include <vector>
 #include "rdptpipe.h"
 #include "rdpblend.h"
 #include "../pin64/pin64.h"
 #include "../pin64/block.h"
+#include "../pin64/hash.h"
 
 /*****************************************************************************/
 
@@ -61,6 +63,13 @@
 
 #define RDP_RANGE_CHECK (0)
 
+#define KEYFRAME_VERSION        1
+#define KEYFRAME_PAGE_SIZE      0x1000
+#define KEYFRAME_REGION_RDRAM   0
+#define KEYFRAME_REGION_HIDDEN  1
+
+#define TMEM_IMAGE_LIMIT        0x4000
+
 #if RDP_RANGE_CHECK
 #define CHECK8(in) if(rdp_range_check((in))) { printf("Check8: Address %08x out of range!\n", (in)); fflush(stdout); fatalerror("Address %08x out of range!\n", (in)); }
 #define CHECK16(in) if(rdp_range_check((in) << 1)) { printf("Check16: Address %08x out of range!\n", (in) << 1); fflush(stdout); fatalerror("Address %08x out of range!\n", (in) << 1); }
@@ -124,6 +133,7 @@
 
 class n64_periphs;
 class n64_rdp;
+class n64_band_worker_t;
 
 #include "n64types.h"
 #include "rdpblend.h"
@@ -131,9 +141,10 @@ class n64_rdp;
 
 typedef void(*rdp_command_t)(uint64_t w1);
 
-class n64_rdp {
+class n64_rdp : public pin64_player_t {
 public:
-	n64_rdp(uint32_t* rdram);
+	n64_rdp(uint32_t* rdram) : n64_rdp(rdram, nullptr) { }
+	~n64_rdp();
 
 	void init_internal_state(pin64_t* capture) {
 		m_tmem = std::make_unique<uint8_t[]>(0x1000);
@@ -142,7 +153,14 @@ public:
 		FILE* normpoint = fopen("normpnt.rom", "rb");
 		FILE* normslope = fopen("normslp.rom", "rb");
 
-		for (int32_t i = 0; i < 64; i++) {
+		// without the ROMs the tables stay zeroed, which only affects
+		// perspective-corrected texturing
+		memset(m_norm_point_rom, 0, sizeof(m_norm_point_rom));
+		memset(m_norm_slope_rom, 0, sizeof(m_norm_slope_rom));
+		if (!normpoint || !normslope)
+			printf("Unable to open normpnt.rom and normslp.rom.\n");
+
+		for (int32_t i = 0; i < 64 && normpoint && normslope; i++) {
 			uint8_t msb = 0;
 			uint8_t lsb = 0;
 
@@ -155,29 +173,56 @@ public:
 			m_norm_slope_rom[i] = (msb << 8) | lsb;
 		}
 
-		fclose(normpoint);
-		fclose(normslope);
+		if (normpoint)
+			fclose(normpoint);
+		if (normslope)
+			fclose(normslope);
 
-		memset(m_tiles, 0, 8 * sizeof(n64_tile_t));
+		reset_tiles();
 		memset(m_cmd_data, 0, sizeof(m_cmd_data));
 
-		for (int32_t i = 0; i < 8; i++) {
-			m_tiles[i].num = i;
-			m_tiles[i].invmm = rgbaint_t(~0, ~0, ~0, ~0);
-			m_tiles[i].invmask = rgbaint_t(~0, ~0, ~0, ~0);
-		}
+		m_tmem_images.clear();
+		m_tmem_image_index.clear();
 
 		set_capture(capture);
 	}
 
 	void set_capture(pin64_t* capture) {
 		m_capture = capture;
+		m_capture->set_player(this);
 	}
 
+	// pin64_player_t
+	void save_keyframe(std::vector<pin64_block_t*>& blocks) override;
+	bool load_keyframe(std::vector<pin64_block_t*>& blocks) override;
+	void clear_state() override;
+	void execute_command() override { process_command(); }
+	uint64_t frame_hash() override;
+	void frame_hashes(pin64_frame_hashes_t& hashes) override;
+
 	uint32_t vi_origin() { return m_capture->vi_origin(); }
 	bool		commands_available() const { return m_capture->commands_left() > 0; }
-	void        process_command_list();
+	uint32_t    process_command_list();
 	void		process_command();
+
+	// runs a command that doesn't come from the capture; only band workers
+	// are fed commands this way
+	void        process_command(const pin64_command_t* command);
+
+	// whole command lists can be rasterized by several threads, each of which
+	// owns every count-th band of scanlines; 1 rasterizes on the calling
+	// thread only. No span depends on the spans drawn before it, so the
+	// output is the same for any thread count, including 1
+	void        set_threads(uint32_t count);
+	uint32_t    threads() const { return (uint32_t)m_workers.size() + 1; }
+
+	static const int32_t BAND_SHIFT = 3;
+
+	// single-stepping for the debugger; step_scanline draws one scanline more
+	// of the current command each call, and returns true once the whole
+	// command has been drawn
+	void        step_command();
+	bool        step_scanline();
 	void		reset();
 	uint64_t    read_data(uint32_t address);
 	void        disassemble(char* buffer, size_t buf_size);
@@ -230,6 +275,10 @@ public:
 	uint32_t    get_log2(uint32_t lod_clamp);
 	int32_t     get_alpha_cvg(int32_t comb_alpha);
 
+	// stands in for rand() in dithering and the noise input; reseeded for
+	// every scanline, so the result doesn't depend on which thread drew it
+	uint32_t    noise() { m_noise = m_noise * 1103515245 + 12345; return (m_noise >> 16) & 0x7fff; }
+
 	void        z_store(uint32_t zcurpixel, uint32_t dzcurpixel, uint32_t z, uint32_t enc);
 	uint32_t    z_decompress(uint32_t zcurpixel);
 	uint32_t    dz_decompress(uint32_t zcurpixel, uint32_t dzcurpixel);
@@ -343,7 +392,9 @@ public:
 
 	n64_texture_pipe_t  m_tex_pipe;
 
-	uint8_t m_hidden_bits[0x800000];
+	// shared with the band workers of a threaded renderer
+	uint8_t* m_hidden_bits;
+	std::unique_ptr<uint8_t[]> m_hidden_bits_storage;
 
 	uint8_t m_replicated_rgba[32];
 
@@ -358,6 +409,18 @@ public:
 
 	void            draw_triangle(bool shade, bool texture, bool zbuffer, bool rect);
 
+	// scanlines the current command has reached, the first it draws, and
+	// how many it may draw
+	uint32_t        m_spans_drawn;
+	uint32_t        m_span_first;
+	uint32_t        m_span_limit;
+
+	// the command being drawn a scanline at a time, and how far it has got
+	const pin64_command_t*  m_step_command;
+	uint32_t        m_step_spans;
+
+	uint32_t        m_noise;
+
 	std::unique_ptr<uint8_t[]>  m_aux_buf;
 	uint32_t          m_aux_buf_ptr;
 	uint32_t          m_aux_buf_index;
@@ -373,6 +436,12 @@ public:
 	pin64_t* m_capture;
 
 private:
+	friend class n64_band_worker_t;
+
+	// band workers share the memory of the renderer that owns them
+	n64_rdp(uint32_t* rdram, uint8_t* hidden_bits);
+	void    init_band_worker(const n64_rdp& owner, uint32_t band, uint32_t band_count);
+
 	void    compute_cvg_noflip(int32_t* majorx, int32_t* minorx, int32_t* majorxint, int32_t* minorxint, int32_t scanline, int32_t yh, int32_t yl, int32_t base);
 	void    compute_cvg_flip(int32_t* majorx, int32_t* minorx, int32_t* majorxint, int32_t* minorxint, int32_t scanline, int32_t yh, int32_t yl, int32_t base);
 
@@ -384,11 +453,43 @@ private:
 	void    precalc_cvmask_derivatives(void);
 	void    z_build_com_table(void);
 
+	typedef void (n64_rdp::*tmem_loader_t)(uint64_t w1, uint8_t* tmem);
+	void    load_tmem(uint64_t w1, tmem_loader_t loader);
+	n64_tmem_image_t* build_tmem_image(uint64_t w1, tmem_loader_t loader, const n64_tmem_key_t& key);
+	void    load_tlut_data(uint64_t w1, uint8_t* tmem);
+	void    load_block_data(uint64_t w1, uint8_t* tmem);
+	void    load_tile_data(uint64_t w1, uint8_t* tmem);
+
+	template <typename T> void keyframe_items(T& state);
+	void    clear_registers();
+	void    reset_tiles();
+	void    draw_step_spans(uint32_t first, uint32_t limit);
+
+	// threaded rasterization
+	uint32_t process_command_list_threaded();
+	bool    band_owns(int32_t scanline) const { return m_band_count == 1 || ((uint32_t)(scanline >> BAND_SHIFT) % m_band_count) == m_band; }
+	bool    draw_bands(const pin64_command_t* command, int32_t& first, int32_t& last) const;
+	void    begin_span(int32_t scanline);
+	void    copy_state(n64_rdp& other);
+	pin64_data_t* data_block();
+	void    save_keyframe_pages(std::vector<pin64_block_t*>& blocks, uint32_t region, uint8_t* base);
+
 	typedef void (n64_rdp::*compute_cvg_t) (int32_t* majorx, int32_t* minorx, int32_t* majorxint, int32_t* minorxint, int32_t scanline, int32_t yh, int32_t yl, int32_t base);
 	compute_cvg_t   m_compute_cvg[2];
 
 	uint32_t*         m_rdram;
 
+	// band workers, and the bands of scanlines this renderer draws
+	std::vector<std::unique_ptr<n64_band_worker_t>> m_workers;
+	uint32_t          m_band;
+	uint32_t          m_band_count;
+
+	// the command being run, and a reader over its data for band workers,
+	// which can't share the capture's
+	const pin64_command_t* m_command;
+	pin64_data_t      m_command_data;
+	pin64_dummy_data_t m_no_data;
+
 	combine_modes_t m_combine;
 	bool            m_pending_mode_block;
 
@@ -398,6 +499,10 @@ private:
 	uint32_t  m_z_complete_dec_table[0x4000]; //the same for decompressed z values, 14b
 	uint8_t   m_compressed_cvmasks[0x10000]; //16bit cvmask -> to byte
 
+	// playback texture loads, cached as the TMEM images they produce
+	std::vector<n64_tmem_image_t> m_tmem_images;
+	pin64_hash_table_t<uint32_t> m_tmem_image_index;
+
 	uint64_t    m_cmd_data[0x800];
 	uint64_t    m_temp_rect_data[0x800];
 
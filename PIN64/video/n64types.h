@@ -5,6 +5,7 @@
 #define _VIDEO_N64TYPES_H_
 
 #include "rgbutil.h"
+#include <vector>
 
 struct misc_state_t {
 	misc_state_t() {
@@ -228,6 +229,27 @@ struct z_decompress_entry_t {
 	uint32_t add;
 };
 
+// TMEM image produced by one load command: the block, command word and
+// tile parameters it depends on, and the TMEM byte ranges it writes
+struct n64_tmem_key_t {
+	uint64_t block;
+	uint64_t command;
+	uint64_t tile;
+};
+
+struct n64_tmem_span_t {
+	uint16_t offset;
+	uint16_t size;
+	uint32_t source;
+};
+
+struct n64_tmem_image_t {
+	n64_tmem_key_t key;
+	int32_t th;
+	std::vector<n64_tmem_span_t> spans;
+	std::vector<uint8_t> bytes;
+};
+
 struct cv_mask_derivative_t {
 	uint8_t cvg;
 	uint8_t cvbit;
@@ -0,0 +1,89 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+/******************************************************************************
+
+
+SGI/Nintendo Reality Display Processor Band Workers
+-------------------
+
+
+******************************************************************************/
+
+#include "n64.h"
+#include "rdpbands.h"
+
+n64_band_worker_t::n64_band_worker_t(n64_rdp& owner, uint32_t band, uint32_t band_count)
+	: m_rdp(new n64_rdp(owner.m_rdram, owner.m_hidden_bits))
+	, m_head(0)
+	, m_tail(0)
+	, m_sleeping(false)
+	, m_waiting(false)
+	, m_exit(false) {
+	m_rdp->init_band_worker(owner, band, band_count);
+	m_thread = std::thread(&n64_band_worker_t::worker, this);
+}
+
+n64_band_worker_t::~n64_band_worker_t() {
+	sync();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_exit = true;
+	}
+	m_wake.notify_one();
+	m_thread.join();
+}
+
+void n64_band_worker_t::push(const pin64_command_t* command) {
+	const size_t tail = m_tail.load(std::memory_order_relaxed);
+	if (tail - m_head.load(std::memory_order_acquire) == CAPACITY) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_waiting.store(true);
+		m_idle.wait(lock, [this, tail] { return tail - m_head.load() < CAPACITY; });
+		m_waiting.store(false);
+	}
+
+	m_ring[tail % CAPACITY] = command;
+	m_tail.store(tail + 1);
+
+	// only take the lock when the worker may be waiting for work
+	if (m_sleeping.load()) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_wake.notify_one();
+	}
+}
+
+void n64_band_worker_t::sync() {
+	const size_t tail = m_tail.load(std::memory_order_relaxed);
+	if (m_head.load() == tail)
+		return;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_waiting.store(true);
+	m_idle.wait(lock, [this, tail] { return m_head.load() == tail; });
+	m_waiting.store(false);
+}
+
+void n64_band_worker_t::worker() {
+	for (;;) {
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load()) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_sleeping.store(true);
+			m_wake.wait(lock, [this, head] { return m_exit || head != m_tail.load(); });
+			m_sleeping.store(false);
+			if (head == m_tail.load())
+				return;
+			continue;
+		}
+
+		m_rdp->process_command(m_ring[head % CAPACITY]);
+		m_head.store(head + 1);
+
+		// only take the lock when the owner may be waiting on this worker
+		if (m_waiting.load()) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_idle.notify_one();
+		}
+	}
+}
@@ -0,0 +1,63 @@
+// license:BSD-3-Clause
+// copyright-holders:Ryan Holtz
+/******************************************************************************
+
+
+SGI/Nintendo Reality Display Processor Band Workers
+-------------------
+
+Threaded rasterization: each worker is a copy of the renderer that runs
+every state command of a list, but only the draws that touch its bands of
+scanlines, and only draws the spans of its own bands.
+
+
+******************************************************************************/
+
+#ifndef _VIDEO_RDPBANDS_H_
+#define _VIDEO_RDPBANDS_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class n64_rdp;
+struct pin64_command_t;
+
+class n64_band_worker_t {
+public:
+	n64_band_worker_t(n64_rdp& owner, uint32_t band, uint32_t band_count);
+	~n64_band_worker_t();
+
+	n64_rdp& rdp() { return *m_rdp; }
+
+	// commands run in order, and have to stay valid until sync() returns
+	void push(const pin64_command_t* command);
+
+	// waits until every pushed command has run
+	void sync();
+
+	static const size_t CAPACITY = 1024;
+
+private:
+	void worker();
+
+	std::unique_ptr<n64_rdp> m_rdp;
+
+	const pin64_command_t* m_ring[CAPACITY];
+	std::atomic<size_t> m_head;
+	std::atomic<size_t> m_tail;
+	std::atomic<bool> m_sleeping;
+	std::atomic<bool> m_waiting;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_idle;
+	bool m_exit;
+};
+
+#endif // _VIDEO_RDPBANDS_H_
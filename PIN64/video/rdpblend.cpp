@@ -78,7 +78,7 @@ bool n64_blender_t::alpha_reject() {
 		return m_rdp->m_pixel_color.get_a() < m_rdp->m_blend_color.get_a();
 
 	case 3:
-		return m_rdp->m_pixel_color.get_a() < (rand() & 0xff);
+		return m_rdp->m_pixel_color.get_a() < (m_rdp->noise() & 0xff);
 
 	default:
 		return false;
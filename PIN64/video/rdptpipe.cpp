@@ -626,7 +626,11 @@ void n64_texture_pipe_t::fetch_rgba32_raw(rgbaint_t& out, int32_t s, int32_t t,
 	out.set(ch & 0xff, cl >> 8, cl & 0xff, ch >> 8);
 }
 
-void n64_texture_pipe_t::fetch_nop(rgbaint_t& out, int32_t s, int32_t t, int32_t tbase, int32_t tpal) {}
+void n64_texture_pipe_t::fetch_nop(rgbaint_t& out, int32_t s, int32_t t, int32_t tbase, int32_t tpal) {
+	// formats with no fetcher read as transparent black rather than whatever
+	// the texel held before
+	out.set(0, 0, 0, 0);
+}
 
 void n64_texture_pipe_t::fetch_yuv(rgbaint_t& out, int32_t s, int32_t t, int32_t tbase, int32_t tpal) {
 	const int32_t taddr = (((tbase << 3) + s) ^ sTexAddrSwap8[t & 1]) & 0x7ff;